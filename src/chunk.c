@@ -0,0 +1,373 @@
+/**
+ * @file chunk.c
+ * @author Gerviba (Szabo Gergely)
+ * @brief Chunked tile layer meshes
+ *
+ * @par Header:
+ * 		chunk.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stdgame.h"
+
+/** Number of face kinds of a tile (back base, front base and the four borders) */
+#define TILE_FACES 6
+
+/**
+ * Face of a tile
+ *
+ * Rotation (column-major 3x3) and offset of the unit quad. The first axis of the quad
+ * is parallel with X if mergeX is set, the second with Y if mergeY is set.
+ *
+ * The face is hidden if there is a foreground tile at the occluder offset: the back base
+ * behind a foreground tile and the borders facing a foreground neighbour.
+ */
+typedef struct {
+	GLfloat rotation[9];
+	GLfloat offset[3];
+	GLboolean mergeX;
+	GLboolean mergeY;
+	GLboolean occludable;
+	GLint occluder[2];
+} TileFace;
+
+/** The faces of a tile: back base, front base, top, left, bottom, right */
+static const TileFace TILE_FACE_INFO[TILE_FACES] = {
+		{{1.0f, 0.0f, 0.0f,	0.0f, 1.0f, 0.0f,	0.0f, 0.0f, 1.0f},	{0.0f, 0.0f, 0.0f}, GL_TRUE, GL_TRUE, GL_TRUE, {0, 0}},
+		{{1.0f, 0.0f, 0.0f,	0.0f, 1.0f, 0.0f,	0.0f, 0.0f, 1.0f},	{0.0f, 0.0f, 1.0f}, GL_TRUE, GL_TRUE, GL_FALSE, {0, 0}},
+		{{1.0f, 0.0f, 0.0f,	0.0f, 0.0f, -1.0f,	0.0f, 1.0f, 0.0f},	{0.0f, 1.0f, 1.0f}, GL_TRUE, GL_FALSE, GL_TRUE, {0, 1}},
+		{{0.0f, 0.0f, -1.0f,	0.0f, 1.0f, 0.0f,	1.0f, 0.0f, 0.0f},	{1.0f, 0.0f, 1.0f}, GL_FALSE, GL_TRUE, GL_TRUE, {1, 0}},
+		{{1.0f, 0.0f, 0.0f,	0.0f, 0.0f, 1.0f,	0.0f, -1.0f, 0.0f},	{0.0f, 0.0f, 0.0f}, GL_TRUE, GL_FALSE, GL_TRUE, {0, -1}},
+		{{0.0f, 0.0f, 1.0f,	0.0f, 1.0f, 0.0f,	-1.0f, 0.0f, 0.0f},	{0.0f, 0.0f, 0.0f}, GL_FALSE, GL_TRUE, GL_TRUE, {-1, 0}}
+};
+
+static GLint getFaceLayer(Tile *tile, int face);
+static TileChunk* getTileChunk(Map *map, GLint x, GLint y, GLboolean create);
+static void addChunkTile(TileChunk *chunk, Tile *tile);
+static void mergeFaces(MeshBuilder *builder, TileChunk *chunk, int face,
+		GLint cells[CHUNK_SIZE][CHUNK_SIZE]);
+static GLint rebuildTileChunk(Map *map, TileChunk *chunk, GLint *hiddenFaces);
+
+/**
+ * Texture layer of a tile face
+ *
+ * @param tile The tile
+ * @param face Index in TILE_FACE_INFO
+ * @return -1 if the face is not rendered
+ */
+static GLint getFaceLayer(Tile *tile, int face) {
+	switch (face) {
+		case 0: return (tile->type & TTMASK_RENDER_FRONT) == 0 ? tile->texture->base : -1;
+		case 1: return (tile->type & TTMASK_RENDER_FRONT) != 0 ? tile->texture->base : -1;
+		case 2: return (tile->type & TTMASK_RENDER_TOP) > 1 ? tile->texture->top : -1;
+		case 3: return (tile->type & TTMASK_RENDER_LEFT) > 1 ? tile->texture->left : -1;
+		case 4: return (tile->type & TTMASK_RENDER_BOTTOM) > 1 ? tile->texture->bottom : -1;
+		case 5: return (tile->type & TTMASK_RENDER_RIGHT) > 1 ? tile->texture->right : -1;
+	}
+	return -1;
+}
+
+/**
+ * Find the chunk at the given chunk coordinates
+ *
+ * @param map The map
+ * @param x Chunk X coordinate
+ * @param y Chunk Y coordinate
+ * @param create Create an empty (dirty) chunk if not found
+ * @return The chunk or NULL
+ */
+static TileChunk* getTileChunk(Map *map, GLint x, GLint y, GLboolean create) {
+	Iterator it;
+	foreach (it, map->chunks->first) {
+		TileChunk *chunk = it->data;
+		if (chunk->x == x && chunk->y == y)
+			return chunk;
+	}
+
+	if (!create)
+		return NULL;
+
+	TileChunk chunk;
+	chunk.x = x;
+	chunk.y = y;
+	chunk.dirty = GL_TRUE;
+	chunk.mesh.vao = 0;
+	chunk.mesh.indexCount = 0;
+	chunk.tiles = NULL;
+	chunk.tileCount = 0;
+	chunk.tileCapacity = 0;
+	listPush(map->chunks, &chunk);
+	return map->chunks->last->data;
+}
+
+/**
+ * Put a tile into the bucket of the chunk
+ *
+ * @param chunk The chunk of the tile
+ * @param tile The tile
+ */
+static void addChunkTile(TileChunk *chunk, Tile *tile) {
+	if (chunk->tileCount == chunk->tileCapacity) {
+		chunk->tileCapacity = chunk->tileCapacity == 0 ? CHUNK_SIZE : chunk->tileCapacity * 2;
+		chunk->tiles = realloc(chunk->tiles, sizeof(Tile *) * chunk->tileCapacity);
+	}
+	chunk->tiles[chunk->tileCount++] = tile;
+}
+
+/**
+ * Merge the faces with the same texture into rectangles
+ *
+ * Greedy: extends each face along X first, then along Y.
+ *
+ * @param builder Target builder
+ * @param chunk The chunk
+ * @param face Index in TILE_FACE_INFO
+ * @param cells Texture layers of the faces (-1 = no face). Merged cells are cleared.
+ */
+static void mergeFaces(MeshBuilder *builder, TileChunk *chunk, int face,
+		GLint cells[CHUNK_SIZE][CHUNK_SIZE]) {
+	const TileFace *info = &TILE_FACE_INFO[face];
+	int x, y, i, j;
+
+	for (y = 0; y < CHUNK_SIZE; ++y) {
+		for (x = 0; x < CHUNK_SIZE; ++x) {
+			GLint layer = cells[x][y];
+			if (layer == -1)
+				continue;
+
+			int width = 1, height = 1;
+			if (info->mergeX)
+				while (x + width < CHUNK_SIZE && cells[x + width][y] == layer)
+					++width;
+
+			if (info->mergeY) {
+				for (; y + height < CHUNK_SIZE; ++height) {
+					for (i = 0; i < width; ++i)
+						if (cells[x + i][y + height] != layer)
+							break;
+					if (i < width)
+						break;
+				}
+			}
+
+			for (i = 0; i < width; ++i)
+				for (j = 0; j < height; ++j)
+					cells[x + i][y + j] = -1;
+
+			const GLfloat *r = info->rotation;
+			meshAddTexturedQuad(builder, (GLfloat[]) {
+					r[0] * width, r[1] * width, r[2] * width, 0.0f,
+					r[3] * height, r[4] * height, r[5] * height, 0.0f,
+					r[6], r[7], r[8], 0.0f,
+					chunk->x * CHUNK_SIZE + x + info->offset[X],
+					chunk->y * CHUNK_SIZE + y + info->offset[Y],
+					info->offset[Z], 1.0f},
+					layer, info->mergeX ? width : 1.0f, info->mergeY ? height : 1.0f);
+		}
+	}
+}
+
+/**
+ * Rebuild the mesh of a chunk from its tiles
+ *
+ * The faces hidden by foreground tiles are left out (the border tiles of the neighbour
+ * chunks are also checked). The tile textures have no alpha, so a foreground tile covers
+ * its cell.
+ *
+ * @param map The map
+ * @param chunk The chunk
+ * @param hiddenFaces Output: count of the removed faces (can be NULL)
+ * @return Count of the faces before merging
+ */
+static GLint rebuildTileChunk(Map *map, TileChunk *chunk, GLint *hiddenFaces) {
+	static GLint cells[TILE_FACES][CHUNK_SIZE][CHUNK_SIZE];
+	static GLboolean foreground[CHUNK_SIZE + 2][CHUNK_SIZE + 2];
+	GLint faceCount = 0, hiddenCount = 0;
+	int face, i, dx, dy;
+
+	memset(cells, -1, sizeof(cells));
+	memset(foreground, GL_FALSE, sizeof(foreground));
+
+	for (dx = -1; dx <= 1; ++dx) {
+		for (dy = -1; dy <= 1; ++dy) {
+			TileChunk *neighbour = dx == 0 && dy == 0 ? chunk
+					: getTileChunk(map, chunk->x + dx, chunk->y + dy, GL_FALSE);
+			if (neighbour == NULL)
+				continue;
+
+			for (i = 0; i < neighbour->tileCount; ++i) {
+				Tile *tile = neighbour->tiles[i];
+				GLint x = (GLint) floorf(tile->x) - chunk->x * CHUNK_SIZE;
+				GLint y = (GLint) floorf(tile->y) - chunk->y * CHUNK_SIZE;
+				if (x >= -1 && y >= -1 && x <= CHUNK_SIZE && y <= CHUNK_SIZE && (tile->type & TTMASK_RENDER_FRONT) != 0)
+					foreground[x + 1][y + 1] = GL_TRUE;
+			}
+		}
+	}
+
+	for (i = 0; i < chunk->tileCount; ++i) {
+		Tile *tile = chunk->tiles[i];
+		GLint x = (GLint) floorf(tile->x) - chunk->x * CHUNK_SIZE;
+		GLint y = (GLint) floorf(tile->y) - chunk->y * CHUNK_SIZE;
+
+		for (face = 0; face < TILE_FACES; ++face) {
+			GLint layer = getFaceLayer(tile, face);
+			if (layer == -1)
+				continue;
+
+			const TileFace *info = &TILE_FACE_INFO[face];
+			if (info->occludable && foreground[x + 1 + info->occluder[X]][y + 1 + info->occluder[Y]]) {
+				++hiddenCount;
+				continue;
+			}
+
+			cells[face][x][y] = layer;
+			++faceCount;
+		}
+	}
+
+	if (hiddenFaces != NULL)
+		*hiddenFaces = hiddenCount;
+
+	MeshBuilder builder;
+	initMeshBuilder(&builder);
+	for (face = 0; face < TILE_FACES; ++face)
+		mergeFaces(&builder, chunk, face, cells[face]);
+
+	if (chunk->mesh.vao != 0)
+		freeMesh(&chunk->mesh);
+	uploadMesh(&chunk->mesh, &builder);
+	freeMeshBuilder(&builder);
+
+	chunk->dirty = GL_FALSE;
+	return faceCount;
+}
+
+/**
+ * Split the tile layer into chunks and build their meshes
+ *
+ * Called after the map is loaded. The tiles are put into the bucket of their chunk once,
+ * a chunk is rebuilt from its own bucket (and the buckets of its neighbours).
+ *
+ * @param map The map
+ */
+void buildTileChunks(Map *map) {
+	Iterator it;
+	foreach (it, map->tiles->first) {
+		Tile *tile = it->data;
+		addChunkTile(getTileChunk(map, (GLint) floorf(tile->x / CHUNK_SIZE),
+				(GLint) floorf(tile->y / CHUNK_SIZE), GL_TRUE), tile);
+	}
+
+	GLint faces = 0, hidden = 0, quads = 0, chunks = 0;
+	foreach (it, map->chunks->first) {
+		TileChunk *chunk = it->data;
+		GLint chunkHidden;
+		faces += rebuildTileChunk(map, chunk, &chunkHidden);
+		hidden += chunkHidden;
+		quads += chunk->mesh.indexCount / 6;
+		++chunks;
+	}
+
+	DEBUG("Map", "Tile layer: %d hidden faces removed, %d faces merged into %d quads in %d chunks",
+			hidden, faces, quads, chunks);
+}
+
+/**
+ * Mark the chunk of a tile for rebuild
+ *
+ * Must be called after a tile is pushed into Map::tiles or its type or texture is changed
+ * (the position of a tile is fixed). The mesh is rebuilt before the next time the chunk is
+ * rendered. A foreground tile can hide the faces of its neighbours, so the existing chunks
+ * next to the tile are also marked. The occlusion masks of the lights around the tile and
+ * the static layers of the shadow maps are also invalidated.
+ *
+ * @param this Actual GameInstance instance
+ * @param tile The new or changed tile
+ */
+void markTileChunkDirty(GameInstance *this, Tile *tile) {
+	Map *map = this->map;
+	const GLfloat x = tile->x, y = tile->y;
+	TileChunk *chunk = getTileChunk(map, (GLint) floorf(x / CHUNK_SIZE), (GLint) floorf(y / CHUNK_SIZE), GL_TRUE);
+
+	/** The cell is solid if any of its tiles is in the foreground */
+	const GLint cellX = (GLint) floorf(x), cellY = (GLint) floorf(y);
+	GLboolean found = GL_FALSE, solid = GL_FALSE;
+	int i;
+	for (i = 0; i < chunk->tileCount; ++i) {
+		const Tile *other = chunk->tiles[i];
+		found |= other == tile;
+		if ((GLint) floorf(other->x) == cellX && (GLint) floorf(other->y) == cellY)
+			solid |= (other->type & TTMASK_RENDER_FRONT) != 0;
+	}
+	if (!found) {
+		addChunkTile(chunk, tile);
+		solid |= (tile->type & TTMASK_RENDER_FRONT) != 0;
+	}
+	chunk->dirty = GL_TRUE;
+
+	markOcclusionDirty(map, cellX, cellY, solid);
+	invalidateShadowMaps(this);
+
+	int dx, dy;
+	for (dx = -1; dx <= 1; ++dx) {
+		for (dy = -1; dy <= 1; ++dy) {
+			TileChunk *neighbour = getTileChunk(map, (GLint) floorf((x + dx) / CHUNK_SIZE),
+					(GLint) floorf((y + dy) / CHUNK_SIZE), GL_FALSE);
+			if (neighbour != NULL)
+				neighbour->dirty = GL_TRUE;
+		}
+	}
+}
+
+/**
+ * Render the chunks inside the view frustum
+ *
+ * One draw call per chunk (submitted to the render queue).
+ *
+ * @param this Actual GameInstance instance
+ */
+void renderTileChunks(GameInstance *this) {
+	static const GLfloat IDENTITY[16] = {
+			1.0f, 0.0f, 0.0f, 0.0f,
+			0.0f, 1.0f, 0.0f, 0.0f,
+			0.0f, 0.0f, 1.0f, 0.0f,
+			0.0f, 0.0f, 0.0f, 1.0f};
+	static const GLfloat WHITE[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+	Iterator it;
+	foreach (it, this->map->chunks->first) {
+		TileChunk *chunk = it->data;
+
+		/** The area of the chunk is known, so a dirty chunk is not rebuilt if it is not visible */
+		const GLfloat min[3] = {chunk->x * CHUNK_SIZE, chunk->y * CHUNK_SIZE, 0.0f};
+		const GLfloat max[3] = {min[X] + CHUNK_SIZE, min[Y] + CHUNK_SIZE, 1.0f};
+		if (!isBoxInFrustum(this->camera->frustum, min, max))
+			continue;
+
+		if (chunk->dirty)
+			rebuildTileChunk(this->map, chunk, NULL);
+
+		submitRenderItem(this, RL_TILES, &chunk->mesh, this->map->textureArray, IDENTITY, WHITE);
+	}
+}
+
+/**
+ * Free the chunks of the map
+ *
+ * @param map The map
+ */
+void freeTileChunks(Map *map) {
+	Iterator it;
+	foreach (it, map->chunks->first) {
+		TileChunk *chunk = it->data;
+		if (chunk->mesh.vao != 0)
+			freeMesh(&chunk->mesh);
+		free(chunk->tiles);
+	}
+	listFree(map->chunks);
+	free(map->chunks);
+}
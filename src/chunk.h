@@ -0,0 +1,41 @@
+/**
+ * @file chunk.h
+ * @author Gerviba (Szabo Gergely)
+ * @brief Chunked tile layer meshes (header)
+ *
+ * @par Definition:
+ * 		chunk.c
+ */
+
+#ifndef CHUNK_H_
+#define CHUNK_H_
+
+#include "stdgame.h"
+
+/** Width and height of a chunk in tiles */
+#define CHUNK_SIZE 16
+
+/**
+ * CHUNK_SIZE x CHUNK_SIZE region of the tile layer
+ *
+ * The faces of the tiles are merged and baked into one mesh. The texture layers are
+ * stored in the vertices, so a chunk is rendered with one draw call.
+ * The tiles themselves stay in Map::tiles.
+ * @see markTileChunkDirty()
+ */
+struct TileChunk {
+	GLint x, y;
+	GLboolean dirty;
+	Mesh mesh;
+	/** Tiles inside the chunk (pointers into Map::tiles), filled by buildTileChunks() */
+	Tile **tiles;
+	GLint tileCount;
+	GLint tileCapacity;
+};
+
+void buildTileChunks(Map *map);
+void markTileChunkDirty(GameInstance *this, Tile *tile);
+void renderTileChunks(GameInstance *this);
+void freeTileChunks(Map *map);
+
+#endif /* CHUNK_H_ */
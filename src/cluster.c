@@ -0,0 +1,268 @@
+/**
+ * @file cluster.c
+ * @author Gerviba (Szabo Gergely)
+ * @brief Clustered light culling
+ *
+ * @par Header:
+ * 		cluster.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stdgame.h"
+
+static GLint getDepthSlice(const LightClusters *clusters, GLfloat depth);
+static GLboolean getTileRange(GLfloat ndcMin, GLfloat ndcMax, GLint count, GLint range[2]);
+static GLboolean getLightClusterBounds(const GameInstance *this, const LightClusters *clusters,
+		GLint light, GLint bounds[6]);
+static void assignLightClusters(GameInstance *this, LightClusters *clusters);
+
+/**
+ * Create the buffers of the clusters
+ *
+ * @param clusters The clusters
+ */
+void initLightClusters(LightClusters *clusters) {
+	clusters->ranges = calloc(CLUSTER_COUNT, sizeof(GLuint[2]));
+	clusters->indexCount = 0;
+	clusters->indexCapacity = LIGHT_INDEX_CAPACITY;
+	clusters->indices = malloc(sizeof(GLushort) * clusters->indexCapacity);
+	clusters->width = 0;
+	clusters->height = 0;
+	memset(clusters->viewMat, 0, sizeof(clusters->viewMat));
+	memset(clusters->scale, 0, sizeof(clusters->scale));
+
+	glGenBuffers(1, &clusters->rangeBuffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, clusters->rangeBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(GLuint[2]) * CLUSTER_COUNT, clusters->ranges, GL_STREAM_DRAW);
+	glGenTextures(1, &clusters->rangeTexture);
+	glBindTexture(GL_TEXTURE_BUFFER, clusters->rangeTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, clusters->rangeBuffer);
+
+	glGenBuffers(1, &clusters->indexBuffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, clusters->indexBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(GLushort) * clusters->indexCapacity, NULL, GL_STREAM_DRAW);
+	glGenTextures(1, &clusters->indexTexture);
+	glBindTexture(GL_TEXTURE_BUFFER, clusters->indexTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, clusters->indexBuffer);
+
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+/**
+ * Depth slice of a view space depth
+ *
+ * The slices are exponential between CLUSTER_DEPTH_NEAR and CLUSTER_DEPTH_FAR.
+ * Same as in the fragment shader.
+ *
+ * @param clusters The clusters (with the actual scale)
+ * @param depth View space depth (positive)
+ * @return Index of the slice
+ */
+static GLint getDepthSlice(const LightClusters *clusters, GLfloat depth) {
+	if (depth <= 0.0f)
+		return 0;
+
+	GLint slice = (GLint) floorf(logf(depth) * clusters->scale[Z] + clusters->scale[3]);
+	return slice < 0 ? 0 : slice >= CLUSTER_COUNT_Z ? CLUSTER_COUNT_Z - 1 : slice;
+}
+
+/**
+ * Screen tiles covered by a normalized device coordinate range
+ *
+ * @param ndcMin Minimum (-1 is the left or bottom side of the screen)
+ * @param ndcMax Maximum (1 is the right or top side of the screen)
+ * @param count Count of the tiles
+ * @param range First and last tile
+ * @return GL_FALSE if the range is off screen
+ */
+static GLboolean getTileRange(GLfloat ndcMin, GLfloat ndcMax, GLint count, GLint range[2]) {
+	if (ndcMax < -1.0f || ndcMin > 1.0f)
+		return GL_FALSE;
+
+	range[0] = (GLint) floorf((ndcMin + 1.0f) * 0.5f * count);
+	range[1] = (GLint) floorf((ndcMax + 1.0f) * 0.5f * count);
+	range[0] = range[0] < 0 ? 0 : range[0] >= count ? count - 1 : range[0];
+	range[1] = range[1] < 0 ? 0 : range[1] >= count ? count - 1 : range[1];
+	return GL_TRUE;
+}
+
+/**
+ * Clusters touched by the range of a light
+ *
+ * The range of the light is a sphere (the light has no effect further). The view space bounding
+ * box of the sphere is projected to the screen, so the result is conservative.
+ *
+ * @param this Actual GameInstance instance
+ * @param clusters The clusters
+ * @param light Index of the light in the LightBlock
+ * @param bounds First and last tile along X, Y and first and last depth slice
+ * @return GL_FALSE if the light is not visible
+ */
+static GLboolean getLightClusterBounds(const GameInstance *this, const LightClusters *clusters,
+		GLint light, GLint bounds[6]) {
+	const GLfloat *p = this->lighting->block.lightPosition[light];
+	const GLfloat *m = this->camera->viewMat;
+	GLfloat radius = getLightRange(&this->lighting->block, light);
+	if (radius <= 0.0f)
+		return GL_FALSE;
+
+	GLfloat view[3] = {
+			m[0] * p[X] + m[4] * p[Y] + m[8] * p[Z] + m[12],
+			m[1] * p[X] + m[5] * p[Y] + m[9] * p[Z] + m[13],
+			m[2] * p[X] + m[6] * p[Y] + m[10] * p[Z] + m[14]};
+	GLfloat nearDepth = -view[Z] - radius;
+	GLfloat farDepth = -view[Z] + radius;
+	if (farDepth <= 0.0f)
+		return GL_FALSE;
+
+	bounds[4] = getDepthSlice(clusters, nearDepth);
+	bounds[5] = getDepthSlice(clusters, farDepth);
+
+	if (nearDepth <= 0.0f) {
+		/** The camera is inside the range */
+		bounds[0] = 0;
+		bounds[1] = CLUSTER_COUNT_X - 1;
+		bounds[2] = 0;
+		bounds[3] = CLUSTER_COUNT_Y - 1;
+		return GL_TRUE;
+	}
+
+	GLfloat minX = INFINITY, maxX = -INFINITY, minY = INFINITY, maxY = -INFINITY;
+	GLfloat depths[2] = {nearDepth, farDepth};
+	int i, j;
+	for (i = 0; i < 2; ++i) {
+		for (j = -1; j <= 1; j += 2) {
+			GLfloat x = this->camera->projMat[0] * (view[X] + j * radius) / depths[i];
+			GLfloat y = this->camera->projMat[5] * (view[Y] + j * radius) / depths[i];
+			minX = fminf(minX, x);
+			maxX = fmaxf(maxX, x);
+			minY = fminf(minY, y);
+			maxY = fmaxf(maxY, y);
+		}
+	}
+
+	return getTileRange(minX, maxX, CLUSTER_COUNT_X, &bounds[0])
+			&& getTileRange(minY, maxY, CLUSTER_COUNT_Y, &bounds[2]);
+}
+
+/**
+ * Build the light lists of the clusters
+ *
+ * Counts the lights of the clusters first, then fills the index list.
+ *
+ * @param this Actual GameInstance instance
+ * @param clusters The clusters
+ */
+static void assignLightClusters(GameInstance *this, LightClusters *clusters) {
+	static GLint bounds[MAX_NUM_LIGHTS][6];
+	const GLint numLights = this->lighting->block.numLights;
+	GLint light, x, y, z, visible[MAX_NUM_LIGHTS];
+
+	memset(clusters->ranges, 0, sizeof(GLuint[2]) * CLUSTER_COUNT);
+
+	for (light = 0; light < numLights; ++light) {
+		visible[light] = getLightClusterBounds(this, clusters, light, bounds[light]);
+		if (!visible[light])
+			continue;
+
+		GLint *b = bounds[light];
+		for (z = b[4]; z <= b[5]; ++z)
+			for (y = b[2]; y <= b[3]; ++y)
+				for (x = b[0]; x <= b[1]; ++x)
+					++clusters->ranges[(z * CLUSTER_COUNT_Y + y) * CLUSTER_COUNT_X + x][1];
+	}
+
+	GLsizei offset = 0;
+	int i;
+	for (i = 0; i < CLUSTER_COUNT; ++i) {
+		clusters->ranges[i][0] = offset;
+		offset += clusters->ranges[i][1];
+		clusters->ranges[i][1] = 0;
+	}
+
+	if (offset > clusters->indexCapacity) {
+		while (offset > clusters->indexCapacity)
+			clusters->indexCapacity *= 2;
+		clusters->indices = realloc(clusters->indices, sizeof(GLushort) * clusters->indexCapacity);
+
+		glBindBuffer(GL_TEXTURE_BUFFER, clusters->indexBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(GLushort) * clusters->indexCapacity, NULL, GL_STREAM_DRAW);
+	}
+	clusters->indexCount = offset;
+
+	for (light = 0; light < numLights; ++light) {
+		if (!visible[light])
+			continue;
+
+		GLint *b = bounds[light];
+		for (z = b[4]; z <= b[5]; ++z) {
+			for (y = b[2]; y <= b[3]; ++y) {
+				for (x = b[0]; x <= b[1]; ++x) {
+					GLuint *range = clusters->ranges[(z * CLUSTER_COUNT_Y + y) * CLUSTER_COUNT_X + x];
+					clusters->indices[range[0] + range[1]++] = light;
+				}
+			}
+		}
+	}
+
+	glBindBuffer(GL_TEXTURE_BUFFER, clusters->rangeBuffer);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(GLuint[2]) * CLUSTER_COUNT, clusters->ranges);
+	if (clusters->indexCount > 0) {
+		glBindBuffer(GL_TEXTURE_BUFFER, clusters->indexBuffer);
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(GLushort) * clusters->indexCount, clusters->indices);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+/**
+ * Update the clusters and bind their textures
+ *
+ * The light lists are rebuilt only if the lights, the camera or the window size were changed.
+ * The uniforms are set by useShaderVariant().
+ *
+ * @note Must be called after the view matrix is updated and before LigingInfo::changed is cleared.
+ *
+ * @param this Actual GameInstance instance
+ */
+void updateLightClusters(GameInstance *this) {
+	LightClusters *clusters = &this->lighting->clusters;
+
+	int width, height;
+	glfwGetFramebufferSize(this->window, &width, &height);
+
+	if (this->lighting->changed || width != clusters->width || height != clusters->height
+			|| memcmp(clusters->viewMat, this->camera->viewMat, sizeof(clusters->viewMat)) != 0) {
+		clusters->width = width;
+		clusters->height = height;
+		memcpy(clusters->viewMat, this->camera->viewMat, sizeof(clusters->viewMat));
+
+		clusters->scale[X] = (GLfloat) CLUSTER_COUNT_X / width;
+		clusters->scale[Y] = (GLfloat) CLUSTER_COUNT_Y / height;
+		clusters->scale[Z] = CLUSTER_COUNT_Z / logf(CLUSTER_DEPTH_FAR / CLUSTER_DEPTH_NEAR);
+		clusters->scale[3] = -logf(CLUSTER_DEPTH_NEAR) * clusters->scale[Z];
+
+		assignLightClusters(this, clusters);
+	}
+
+	bindTexture(this, CLUSTER_TEXTURE_UNIT, GL_TEXTURE_BUFFER, clusters->rangeTexture);
+	bindTexture(this, CLUSTER_TEXTURE_UNIT + 1, GL_TEXTURE_BUFFER, clusters->indexTexture);
+}
+
+/**
+ * Free the buffers of the clusters
+ *
+ * @param clusters The clusters
+ */
+void freeLightClusters(LightClusters *clusters) {
+	glDeleteTextures(1, &clusters->rangeTexture);
+	glDeleteTextures(1, &clusters->indexTexture);
+	glDeleteBuffers(1, &clusters->rangeBuffer);
+	glDeleteBuffers(1, &clusters->indexBuffer);
+
+	free(clusters->ranges);
+	free(clusters->indices);
+}
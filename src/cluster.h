@@ -0,0 +1,60 @@
+/**
+ * @file cluster.h
+ * @author Gerviba (Szabo Gergely)
+ * @brief Clustered light culling (header)
+ *
+ * @par Definition:
+ * 		cluster.c
+ */
+
+#ifndef CLUSTER_H_
+#define CLUSTER_H_
+
+#include "stdgame.h"
+
+/** Screen tiles along X (same as in the fragment shader) */
+#define CLUSTER_COUNT_X 16
+/** Screen tiles along Y (same as in the fragment shader) */
+#define CLUSTER_COUNT_Y 8
+/** Depth slices (same as in the fragment shader) */
+#define CLUSTER_COUNT_Z 16
+/** Count of all the clusters */
+#define CLUSTER_COUNT (CLUSTER_COUNT_X * CLUSTER_COUNT_Y * CLUSTER_COUNT_Z)
+/** View space depth of the first slice boundary; closer fragments use the first slice */
+#define CLUSTER_DEPTH_NEAR 1.0f
+/** View space depth of the last slice boundary; further fragments use the last slice */
+#define CLUSTER_DEPTH_FAR 100.0f
+/** Light range at strength 1 (same as MAX_DIST in the fragment shader) */
+#define LIGHT_MAX_DIST 3.0f
+/** Texture unit of the cluster ranges (the light indices use the next one) */
+#define CLUSTER_TEXTURE_UNIT 1
+/** Initial capacity of the light index list */
+#define LIGHT_INDEX_CAPACITY 1024
+
+/**
+ * Light lists of the view clusters
+ *
+ * The view is split into CLUSTER_COUNT_X x CLUSTER_COUNT_Y screen tiles and CLUSTER_COUNT_Z
+ * exponential depth slices. Every cluster stores the range of its light indices (offset, count)
+ * in the index list. Both are uploaded into buffer textures, so a fragment only evaluates the
+ * lights of its own cluster.
+ */
+struct LightClusters {
+	GLuint (*ranges)[2];
+	GLushort *indices;
+	GLsizei indexCount;
+	GLsizei indexCapacity;
+
+	GLfloat scale[4];
+	GLfloat viewMat[16];
+	GLint width, height;
+
+	GLuint rangeBuffer, rangeTexture;
+	GLuint indexBuffer, indexTexture;
+};
+
+void initLightClusters(LightClusters *clusters);
+void updateLightClusters(GameInstance *this);
+void freeLightClusters(LightClusters *clusters);
+
+#endif /* CLUSTER_H_ */
@@ -409,6 +409,56 @@ void calcOptionsGraphicsButton(Component *comp, GameInstance *this) {
 				setColor(temp->text->baseColor, 0.992156863f, 0.909803922f, 0.529411765f,
 						temp->text->baseColor[A]);
 			}
+		} else if (temp->type == CT_TEXT && temp->id == 51) { /**< NO SHADOW */
+			if (!this->options->shadow) {
+				setColor(temp->text->baseColor, 0.992156863f, 0.909803922f, 0.529411765f,
+						temp->text->baseColor[A]);
+			} else {
+				setColor(temp->text->baseColor, 1.0f, 1.0f, 1.0f,
+						temp->text->baseColor[A]);
+			}
+		} else if (temp->type == CT_TEXT && temp->id == 52) { /**< MID SHADOW */
+			if (this->options->shadow && this->options->shadowResolution == SHADOW_RESOLUTION_MID
+					&& this->options->shadowLights == SHADOW_LIGHTS_MID) {
+				setColor(temp->text->baseColor, 0.992156863f, 0.909803922f, 0.529411765f,
+						temp->text->baseColor[A]);
+			} else {
+				setColor(temp->text->baseColor, 1.0f, 1.0f, 1.0f,
+						temp->text->baseColor[A]);
+			}
+		} else if (temp->type == CT_TEXT && temp->id == 53) { /**< AWESOME SHADOW */
+			if (this->options->shadow && this->options->shadowResolution == SHADOW_RESOLUTION_AWESOME
+					&& this->options->shadowLights == SHADOW_LIGHTS_AWESOME) {
+				setColor(temp->text->baseColor, 0.992156863f, 0.909803922f, 0.529411765f,
+						temp->text->baseColor[A]);
+			} else {
+				setColor(temp->text->baseColor, 1.0f, 1.0f, 1.0f,
+						temp->text->baseColor[A]);
+			}
+		} else if (temp->type == CT_TEXT && temp->id == 61) { /**< NEAR VIEW DISTANCE */
+			if (this->options->viewDistance == VIEW_DISTANCE_NEAR) {
+				setColor(temp->text->baseColor, 0.992156863f, 0.909803922f, 0.529411765f,
+						temp->text->baseColor[A]);
+			} else {
+				setColor(temp->text->baseColor, 1.0f, 1.0f, 1.0f,
+						temp->text->baseColor[A]);
+			}
+		} else if (temp->type == CT_TEXT && temp->id == 62) { /**< MID VIEW DISTANCE */
+			if (this->options->viewDistance == VIEW_DISTANCE_MID) {
+				setColor(temp->text->baseColor, 0.992156863f, 0.909803922f, 0.529411765f,
+						temp->text->baseColor[A]);
+			} else {
+				setColor(temp->text->baseColor, 1.0f, 1.0f, 1.0f,
+						temp->text->baseColor[A]);
+			}
+		} else if (temp->type == CT_TEXT && temp->id == 63) { /**< FAR VIEW DISTANCE */
+			if (this->options->viewDistance == VIEW_DISTANCE_FAR) {
+				setColor(temp->text->baseColor, 0.992156863f, 0.909803922f, 0.529411765f,
+						temp->text->baseColor[A]);
+			} else {
+				setColor(temp->text->baseColor, 1.0f, 1.0f, 1.0f,
+						temp->text->baseColor[A]);
+			}
 		}
 
 	}
@@ -651,6 +701,22 @@ void clickGraphicsSet(Component *comp, GameInstance *this) {
 		this->options->windowedWidth = 0;
 		this->options->windowedHeight = 0;
 		this->options->reloadProgram = GL_TRUE;
+	} else if (comp->id == 51) {
+		this->options->shadow = GL_FALSE;
+	} else if (comp->id == 52) {
+		this->options->shadow = GL_TRUE;
+		this->options->shadowResolution = SHADOW_RESOLUTION_MID;
+		this->options->shadowLights = SHADOW_LIGHTS_MID;
+	} else if (comp->id == 53) {
+		this->options->shadow = GL_TRUE;
+		this->options->shadowResolution = SHADOW_RESOLUTION_AWESOME;
+		this->options->shadowLights = SHADOW_LIGHTS_AWESOME;
+	} else if (comp->id == 61) {
+		this->options->viewDistance = VIEW_DISTANCE_NEAR;
+	} else if (comp->id == 62) {
+		this->options->viewDistance = VIEW_DISTANCE_MID;
+	} else if (comp->id == 63) {
+		this->options->viewDistance = VIEW_DISTANCE_FAR;
 	}
 }
 
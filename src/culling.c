@@ -0,0 +1,745 @@
+/**
+ * @file culling.c
+ * @author Gerviba (Szabo Gergely)
+ * @brief GPU culling of the dynamic and active object instances
+ *
+ * @par Header:
+ * 		culling.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stdgame.h"
+#include "shader.h"
+
+static int compareMeshIds(const void *a, const void *b);
+static void setCullCommand(DrawElementsIndirectCommand *command, const Mesh *mesh);
+static void addCullingMesh(GameInstance *this, DynamicObject *obj);
+static void addCullingLod(InstanceCulling *culling, DynamicObject *obj, ObjectLod lod);
+static GLuint getReferenceIndex(GameInstance *this, const ReferencePoint *reference);
+static void setCullInstance(GameInstance *this, CullInstance *instance, const DynamicObject *obj,
+		const GLfloat position[3], const GLfloat rotation[3], const GLfloat scale[3],
+		const ReferencePoint *reference, GLboolean visible);
+static void uploadDynamicInstances(GameInstance *this, Map *map);
+static void uploadActiveInstances(GameInstance *this);
+static void uploadReferences(GameInstance *this);
+static void drawCulledCommands(GameInstance *this, GLsizei first, GLsizei count);
+#ifdef DEBUG_CULLING
+static void checkCulling(GameInstance *this);
+#endif
+
+/**
+ * Compile the culling shader and create the buffers
+ *
+ * @note Must be called after initSceneBuffer().
+ *
+ * @param this Actual GameInstance instance
+ */
+void initInstanceCulling(GameInstance *this) {
+	InstanceCulling *culling = this->culling;
+	culling->enabled = GL_FALSE;
+	culling->pending = GL_FALSE;
+	culling->impostorsPending = GL_FALSE;
+	culling->program = 0;
+	culling->meshes = NULL;
+	culling->meshCount = 0;
+	culling->commands = NULL;
+	culling->commandCount = 0;
+	culling->impostorCommand = 0;
+	culling->instances = NULL;
+	culling->instanceCount = 0;
+	culling->dynamicCount = 0;
+	culling->instancesDirty = GL_FALSE;
+	culling->queued = NULL;
+	culling->queuedCount = 0;
+	culling->references = NULL;
+	culling->referenceCount = 0;
+	culling->matrixCapacity = 0;
+
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (!this->sceneBuffer->multiDraw || major < 4 || (major == 4 && minor < 3)) {
+		DEBUG("Info", "Compute shaders are not supported, the objects are culled on the CPU");
+		return;
+	}
+
+	culling->program = glCreateProgram();
+	if (shaderAttachFromFile(culling->program, GL_COMPUTE_SHADER, "assets/shaders/culling.compute", "") == 0) {
+		glDeleteProgram(culling->program);
+		return;
+	}
+
+	glLinkProgram(culling->program);
+	if (!shaderCheckProgram(culling->program, "Culling")) {
+		glDeleteProgram(culling->program);
+		return;
+	}
+
+	culling->instanceCountPosition = glGetUniformLocation(culling->program, "instanceCount");
+	culling->frustumPosition = glGetUniformLocation(culling->program, "frustum");
+	culling->cameraPosition = glGetUniformLocation(culling->program, "cameraPosition");
+
+	glGenBuffers(1, &culling->instanceBuffer);
+	glGenBuffers(1, &culling->meshBuffer);
+	glGenBuffers(1, &culling->commandBuffer);
+	glGenBuffers(1, &culling->matrixBuffer);
+	glGenBuffers(1, &culling->referenceBuffer);
+
+	culling->enabled = GL_TRUE;
+	DEBUG("Info", "GPU instance culling enabled");
+}
+
+/**
+ * Compare two objects by the id of the mesh (for qsort)
+ */
+static int compareMeshIds(const void *a, const void *b) {
+	const GLuint idA = (*(DynamicObject * const *) a)->mesh.id;
+	const GLuint idB = (*(DynamicObject * const *) b)->mesh.id;
+	return idA < idB ? -1 : idA > idB ? 1 : 0;
+}
+
+/**
+ * Set up the indirect draw command of a mesh (without instances)
+ */
+static void setCullCommand(DrawElementsIndirectCommand *command, const Mesh *mesh) {
+	command->count = mesh->indexCount;
+	command->instanceCount = 0;
+	command->firstIndex = mesh->firstIndex;
+	command->baseVertex = mesh->baseVertex;
+	command->baseInstance = 0;
+}
+
+/**
+ * Add the mesh of an object to the culling
+ *
+ * The transparent meshes and the meshes that are not stored as packed faces are drawn
+ * through the render queue. The command of the full mesh has the index of the mesh.
+ *
+ * @param this Actual GameInstance instance
+ * @param obj The object (or a part of an ActiveObject)
+ */
+static void addCullingMesh(GameInstance *this, DynamicObject *obj) {
+	InstanceCulling *culling = this->culling;
+	Mesh *mesh = &obj->mesh;
+	if (!mesh->packed || mesh->transparent) {
+		obj->cullMesh = CULL_NO_MESH;
+		return;
+	}
+
+	obj->cullMesh = culling->meshCount++;
+
+	CullMesh *cullMesh = &culling->meshes[obj->cullMesh];
+	memcpy(cullMesh->min, mesh->min, sizeof(GLfloat[3]));
+	memcpy(cullMesh->max, mesh->max, sizeof(GLfloat[3]));
+	cullMesh->min[3] = 0.0f;
+	cullMesh->max[3] = 0.0f;
+
+	/** DynamicObject::lodMat is a translation and a uniform scale */
+	memcpy(cullMesh->lodOffset, &obj->lodMat[12], sizeof(GLfloat[3]));
+	cullMesh->lodOffset[3] = obj->lodMat[0];
+
+	cullMesh->commands[LOD_FULL] = obj->cullMesh;
+	cullMesh->commands[LOD_COARSE] = CULL_NO_COMMAND;
+	cullMesh->commands[LOD_IMPOSTOR] = CULL_NO_COMMAND;
+	cullMesh->commands[3] = CULL_NO_COMMAND;
+	cullMesh->lodDistance = this->options->lodDistance;
+	cullMesh->impostorDistance = this->options->impostorDistance;
+	cullMesh->padding[0] = 0.0f;
+	cullMesh->padding[1] = 0.0f;
+
+	setCullCommand(&culling->commands[obj->cullMesh], mesh);
+}
+
+/**
+ * Add the command of a lower level of detail of an object to the culling
+ *
+ * The coarse meshes are drawn with the full meshes (packed faces), the impostors with
+ * drawCulledImpostors() (shared quads).
+ *
+ * @param culling The culling
+ * @param obj The object (or a part of an ActiveObject)
+ * @param lod LOD_COARSE or LOD_IMPOSTOR
+ */
+static void addCullingLod(InstanceCulling *culling, DynamicObject *obj, ObjectLod lod) {
+	const Mesh *mesh = lod == LOD_COARSE ? &obj->lodMesh : &obj->impostorMesh;
+	if (obj->cullMesh == CULL_NO_MESH || mesh->indexCount == 0
+			|| (lod == LOD_COARSE ? !mesh->packed : !mesh->shared))
+		return;
+
+	culling->meshes[obj->cullMesh].commands[lod] = culling->commandCount;
+	setCullCommand(&culling->commands[culling->commandCount++], mesh);
+}
+
+/**
+ * Collect the meshes of the dynamic and active objects of the map
+ *
+ * The commands are ordered by the mesh ids, so the objects are drawn in the same order as
+ * through the render queue (it matters on the coplanar faces). The commands of the full
+ * meshes are followed by the ones of the coarse meshes and the impostors.
+ *
+ * @note Called after the map and its impostors are loaded.
+ *
+ * @param this Actual GameInstance instance
+ * @param map The map
+ */
+void buildCullingMeshes(GameInstance *this, Map *map) {
+	InstanceCulling *culling = this->culling;
+	Iterator it;
+	int i;
+
+	if (!culling->enabled) {
+		foreach (it, map->objects->dynamicObjects->first)
+			((DynamicObject *) it->data)->cullMesh = CULL_NO_MESH;
+		foreach (it, map->objects->activeObjects->first) {
+			ActiveObject *aobj = it->data;
+			for (i = 0; i < aobj->size; ++i)
+				aobj->parts[i].cullMesh = CULL_NO_MESH;
+		}
+		return;
+	}
+
+	GLsizei meshes = 0;
+	foreach (it, map->objects->dynamicObjects->first)
+		++meshes;
+	foreach (it, map->objects->activeObjects->first)
+		meshes += ((ActiveObject *) it->data)->size;
+
+	DynamicObject **objects = malloc(sizeof(DynamicObject *) * max(meshes, 1));
+	meshes = 0;
+	foreach (it, map->objects->dynamicObjects->first)
+		objects[meshes++] = it->data;
+	foreach (it, map->objects->activeObjects->first) {
+		ActiveObject *aobj = it->data;
+		for (i = 0; i < aobj->size; ++i)
+			objects[meshes++] = &aobj->parts[i];
+	}
+	qsort(objects, meshes, sizeof(DynamicObject *), compareMeshIds);
+
+	free(culling->meshes);
+	free(culling->commands);
+	free(culling->instances);
+	culling->meshes = malloc(sizeof(CullMesh) * max(meshes, 1));
+	/** At most one command per level of detail */
+	culling->commands = malloc(sizeof(DrawElementsIndirectCommand) * max(meshes * 3, 1));
+	culling->meshCount = 0;
+
+	for (i = 0; i < meshes; ++i)
+		addCullingMesh(this, objects[i]);
+	culling->commandCount = culling->meshCount;
+	for (i = 0; i < meshes; ++i)
+		addCullingLod(culling, objects[i], LOD_COARSE);
+	culling->impostorCommand = culling->commandCount;
+	for (i = 0; i < meshes; ++i)
+		addCullingLod(culling, objects[i], LOD_IMPOSTOR);
+	free(objects);
+
+	/** Every instance can be visible, so the matrix range of a mesh is sized by its instances */
+	culling->instanceCount = 0;
+	culling->queuedCount = 0;
+	foreach (it, map->objects->dynamicInstances->first) {
+		DynamicObjectInstance *instance = it->data;
+		if (instance->object->cullMesh != CULL_NO_MESH)
+			++culling->commands[instance->object->cullMesh].baseInstance;
+		else
+			++culling->queuedCount;
+		++culling->instanceCount;
+	}
+	culling->dynamicCount = culling->instanceCount;
+	foreach (it, map->objects->activeInstances->first) {
+		ActiveObjectInstance *instance = it->data;
+		for (i = 0; i < instance->object->size; ++i)
+			if (instance->object->parts[i].cullMesh != CULL_NO_MESH)
+				++culling->commands[instance->object->parts[i].cullMesh].baseInstance;
+		++culling->instanceCount;
+	}
+
+	int j;
+	for (i = 0; i < culling->meshCount; ++i)
+		for (j = LOD_COARSE; j <= LOD_IMPOSTOR; ++j)
+			if (culling->meshes[i].commands[j] != CULL_NO_COMMAND)
+				culling->commands[culling->meshes[i].commands[j]].baseInstance = culling->commands[i].baseInstance;
+
+	culling->matrixCapacity = 0;
+	for (i = 0; i < culling->commandCount; ++i) {
+		const GLuint count = culling->commands[i].baseInstance;
+		culling->commands[i].baseInstance = culling->matrixCapacity;
+		culling->matrixCapacity += count;
+	}
+
+	free(culling->queued);
+	culling->queued = malloc(sizeof(DynamicObjectInstance *) * max(culling->queuedCount, 1));
+	culling->queuedCount = 0;
+	foreach (it, map->objects->dynamicInstances->first) {
+		DynamicObjectInstance *instance = it->data;
+		if (instance->object->cullMesh == CULL_NO_MESH)
+			culling->queued[culling->queuedCount++] = instance;
+	}
+
+	free(culling->references);
+	culling->referenceCount = 0;
+	foreach (it, this->referencePoints->first)
+		++culling->referenceCount;
+	culling->references = malloc(sizeof(CullReference) * max(culling->referenceCount, 1));
+
+	culling->instances = malloc(sizeof(CullInstance) * max(culling->instanceCount, 1));
+	culling->pending = GL_FALSE;
+	culling->impostorsPending = GL_FALSE;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->meshBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(CullMesh) * max(culling->meshCount, 1),
+			culling->meshes, GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->commandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawElementsIndirectCommand) * max(culling->commandCount, 1),
+			NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->matrixBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLfloat[16]) * max(culling->matrixCapacity, 1),
+			NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->instanceBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(CullInstance) * max(culling->instanceCount, 1),
+			NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	uploadDynamicInstances(this, map);
+
+	DEBUG("Object", "%d meshes (%d commands) and %d instances are culled on the GPU", culling->meshCount,
+			culling->commandCount, culling->instanceCount);
+}
+
+/**
+ * Get the index of a reference point in GameInstance::referencePoints
+ *
+ * @param this Actual GameInstance instance
+ * @param reference The reference point
+ * @return Index of the reference point (0 if it is not found)
+ */
+static GLuint getReferenceIndex(GameInstance *this, const ReferencePoint *reference) {
+	GLuint index = 0;
+	Iterator it;
+	foreach (it, this->referencePoints->first) {
+		if (it->data == reference)
+			return index;
+		++index;
+	}
+	return 0;
+}
+
+/**
+ * Set an instance of the input of the culling
+ *
+ * @param this Actual GameInstance instance
+ * @param instance The instance slot
+ * @param obj The object (or the active part of an ActiveObject)
+ * @param position Position of the instance
+ * @param rotation Rotation of the instance
+ * @param scale Scale of the instance
+ * @param reference Reference point of the instance
+ * @param visible The instance is culled (not hidden and not drawn through the render queue)
+ */
+static void setCullInstance(GameInstance *this, CullInstance *instance, const DynamicObject *obj,
+		const GLfloat position[3], const GLfloat rotation[3], const GLfloat scale[3],
+		const ReferencePoint *reference, GLboolean visible) {
+	int i;
+	for (i = 0; i < 3; ++i) {
+		instance->position[i] = obj->position[i] + position[i];
+		instance->rotation[i] = obj->rotation[i] + rotation[i];
+		instance->scale[i] = obj->scale[i] * scale[i];
+	}
+	instance->position[3] = 0.0f;
+	instance->rotation[3] = 0.0f;
+	instance->scale[3] = 0.0f;
+	instance->mesh = visible ? obj->cullMesh : 0;
+	instance->reference = getReferenceIndex(this, reference);
+	instance->visible = visible;
+	instance->padding = 0;
+}
+
+/**
+ * Upload the dynamic instances of a map
+ *
+ * Called when the map is loaded and after the instances are changed by an action.
+ *
+ * @param this Actual GameInstance instance
+ * @param map The map
+ */
+static void uploadDynamicInstances(GameInstance *this, Map *map) {
+	InstanceCulling *culling = this->culling;
+	CullInstance *instance = culling->instances;
+	Iterator it;
+
+	foreach (it, map->objects->dynamicInstances->first) {
+		DynamicObjectInstance *dynamic = it->data;
+		setCullInstance(this, instance++, dynamic->object, dynamic->position, dynamic->rotation,
+				dynamic->scale, dynamic->reference,
+				dynamic->visible && dynamic->object->cullMesh != CULL_NO_MESH);
+	}
+
+	if (culling->dynamicCount > 0) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->instanceBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(CullInstance) * culling->dynamicCount,
+				culling->instances);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+	culling->instancesDirty = GL_FALSE;
+}
+
+/**
+ * Upload the active instances (after the dynamic ones)
+ *
+ * The game logic changes them directly every frame (animations, spells), but there are only a
+ * few of them. The parts which are not handled by the culling are submitted to the render
+ * queue.
+ *
+ * @param this Actual GameInstance instance
+ */
+static void uploadActiveInstances(GameInstance *this) {
+	InstanceCulling *culling = this->culling;
+	CullInstance *instance = &culling->instances[culling->dynamicCount];
+	Iterator it;
+
+	foreach (it, this->map->objects->activeInstances->first) {
+		ActiveObjectInstance *active = it->data;
+		DynamicObject *obj = active->object->parts + active->activePart;
+		if (obj->cullMesh == CULL_NO_MESH)
+			renderActiveObject(this, active);
+		setCullInstance(this, instance++, obj, active->position, active->rotation, active->scale,
+				active->reference, active->visible && obj->cullMesh != CULL_NO_MESH);
+	}
+
+	if (culling->instanceCount > culling->dynamicCount) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->instanceBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(CullInstance) * culling->dynamicCount,
+				sizeof(CullInstance) * (culling->instanceCount - culling->dynamicCount),
+				&culling->instances[culling->dynamicCount]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+}
+
+/**
+ * Upload the reference points of the frame
+ *
+ * @param this Actual GameInstance instance
+ */
+static void uploadReferences(GameInstance *this) {
+	InstanceCulling *culling = this->culling;
+	CullReference *reference = culling->references;
+	Iterator it;
+
+	foreach (it, this->referencePoints->first) {
+		const ReferencePoint *point = it->data;
+		memcpy(reference->position, point->position, sizeof(GLfloat[3]));
+		memcpy(reference->rotation, point->rotation, sizeof(GLfloat[3]));
+		memcpy(reference->scale, point->scale, sizeof(GLfloat[3]));
+		reference->position[3] = 0.0f;
+		reference->rotation[3] = 0.0f;
+		reference->scale[3] = 0.0f;
+		++reference;
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->referenceBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(CullReference) * max(culling->referenceCount, 1),
+			NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(CullReference) * culling->referenceCount,
+			culling->references);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+/**
+ * Upload the dynamic instances again before the next culling
+ *
+ * Must be called after the dynamic instances are changed (see activateAction()).
+ *
+ * @param this Actual GameInstance instance
+ */
+void invalidateCullInstances(GameInstance *this) {
+	this->culling->instancesDirty = GL_TRUE;
+}
+
+/**
+ * Cull the dynamic and active object instances of the map
+ *
+ * The reference points, the active instances and the changed dynamic instances are uploaded
+ * and the culling shader is dispatched. The result is drawn by the render queue
+ * (drawCulledInstances() and drawCulledImpostors()). The objects which are not handled by the
+ * culling are submitted to the render queue.
+ *
+ * @note The camera frustum must be updated before.
+ *
+ * @param this Actual GameInstance instance
+ */
+void cullObjectInstances(GameInstance *this) {
+	InstanceCulling *culling = this->culling;
+
+	int i;
+	for (i = 0; i < culling->queuedCount; ++i)
+		renderDynamicObject(this, culling->queued[i]);
+
+	if (culling->instanceCount == 0)
+		return;
+
+	if (culling->instancesDirty)
+		uploadDynamicInstances(this, this->map);
+	uploadActiveInstances(this);
+	uploadReferences(this);
+
+	/** Reset the instance counters of the commands */
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->commandBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(DrawElementsIndirectCommand) * culling->commandCount,
+			culling->commands);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	useProgram(this, culling->program);
+	setUniform1ui(this, culling->instanceCountPosition, culling->instanceCount);
+	setUniform4fv(this, culling->frustumPosition, 6, this->camera->frustum[0]);
+	setUniform3fv(this, culling->cameraPosition, this->camera->position);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, culling->instanceBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, culling->meshBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, culling->commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, culling->matrixBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, culling->referenceBuffer);
+
+	glDispatchCompute((culling->instanceCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+	useProgram(this, this->shader->shaderId);
+	culling->pending = GL_TRUE;
+	culling->impostorsPending = culling->impostorCommand < culling->commandCount;
+
+#ifdef DEBUG_CULLING
+	checkCulling(this);
+#endif
+}
+
+/**
+ * Draw a range of the culled commands with one multi-draw call
+ *
+ * The texture, the VAO and the base color must be set before.
+ *
+ * @param this Actual GameInstance instance
+ * @param first First command
+ * @param count Count of the commands
+ */
+static void drawCulledCommands(GameInstance *this, GLsizei first, GLsizei count) {
+	InstanceCulling *culling = this->culling;
+	RenderStats *stats = &this->renderQueue->current;
+
+	int j;
+	glBindBuffer(GL_ARRAY_BUFFER, culling->matrixBuffer);
+	for (j = 0; j < 4; ++j)
+		glVertexAttribPointer(INSTANCE_MAT_ATTRIBUTE + j, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat[16]),
+				(void *) (sizeof(GLfloat[4]) * j));
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culling->commandBuffer);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+			(void *) (sizeof(DrawElementsIndirectCommand) * first), count, 0);
+
+	++stats->drawCalls;
+	++stats->textureBinds;
+	++stats->meshBinds;
+	++stats->uniformUploads;
+	stats->indirectCommands += count;
+}
+
+/**
+ * Draw the full and coarse meshes of the culling result with one multi-draw call
+ *
+ * Called by the render queue after the opaque tiles. The texture, the VAO, the base color,
+ * the array buffer and the indirect buffer bindings are changed.
+ *
+ * @param this Actual GameInstance instance
+ */
+void drawCulledInstances(GameInstance *this) {
+	static const GLfloat WHITE[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+	InstanceCulling *culling = this->culling;
+
+	if (!culling->pending)
+		return;
+	culling->pending = GL_FALSE;
+
+	bindTexture(this, 0, GL_TEXTURE_2D_ARRAY, this->map->textureArray);
+	setUniform4fv(this, this->shader->baseColor, 1, WHITE);
+	bindVertexArray(this, this->sceneBuffer->faceVao);
+	setUniform1i(this, this->shader->packedFaces, GL_TRUE);
+	drawCulledCommands(this, 0, culling->impostorCommand);
+}
+
+/**
+ * Draw the impostors of the culling result with one multi-draw call
+ *
+ * Called by the render queue before the transparent items. The impostors are the farthest
+ * objects, so they are blended first. The output of the shader is not sorted, so the
+ * transparent pixels of the quads are discarded (they would hide the impostors behind them).
+ * The same bindings are changed as by drawCulledInstances().
+ *
+ * @param this Actual GameInstance instance
+ */
+void drawCulledImpostors(GameInstance *this) {
+	static const GLfloat WHITE[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+	InstanceCulling *culling = this->culling;
+
+	if (!culling->impostorsPending)
+		return;
+	culling->impostorsPending = GL_FALSE;
+
+	bindTexture(this, 0, GL_TEXTURE_2D_ARRAY, this->map->objects->impostorAtlas);
+	setUniform4fv(this, this->shader->baseColor, 1, WHITE);
+	bindVertexArray(this, this->sceneBuffer->vao);
+	setUniform1i(this, this->shader->packedFaces, GL_FALSE);
+	setUniform1f(this, this->shader->alphaCutoff, CULL_IMPOSTOR_ALPHA_CUTOFF);
+	drawCulledCommands(this, culling->impostorCommand, culling->commandCount - culling->impostorCommand);
+	setUniform1f(this, this->shader->alphaCutoff, 0.0f);
+}
+
+/**
+ * CPU reference of the culling shader
+ *
+ * Culls the instances (InstanceCulling::instances with InstanceCulling::references) and
+ * selects their level of detail the same way as the shader, using the matrix.c and lod.c methods. The instances of
+ * a command are in submit order (the order of the shader output is not defined).
+ *
+ * @param culling The culling
+ * @param frustum Frustum planes
+ * @param camera Position of the camera
+ * @param commands Output commands (InstanceCulling::commandCount)
+ * @param matrices Output matrices (InstanceCulling::matrixCapacity)
+ */
+void cullInstancesReference(InstanceCulling *culling, GLfloat frustum[6][4], const GLfloat camera[3],
+		DrawElementsIndirectCommand *commands, GLfloat (*matrices)[16]) {
+	memcpy(commands, culling->commands, sizeof(DrawElementsIndirectCommand) * culling->commandCount);
+
+	int i;
+	for (i = 0; i < culling->instanceCount; ++i) {
+		const CullInstance *instance = &culling->instances[i];
+		if (!instance->visible)
+			continue;
+		const CullMesh *mesh = &culling->meshes[instance->mesh];
+		const CullReference *reference = &culling->references[instance->reference];
+
+		GLfloat position[3], rotation[3], scale[3];
+		int j;
+		for (j = 0; j < 3; ++j) {
+			position[j] = instance->position[j] + reference->position[j];
+			rotation[j] = instance->rotation[j] + reference->rotation[j];
+			scale[j] = instance->scale[j] * reference->scale[j];
+		}
+
+		GLfloat moveMat[16], lodMat[16], offsetMat[16], min[3], max[3];
+		mat4Identity(moveMat);
+		mat4Translate(moveMat, position[X], position[Y], position[Z]);
+		mat4Scale(moveMat, scale[X], scale[Y], scale[Z]);
+		mat4Rotate(moveMat, -rotation[X], 1.0f, 0.0f, 0.0f);
+		mat4Rotate(moveMat, -rotation[Y], 0.0f, 1.0f, 0.0f);
+		mat4Rotate(moveMat, -rotation[Z], 0.0f, 0.0f, 1.0f);
+
+		transformBox(min, max, moveMat, mesh->min, mesh->max);
+		if (!isBoxInFrustum(frustum, min, max))
+			continue;
+
+		/** Same as getObjectLod() and submitObjectLod() */
+		const GLfloat dx = position[X] - camera[X];
+		const GLfloat dy = position[Y] - camera[Y];
+		const GLfloat dz = position[Z] - camera[Z];
+		const GLfloat distance = dx * dx + dy * dy + dz * dz;
+
+		DrawElementsIndirectCommand *command;
+		if (mesh->commands[LOD_IMPOSTOR] != CULL_NO_COMMAND
+				&& distance >= mesh->impostorDistance * mesh->impostorDistance) {
+			command = &commands[mesh->commands[LOD_IMPOSTOR]];
+			getImpostorMatrix(lodMat, moveMat);
+		} else if (mesh->commands[LOD_COARSE] != CULL_NO_COMMAND
+				&& distance >= mesh->lodDistance * mesh->lodDistance) {
+			command = &commands[mesh->commands[LOD_COARSE]];
+			mat4Identity(offsetMat);
+			mat4Translate(offsetMat, mesh->lodOffset[X], mesh->lodOffset[Y], mesh->lodOffset[Z]);
+			mat4Scale(offsetMat, mesh->lodOffset[3], mesh->lodOffset[3], mesh->lodOffset[3]);
+			mat4Multiply(lodMat, moveMat, offsetMat);
+		} else {
+			command = &commands[mesh->commands[LOD_FULL]];
+			memcpy(lodMat, moveMat, sizeof(lodMat));
+		}
+
+		memcpy(matrices[command->baseInstance + command->instanceCount], lodMat, sizeof(GLfloat[16]));
+		++command->instanceCount;
+	}
+}
+
+#ifdef DEBUG_CULLING
+/**
+ * Compare the output of the culling shader with the CPU reference
+ *
+ * @warning Reads back the buffers (stalls the pipeline).
+ *
+ * @param this Actual GameInstance instance
+ */
+static void checkCulling(GameInstance *this) {
+	InstanceCulling *culling = this->culling;
+	DrawElementsIndirectCommand *gpuCommands = malloc(sizeof(DrawElementsIndirectCommand) * culling->commandCount);
+	DrawElementsIndirectCommand *cpuCommands = malloc(sizeof(DrawElementsIndirectCommand) * culling->commandCount);
+	GLfloat (*gpuMatrices)[16] = malloc(sizeof(GLfloat[16]) * max(culling->matrixCapacity, 1));
+	GLfloat (*cpuMatrices)[16] = malloc(sizeof(GLfloat[16]) * max(culling->matrixCapacity, 1));
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->commandBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(DrawElementsIndirectCommand) * culling->commandCount,
+			gpuCommands);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->matrixBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLfloat[16]) * culling->matrixCapacity, gpuMatrices);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	cullInstancesReference(culling, this->camera->frustum, this->camera->position, cpuCommands, cpuMatrices);
+
+	GLint visible = 0, errors = 0;
+	int i, j, k, l;
+	for (i = 0; i < culling->commandCount; ++i) {
+		const GLuint first = cpuCommands[i].baseInstance;
+		if (gpuCommands[i].instanceCount != cpuCommands[i].instanceCount) {
+			WARNING("Culling command %d: %u instances on the GPU, %u on the CPU", i,
+					gpuCommands[i].instanceCount, cpuCommands[i].instanceCount);
+			++errors;
+			continue;
+		}
+
+		/** The GPU output is unordered */
+		for (j = 0; j < cpuCommands[i].instanceCount; ++j) {
+			for (k = 0; k < gpuCommands[i].instanceCount; ++k) {
+				for (l = 0; l < 16 && fabsf(cpuMatrices[first + j][l] - gpuMatrices[first + k][l]) < 0.001f; ++l);
+				if (l == 16)
+					break;
+			}
+			if (k == gpuCommands[i].instanceCount) {
+				WARNING("Culling command %d: instance matrix %d not found in the GPU output", i, j);
+				++errors;
+			}
+		}
+		visible += cpuCommands[i].instanceCount;
+	}
+	DEBUG("Culling", "%d of %d instances visible, %d mismatches", visible, culling->instanceCount, errors);
+
+	free(gpuCommands);
+	free(cpuCommands);
+	free(gpuMatrices);
+	free(cpuMatrices);
+}
+#endif
+
+/**
+ * Free the culling shader, the buffers and the storage
+ *
+ * @param culling The culling
+ */
+void freeInstanceCulling(InstanceCulling *culling) {
+	if (culling->enabled) {
+		glDeleteProgram(culling->program);
+		glDeleteBuffers(1, &culling->instanceBuffer);
+		glDeleteBuffers(1, &culling->meshBuffer);
+		glDeleteBuffers(1, &culling->commandBuffer);
+		glDeleteBuffers(1, &culling->matrixBuffer);
+		glDeleteBuffers(1, &culling->referenceBuffer);
+	}
+	free(culling->meshes);
+	free(culling->commands);
+	free(culling->instances);
+	free(culling->queued);
+	free(culling->references);
+	culling->enabled = GL_FALSE;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file culling.h
+ * @author Gerviba (Szabo Gergely)
+ * @brief GPU culling of the dynamic and active object instances (header)
+ *
+ * @par Definition:
+ * 		culling.c
+ */
+
+#ifndef CULLING_H_
+#define CULLING_H_
+
+#include "stdgame.h"
+
+/** Work group size of the culling compute shader (local_size_x) */
+#define CULL_GROUP_SIZE 64
+/** Value of DynamicObject::cullMesh if the object is drawn through the render queue */
+#define CULL_NO_MESH -1
+/** Value of CullMesh::commands if the object has no mesh for that level of detail */
+#define CULL_NO_COMMAND 0xFFFFFFFFu
+/** Alpha below which the fragments of the culled impostors are discarded */
+#define CULL_IMPOSTOR_ALPHA_CUTOFF 0.5f
+
+/**
+ * Input instance of the culling shader (std430 layout)
+ *
+ * The transformation is the sum of the object and the instance values (the product for the
+ * scale). The shader adds the reference point.
+ */
+struct CullInstance {
+	GLfloat position[4];
+	GLfloat rotation[4];
+	GLfloat scale[4];
+	/** Index of the mesh (DynamicObject::cullMesh) */
+	GLuint mesh;
+	/** Index of the reference point (in GameInstance::referencePoints) */
+	GLuint reference;
+	/** Hidden instances and the ones drawn through the render queue are skipped */
+	GLuint visible;
+	GLuint padding;
+};
+
+/**
+ * Reference point of the culling shader (std430 layout)
+ */
+struct CullReference {
+	GLfloat position[4];
+	GLfloat rotation[4];
+	GLfloat scale[4];
+};
+
+/**
+ * Mesh of the culling shader (std430 layout)
+ *
+ * The level of detail is selected the same way as by getObjectLod().
+ */
+struct CullMesh {
+	/** Bounding box of the full mesh (model space) */
+	GLfloat min[4];
+	GLfloat max[4];
+	/** Origin (xyz) and scale (w) of the coarse mesh (DynamicObject::lodMat) */
+	GLfloat lodOffset[4];
+	/** Command of every level of detail (indexed by ObjectLod, or CULL_NO_COMMAND) */
+	GLuint commands[4];
+	/** Options::lodDistance and Options::impostorDistance */
+	GLfloat lodDistance;
+	GLfloat impostorDistance;
+	GLfloat padding[2];
+};
+
+/**
+ * GPU instance culling
+ *
+ * The instances of the opaque dynamic objects of the map are uploaded once (and again after
+ * invalidateCullInstances()), only the reference points and the few active instances are
+ * uploaded every frame. The compute shader adds the reference points, calculates the move
+ * matrices, tests them against the view frustum (the far plane is Options::viewDistance),
+ * selects their level of detail and writes the visible ones compacted by mesh, followed by
+ * one indirect draw command per mesh and level. The commands are drawn by the render queue
+ * with one glMultiDrawElementsIndirect() call for the full and the coarse meshes and one for
+ * the impostors, without reading anything back.
+ *
+ * Only enabled if the SceneBuffer is enabled and the OpenGL version is at least 4.3.
+ * @see cullInstancesReference()
+ */
+struct InstanceCulling {
+	GLboolean enabled;
+	/** The full and coarse commands of this frame are not drawn yet */
+	GLboolean pending;
+	GLuint program;
+	GLint instanceCountPosition;
+	GLint frustumPosition;
+	GLint cameraPosition;
+	/** The impostor commands of this frame are not drawn yet */
+	GLboolean impostorsPending;
+
+	/** Meshes of the map (CPU side copies of the buffers) */
+	CullMesh *meshes;
+	GLsizei meshCount;
+	/** Full and coarse commands, followed by the impostor commands (from impostorCommand) */
+	DrawElementsIndirectCommand *commands;
+	GLsizei commandCount;
+	GLsizei impostorCommand;
+
+	/** Dynamic instances, followed by the active instances (CPU side copy of the buffer) */
+	CullInstance *instances;
+	GLsizei instanceCount;
+	GLsizei dynamicCount;
+	/** The dynamic instances are changed since their upload */
+	GLboolean instancesDirty;
+	/** Dynamic instances drawn through the render queue */
+	DynamicObjectInstance **queued;
+	GLsizei queuedCount;
+	/** Reference points of the frame (CPU side copy of the buffer) */
+	CullReference *references;
+	GLsizei referenceCount;
+	/** Size of the matrix buffer (every command has room for all of its possible instances) */
+	GLsizei matrixCapacity;
+
+	GLuint instanceBuffer;
+	GLuint meshBuffer;
+	GLuint commandBuffer;
+	GLuint matrixBuffer;
+	GLuint referenceBuffer;
+};
+
+void initInstanceCulling(GameInstance *this);
+void buildCullingMeshes(GameInstance *this, Map *map);
+void invalidateCullInstances(GameInstance *this);
+void cullObjectInstances(GameInstance *this);
+void drawCulledInstances(GameInstance *this);
+void drawCulledImpostors(GameInstance *this);
+void cullInstancesReference(InstanceCulling *culling, GLfloat frustum[6][4], const GLfloat camera[3],
+		DrawElementsIndirectCommand *commands, GLfloat (*matrices)[16]);
+void freeInstanceCulling(InstanceCulling *culling);
+
+#endif /* CULLING_H_ */
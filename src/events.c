@@ -112,6 +112,12 @@ void onKeyEvent(GLFWwindow* window, int key, int scancode, int action, int mods)
 
 	if (key == GLFW_KEY_H && action == GLFW_PRESS) {
 		printf("%g %g\n", this->player->position[X], this->player->position[Y]);
+
+		const RenderStats *stats = &this->renderQueue->last;
+		printf("items %u, draw calls %u (indirect %u), binds: texture %u, mesh %u, uniform %u, saved %u, "
+				"state changes %u (skipped %u)\n", stats->items, stats->drawCalls, stats->indirectCommands,
+				stats->textureBinds, stats->meshBinds, stats->uniformUploads, stats->bindsSaved,
+				stats->stateChanges, stats->stateSkipped);
 	}
 #ifdef DEBUG_MOVEMENT
 	onDebugKeyPress(key, 0, 0);
@@ -9,12 +9,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include <math.h>
 #include "stdgame.h"
 
 static Char* loadChar(char path[], char charId, GLfloat *colors);
-static void renderChar(GameInstance *this, Font *font, Char *c, GLfloat x, GLfloat z, GLfloat *defaultColor);
+static void bakeChar(Char *c, GLfloat *colors);
+static TextMesh* getTextMesh(GameInstance *this, char str[], GLfloat color[4]);
+static GLfloat renderText(GameInstance *this, char str[], GLfloat color[4], const GLfloat moveMat[16]);
 
 /**
  * Loads a char
@@ -69,19 +72,73 @@ static Char* loadChar(char path[], char charId, GLfloat *colors) {
 			}
 		}
 	}
+
+	/** The dynamic color is treated as opaque */
+	PartOccupancy occupancy;
+	initPartOccupancy(&occupancy);
+	Iterator it;
+	foreach (it, c->parts->first) {
+		CharPart *part = it->data;
+		addPartOccupancy(&occupancy, part->position, part->colorId == -1 || colors[part->colorId * 4 + 3] >= 1.0f);
+	}
+	foreach (it, c->parts->first) {
+		CharPart *part = it->data;
+		part->type = getVisibleFaces(&occupancy, part->type, part->position);
+	}
+	freePartOccupancy(&occupancy);
+
+	bakeChar(c, colors);
 	c->code = charId;
 	return c;
 }
 
+/**
+ * Bake the faces of a char into its glyph mesh builder
+ *
+ * The parts with own color are baked first, then the dynamic colored ones (as white).
+ *
+ * @param c The char
+ * @param colors Color bank array
+ */
+static void bakeChar(Char *c, GLfloat *colors) {
+	static GLfloat WHITE[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+	LinkedList *fixedParts = newList(StaticObjectPart);
+	LinkedList *dynamicParts = newList(StaticObjectPart);
+
+	Iterator it;
+	foreach (it, c->parts->first) {
+		CharPart *charPart = it->data;
+		StaticObjectPart part;
+		part.type = charPart->type;
+		part.color = charPart->colorId == -1 ? WHITE : &colors[4 * charPart->colorId];
+		setPosition(part.position, charPart->position[X], charPart->position[Y], charPart->position[Z]);
+		listPush(charPart->colorId == -1 ? dynamicParts : fixedParts, &part);
+	}
+
+	initMeshBuilder(&c->glyph);
+	meshParts(&c->glyph, fixedParts);
+	c->dynamicFirst = c->glyph.vertexCount;
+	meshParts(&c->glyph, dynamicParts);
+
+	listFree(fixedParts);
+	free(fixedParts);
+	listFree(dynamicParts);
+	free(dynamicParts);
+}
+
 /**
  * Initialize font from `assets/fonts/default.font`
  */
 void initFont(GameInstance *this) {
 	this->font = new(Font);
 	this->font->chars = newList(Char);
+	memset(this->font->cache, 0, sizeof(this->font->cache));
+	this->font->useCounter = 0;
+	this->font->lastFlush = 0;
 
 	FILE *file;
 	char buff[255];
+	int colorCount = 0;
 	DEBUG("Font", "Loading font: default");
 
 	file = fopen("assets/fonts/default.font", "r");
@@ -91,9 +148,8 @@ void initFont(GameInstance *this) {
 	}
 
 	while (fgets(buff, 255, file)) {
-		int colorSize;
-		if (sscanf(buff, "# COLOR_COUNT %d", &colorSize) == 1) {
-			this->font->colors = malloc(sizeof(GLfloat) * 4 * colorSize);
+		if (sscanf(buff, "# COLOR_COUNT %d", &colorCount) == 1) {
+			this->font->colors = calloc(colorCount, sizeof(GLfloat) * 4);
 			continue;
 		}
 
@@ -127,23 +183,44 @@ void initFont(GameInstance *this) {
 	}
 
 	fclose(file);
+
+	/** The colors are set while loading the chars */
+	addSceneColors((const GLfloat (*)[4]) this->font->colors, colorCount);
 }
 
-//TODO: Call
 /**
- * Free the loaded fonts <br>
- * Must be called before exit
+ * Free the loaded fonts and the cached text meshes <br>
+ * Must be called before the OpenGL context is destroyed
  *
  * @param this Actual GameInstance instance
  */
 void freeFont(GameInstance *this) {
-	free(this->font->unknown);
+	int i;
+	for (i = 0; i < TEXT_CACHE_SIZE; ++i) {
+		if (this->font->cache[i].text != NULL) {
+			free(this->font->cache[i].text);
+			freeMesh(&this->font->cache[i].mesh);
+		}
+	}
+
+	if (this->font->unknown != NULL) {
+		listFree(this->font->unknown->parts);
+		free(this->font->unknown->parts);
+		freeMeshBuilder(&this->font->unknown->glyph);
+		free(this->font->unknown);
+	}
 	free(this->font->colors);
 	Iterator it;
-	for (it = this->font->chars->first; it != NULL; it = it->next)
-		listFree(((Char *)it->data)->parts);
+	foreach (it, this->font->chars->first) {
+		Char *c = it->data;
+		listFree(c->parts);
+		free(c->parts);
+		freeMeshBuilder(&c->glyph);
+	}
 	listFree(this->font->chars);
+	free(this->font->chars);
 	free(this->font);
+	this->font = NULL;
 }
 
 /**
@@ -162,77 +239,89 @@ Char* getChar(Font *font, char c) {
 }
 
 /**
- * Render selected char.
+ * Get the mesh of a text from the cache
+ *
+ * On a miss the least recently used entry is rebuilt from the glyphs. If that entry is
+ * still in the render queue, the queue is flushed first.
  *
  * @param this Actual GameInstance instance
- * @param font Font family
- * @param c Character pointer
- * @param x Coordinates (x-dim)
- * @param z Coordinates (z-dim)
- * @param defaultColor Default color of the font
+ * @param str The text
+ * @param color Dynamic color
+ * @returns The cached mesh
  */
-static void renderChar(GameInstance *this, Font *font, Char *c, GLfloat x, GLfloat z, GLfloat *defaultColor) {
-	Iterator it;
-	foreach (it, c->parts->first) {
-		CharPart part = *(CharPart *)it->data;
-		glUniform4fv(this->shader->baseColor, 1, part.colorId == -1 ?
-				defaultColor : &font->colors[4 * part.colorId]);
-
-		if ((part.type & PTMASK_RENDER_UP) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					1.0f, 0.0f, 0.0f, 0.0f,
-					0.0f, 0.0f, -1, 0.0f,
-					0.0f, 1, 0.0f, 0.0f,
-					x + part.position[X], part.position[Y] + 1 + c->y, z + part.position[Z], 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+static TextMesh* getTextMesh(GameInstance *this, char str[], GLfloat color[4]) {
+	Font *font = this->font;
+	TextMesh *oldest = &font->cache[0];
+	++font->useCounter;
+
+	int i;
+	for (i = 0; i < TEXT_CACHE_SIZE; ++i) {
+		TextMesh *entry = &font->cache[i];
+		if (entry->text != NULL && equals(entry->text, str)
+				&& memcmp(entry->color, color, sizeof(GLfloat) * 4) == 0) {
+			entry->lastUse = font->useCounter;
+			return entry;
 		}
+		if (entry->lastUse < oldest->lastUse)
+			oldest = entry;
+	}
 
-		if ((part.type & PTMASK_RENDER_DOWN) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					1.0f, 0.0f, 0.0f, 0.0f,
-					0.0f, cosf(PI + PI / 2), -sinf(PI + PI / 2), 0.0f,
-					0.0f, sinf(PI + PI / 2), cosf(PI + PI / 2), 0.0f,
-					x + part.position[X], part.position[Y] + c->y, z + part.position[Z] - 1, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
+	/** The entry can be referenced by a queued draw call */
+	if (oldest->lastUse > font->lastFlush)
+		flushRenderQueue(this);
 
-		if ((part.type & PTMASK_RENDER_TOP) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					cosf(PI), 0.0f, sinf(PI), 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					-sinf(PI), 0.0f, cosf(PI), 0.0f,
-					x + part.position[X] + 1, part.position[Y] + c->y, z + part.position[Z] - 1, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
+	if (oldest->text != NULL) {
+		free(oldest->text);
+		freeMesh(&oldest->mesh);
+	}
 
-		if ((part.type & PTMASK_RENDER_LEFT) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					cosf(PI / 2), 0.0f, sinf(PI / 2), 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					-sinf(PI / 2), 0.0f, cosf(PI / 2), 0.0f,
-					x + part.position[X], part.position[Y] + c->y, z + part.position[Z] - 1, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
+	MeshBuilder builder;
+	initMeshBuilder(&builder);
 
-		if ((part.type & PTMASK_RENDER_BOTTOM) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					1.0f, 0.0f, 0.0f, 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					0.0f, 0.0f, 1.0f, 0.0f,
-					x + part.position[X], part.position[Y] + c->y, z + part.position[Z], 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
+	GLfloat x = 0;
+	for (i = 0; str[i] != '\0'; ++i) {
+		Char *c = getChar(font, toupper(str[i]));
+		GLsizei first = meshAppend(&builder, &c->glyph, (GLfloat[]) {x, c->y, 1.0f});
+		meshSetColor(&builder, first + c->dynamicFirst, color);
+		x += c->width + 1;
+	}
 
-		if ((part.type & PTMASK_RENDER_RIGHT) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					cosf(PI + PI / 2), 0.0f, sinf(PI + PI / 2), 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					-sinf(PI + PI / 2), 0.0f, cosf(PI + PI / 2), 0.0f,
-					x + part.position[X] + 1, part.position[Y] + c->y, z + part.position[Z], 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
+	uploadMesh(&oldest->mesh, &builder);
+	freeMeshBuilder(&builder);
+	/** The upload binds the VAOs and the buffers directly */
+	invalidateStateCache(this->glState);
+
+	oldest->text = malloc(strlen(str) + 1);
+	strcpy(oldest->text, str);
+	memcpy(oldest->color, color, sizeof(GLfloat) * 4);
+	oldest->width = x;
+	oldest->lastUse = font->useCounter;
+	return oldest;
+}
 
-	}
+/**
+ * Submit a text with one draw call
+ *
+ * The text is not drawn if its bounding box is outside the view frustum.
+ *
+ * @param this Actual GameInstance instance
+ * @param str The text
+ * @param color Dynamic color
+ * @param moveMat Move matrix of the text
+ * @returns Width of the text in cubes (even if it is not drawn)
+ */
+static GLfloat renderText(GameInstance *this, char str[], GLfloat color[4], const GLfloat moveMat[16]) {
+	static const GLfloat WHITE[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+	TextMesh *text = getTextMesh(this, str, color);
+
+	GLfloat min[3], max[3];
+	transformBox(min, max, moveMat, text->mesh.min, text->mesh.max);
+	if (!isBoxInFrustum(this->camera->frustum, min, max))
+		return text->width;
+
+	submitRenderItem(this, RL_OVERLAY, &text->mesh, this->map->textureArray, moveMat, WHITE);
+	return text->width;
 }
 
 /**
@@ -251,26 +340,12 @@ static void renderChar(GameInstance *this, Font *font, Char *c, GLfloat x, GLflo
 void renderFontTo(GameInstance *this, char str[], GLfloat position[3], GLfloat defaultColor[4], FontSize size) {
 	const GLfloat dist = 1.0 / size;
 
-	glPushMatrix();
-	glLoadIdentity();
-	glTranslatef(position[X], position[Y], position[Z]);
-	glScalef(dist, dist, dist);
-
 	GLfloat moveMat[16];
-	glGetFloatv(GL_MODELVIEW_MATRIX, moveMat);
-	glUniformMatrix4fv(this->shader->moveMat, 1, GL_FALSE, moveMat);
-	glPopMatrix();
+	mat4Identity(moveMat);
+	mat4Translate(moveMat, position[X], position[Y], position[Z]);
+	mat4Scale(moveMat, dist, dist, dist);
 
-	glBindTexture(GL_TEXTURE_2D, this->blankTextureId);
-
-	int i = 0;
-	GLfloat x = 0;
-	while (str[i] != '\0') {
-		Char *c = getChar(this->font, toupper(str[i]));
-		renderChar(this, this->font, c, x, 1.0f, defaultColor);
-		x += c->width + 1;
-		++i;
-	}
+	renderText(this, str, defaultColor, moveMat);
 }
 
 /**
@@ -293,29 +368,15 @@ void renderFontToComponent(GameInstance *this, char str[], GLfloat position[3],
 		FontSize size, GLfloat min[3], GLfloat max[3]) {
 	const GLfloat dist = 1.0 / size;
 
-	glPushMatrix();
-	glLoadIdentity();
-	glTranslatef(position[X], position[Y], position[Z]);
-	glScalef(dist, dist, dist);
-
 	GLfloat moveMat[16];
-	glGetFloatv(GL_MODELVIEW_MATRIX, moveMat);
-	glUniformMatrix4fv(this->shader->moveMat, 1, GL_FALSE, moveMat);
-	glPopMatrix();
-
-	glBindTexture(GL_TEXTURE_2D, this->blankTextureId);
+	mat4Identity(moveMat);
+	mat4Translate(moveMat, position[X], position[Y], position[Z]);
+	mat4Scale(moveMat, dist, dist, dist);
 
 	min[X] = position[X];
 	min[Y] = position[Y] - dist;
 
-	int i = 0;
-	GLfloat x = 0;
-	while (str[i] != '\0') {
-		Char *c = getChar(this->font, toupper(str[i]));
-		renderChar(this, this->font, c, x, 1.0f, defaultColor);
-		x += c->width + 1;
-		++i;
-	}
+	GLfloat x = renderText(this, str, defaultColor, moveMat);
 
 	max[X] = position[X] + (x * dist);
 	max[Y] = position[Y] + (6 * dist);
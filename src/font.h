@@ -13,6 +13,9 @@
 #include "stdgame.h"
 #include "object.h"
 
+/** Count of the cached text meshes */
+#define TEXT_CACHE_SIZE 64
+
 /**
  * Font size enumeration
  */
@@ -52,6 +55,25 @@ struct Char {
 	GLuint width;
 	GLint y;
 	LinkedList /*CharPart*/ *parts;
+	/** Baked faces. The dynamic colored ones start from dynamicFirst (vertex index) */
+	MeshBuilder glyph;
+	GLsizei dynamicFirst;
+};
+
+/**
+ * Cached mesh of a rendered text
+ *
+ * The geometry does not depend on the FontSize (it is applied by the move matrix),
+ * so the key is the text and the dynamic color.
+ * @see TEXT_CACHE_SIZE
+ */
+struct TextMesh {
+	char *text;
+	GLfloat color[4];
+	Mesh mesh;
+	/** Width of the text in cubes */
+	GLfloat width;
+	GLuint lastUse;
 };
 
 /**
@@ -61,6 +83,11 @@ struct Font {
 	LinkedList /*Char*/ *chars;
 	Char *unknown;
 	GLfloat *colors; // 4 * size TODO: Add pointer to its name
+	/** Least recently used text meshes are rebuilt first */
+	TextMesh cache[TEXT_CACHE_SIZE];
+	GLuint useCounter;
+	/** Value of the useCounter when the render queue was last flushed */
+	GLuint lastFlush;
 };
 
 
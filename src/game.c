@@ -9,11 +9,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 #include "stdgame.h"
+#include "shader.h"
 
-static void initShaderUniforms(GameInstance* this);
+static void initShaderUniforms(ShaderInfo *shader);
+static GLboolean beginShaderVariant(ShaderInfo *shader, const char *defines, char *cachePath);
+static void finishShaderVariant(ShaderInfo *shader, const char *cachePath, GLboolean cached);
+static ShaderVariant getLightingVariant(GameInstance *this);
 
 static void processDobjAction(GameInstance *this, Action *action);
 static void processAobjAction(GameInstance *this, Action *action);
@@ -36,54 +41,111 @@ static GLfloat getDelta(void);
 static void calcLights(GameInstance *this);
 
 /**
- * Load the tile VAO
+ * Initialize shader uniforms
  *
- * This VertexArrayObject will be used in every cube.
+ * @param shader The program of a variant
+ */
+static void initShaderUniforms(ShaderInfo *shader) {
+	shader->cameraPosition = glGetUniformLocation(shader->shaderId, "cameraPosition");
+	shader->lightBlock = glGetUniformBlockIndex(shader->shaderId, "LightBlock");
+	shader->clusterScale = glGetUniformLocation(shader->shaderId, "clusterScale");
+	shader->lightClusters = glGetUniformLocation(shader->shaderId, "lightClusters");
+	shader->lightIndices = glGetUniformLocation(shader->shaderId, "lightIndices");
+	shader->texturePosition = glGetUniformLocation(shader->shaderId, "tex");
+	shader->baseColor = glGetUniformLocation(shader->shaderId, "baseColor");
+	shader->projMat = glGetUniformLocation(shader->shaderId, "projMat");
+	shader->viewMat = glGetUniformLocation(shader->shaderId, "viewMat");
+	shader->modelMat = glGetUniformLocation(shader->shaderId, "modelMat");
+	shader->packedFaces = glGetUniformLocation(shader->shaderId, "packedFaces");
+	shader->faces = glGetUniformLocation(shader->shaderId, "faces");
+	shader->palette = glGetUniformLocation(shader->shaderId, "palette");
+	shader->staticShadows = glGetUniformLocation(shader->shaderId, "staticShadows");
+	shader->dynamicShadows = glGetUniformLocation(shader->shaderId, "dynamicShadows");
+	shader->lightMasks = glGetUniformLocation(shader->shaderId, "lightMasks");
+	shader->time = glGetUniformLocation(shader->shaderId, "time");
+	shader->alphaCutoff = glGetUniformLocation(shader->shaderId, "alphaCutoff");
+	if (shader->lightBlock != GL_INVALID_INDEX)
+		glUniformBlockBinding(shader->shaderId, shader->lightBlock, LIGHT_BLOCK_BINDING);
+}
+
+/**
+ * Start loading a variant of the shader program
  *
- * @param this Actual GameInstance instance
+ * The program is loaded from the binary cache if it is possible, otherwise the shaders are
+ * compiled and linked. The result is checked in finishShaderVariant(), so the variants can be
+ * compiled in parallel.
+ *
+ * @param shader The program of the variant
+ * @param defines Preprocessor lines of the variant
+ * @param cachePath Output: the cache file (empty if the cache is not supported)
+ * @return The program is loaded from the cache
  */
-static void loadTileVAO(const GameInstance *this) {
-	glGenVertexArrays(1, &this->tileVAO);
-	glBindVertexArray(this->tileVAO);
-
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
-	/** (3 x Position, 2 x Texture coord, 3 x Normal vectors) x 4 */
-	GLfloat v[] = {
-			0.0f, 0.0f, 0.0f,	0.0f, 1.0f,		0.0f, 0.0f, 1.0f,
-			1.0f, 0.0f, 0.0f,	1.0f, 1.0f, 	0.0f, 0.0f, 1.0f,
-			1.0f, 1.0f, 0.0f,	1.0f, 0.0f,		0.0f, 0.0f, 1.0f,
-			0.0f, 1.0f, 0.0f, 	0.0f, 0.0f, 	0.0f, 0.0f, 1.0f
+static GLboolean beginShaderVariant(ShaderInfo *shader, const char *defines, char *cachePath) {
+	static const char *SHADER_FILES[2] = {
+			"assets/shaders/shader.vertex",
+			"assets/shaders/shader.fragment"
 	};
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 32, v, GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 8, 0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 8, sizeof(GLfloat) * 3);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 8, sizeof(GLfloat) * 5);
-	glEnableVertexAttribArray(2);
+	shader->shaderId = glCreateProgram();
+	cachePath[0] = '\0';
+	if (shaderGetCachePath(cachePath, SHADER_FILES, 2, defines)) {
+		if (shaderLoadBinary(shader->shaderId, cachePath))
+			return GL_TRUE;
+		glProgramParameteri(shader->shaderId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	shaderAttachFromFile(shader->shaderId, GL_VERTEX_SHADER, SHADER_FILES[0], defines);
+	shaderAttachFromFile(shader->shaderId, GL_FRAGMENT_SHADER, SHADER_FILES[1], defines);
+
+	glBindAttribLocation(shader->shaderId, 0, "position");
+	glBindAttribLocation(shader->shaderId, 1, "texCoord");
+	glBindAttribLocation(shader->shaderId, 2, "normal");
+	glBindAttribLocation(shader->shaderId, 3, "color");
+	glBindAttribLocation(shader->shaderId, INSTANCE_MAT_ATTRIBUTE, "instanceMat");
+
+	glLinkProgram(shader->shaderId);
+	return GL_FALSE;
 }
 
 /**
- * Initialize shader uniforms
+ * Check a variant of the shader program and store it in the binary cache
+ *
+ * @param shader The program of the variant
+ * @param cachePath The cache file (empty if the cache is not supported)
+ * @param cached The program is loaded from the cache
+ */
+static void finishShaderVariant(ShaderInfo *shader, const char *cachePath, GLboolean cached) {
+	if (!cached) {
+		if (!shaderCheckProgram(shader->shaderId, "Shader")) {
+			glDeleteProgram(shader->shaderId);
+			shader->shaderId = 0;
+		} else if (cachePath[0] != '\0') {
+			shaderSaveBinary(shader->shaderId, cachePath);
+		}
+	}
+
+	initShaderUniforms(shader);
+}
+
+/**
+ * Create the uniform buffer and the clusters of the lights
  *
  * @param this Actual GameInstance instance
  */
-static void initShaderUniforms(GameInstance* this) {
-	this->shader->cameraPosition = glGetUniformLocation(this->shader->shaderId, "cameraPosition");
-	this->shader->lightPosition = glGetUniformLocation(this->shader->shaderId, "lightPosition");
-	this->shader->lightColor = glGetUniformLocation(this->shader->shaderId,"lightColor");
-	this->shader->lightInfo = glGetUniformLocation(this->shader->shaderId, "lightInfo");
-	this->shader->texturePosition = glGetUniformLocation(this->shader->shaderId, "tex");
-	this->shader->numLights = glGetUniformLocation(this->shader->shaderId, "numLights");
-	this->shader->baseColor = glGetUniformLocation(this->shader->shaderId, "baseColor");
-	this->shader->projMat = glGetUniformLocation(this->shader->shaderId, "projMat");
-	this->shader->viewMat = glGetUniformLocation(this->shader->shaderId, "viewMat");
-	this->shader->moveMat = glGetUniformLocation(this->shader->shaderId, "moveMat");
-	this->shader->modelMat = glGetUniformLocation(this->shader->shaderId, "modelMat");
+static void initLightBuffer(GameInstance *this) {
+	memset(&this->lighting->block, 0, sizeof(LightBlock));
+	this->lighting->changed = GL_FALSE;
+	this->lighting->time = 0.0f;
+
+	glGenBuffers(1, &this->lighting->uniformBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, this->lighting->uniformBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlock), &this->lighting->block, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, this->lighting->uniformBuffer);
+
+	initLightClusters(&this->lighting->clusters);
+	initShadowMaps(&this->lighting->shadows);
+	initLightMasks(&this->lighting->masks);
 }
 
 /**
@@ -94,37 +156,39 @@ static void initShaderUniforms(GameInstance* this) {
  * @param this Actual GameInstance instance
  */
 void gameInit(GameInstance *this) {
-	this->shader->shaderId = glCreateProgram();
-	shaderAttachFromFile(this->shader->shaderId, GL_VERTEX_SHADER, "assets/shaders/shader.vertex");
-	shaderAttachFromFile(this->shader->shaderId, GL_FRAGMENT_SHADER, "assets/shaders/shader.fragment");
-
-	glBindAttribLocation(this->shader->shaderId, 0, "position");
-	glBindAttribLocation(this->shader->shaderId, 1, "texCoord");
-	glBindAttribLocation(this->shader->shaderId, 2, "normal");
-
-	GLint result;
-	glLinkProgram(this->shader->shaderId);
-	glGetProgramiv(this->shader->shaderId, GL_LINK_STATUS, &result);
-	if (result == GL_FALSE) {
-		GLint length;
-		char *log;
-
-		glGetProgramiv(this->shader->shaderId, GL_INFO_LOG_LENGTH, &length);
-		log = malloc(length);
-		glGetProgramInfoLog(this->shader->shaderId, length, &result, log);
-
-		ERROR("Shader program linking failed: %s", log);
-		free(log);
-
-		glDeleteProgram(this->shader->shaderId);
-		this->shader->shaderId = 0;
-	}
+	/** Defines of the variants (the order of ShaderVariant) */
+	static const char *VARIANT_DEFINES[SHADER_VARIANT_COUNT] = {
+			"",
+			"#define NO_SPECULAR\n",
+			"#define NO_LIGHTS\n",
+			"#define UNLIT\n"
+	};
+
+	char cachePaths[SHADER_VARIANT_COUNT][SHADER_CACHE_PATH_LENGTH];
+	GLboolean cached[SHADER_VARIANT_COUNT];
+	double startTime = glfwGetTime();
+	int i, cachedCount = 0;
+
+	initStateCache(this->glState);
+	shaderEnableParallelCompile();
+	for (i = 0; i < SHADER_VARIANT_COUNT; ++i)
+		cached[i] = beginShaderVariant(&this->shaders[i], VARIANT_DEFINES[i], cachePaths[i]);
 
-	initShaderUniforms(this);
-	loadTileVAO(this);
-	loadTexture(&this->blankTextureId, "null.png");
+	initLightBuffer(this);
+	initSceneBuffer(this->sceneBuffer);
+	initInstanceBuffer(this->renderQueue, this->sceneBuffer->multiDraw);
+	initInstanceCulling(this);
 	initReferencePoints(this);
 
+	for (i = 0; i < SHADER_VARIANT_COUNT; ++i) {
+		finishShaderVariant(&this->shaders[i], cachePaths[i], cached[i]);
+		cachedCount += cached[i];
+	}
+	this->shader = &this->shaders[SV_LIT];
+	this->lighting->variant = SV_LIT;
+	DEBUG("Shader", "Programs and buffers ready in %.1f ms (%d of %d programs from the cache)",
+			(glfwGetTime() - startTime) * 1000.0, cachedCount, SHADER_VARIANT_COUNT);
+
 	this->state = MENU;
 	this->map = loadMap(this, "assets/maps/main.menu");
 
@@ -134,22 +198,34 @@ void gameInit(GameInstance *this) {
 	DEBUG("Logic", "First logic done");
 
 	updateCamera(this);
-	glGetFloatv(GL_MODELVIEW_MATRIX, this->camera->viewMat);
+	DEBUG("Info", "Startup done in %.1f ms", (glfwGetTime() - startTime) * 1000.0);
 }
 
 /**
- * Updates the camera position
+ * Updates the view matrix and the view frustum from the camera position and rotation
+ *
+ * The far plane of the frustum is at Options::viewDistance (the depth buffer still uses the
+ * far plane of the projection matrix).
  *
  * @param this Actual GameInstance instance
  */
 void updateCamera(GameInstance* this) {
-	glLoadIdentity();
-	glRotatef(-this->camera->rotation[X], 1.0f, 0.0f, 0.0f);
-	glRotatef(-this->camera->rotation[Y], 0.0f, 1.0f, 0.0f);
-	glRotatef(-this->camera->rotation[Z], 0.0f, 0.0f, 1.0f);
-	glTranslatef(-this->camera->position[X],
+	mat4Identity(this->camera->viewMat);
+	mat4Rotate(this->camera->viewMat, -this->camera->rotation[X], 1.0f, 0.0f, 0.0f);
+	mat4Rotate(this->camera->viewMat, -this->camera->rotation[Y], 0.0f, 1.0f, 0.0f);
+	mat4Rotate(this->camera->viewMat, -this->camera->rotation[Z], 0.0f, 0.0f, 1.0f);
+	mat4Translate(this->camera->viewMat, -this->camera->position[X],
 			-this->camera->position[Y],
 			-this->camera->position[Z]);
+
+	GLfloat cullMat[16];
+	memcpy(cullMat, this->camera->projMat, sizeof(cullMat));
+	const GLfloat near = cullMat[14] / (cullMat[10] - 1.0f);
+	const GLfloat far = this->options->viewDistance;
+	cullMat[10] = (far + near) / (near - far);
+	cullMat[14] = 2.0f * far * near / (near - far);
+	mat4Multiply(cullMat, cullMat, this->camera->viewMat);
+	extractFrustumPlanes(this->camera->frustum, cullMat);
 }
 
 /**
@@ -160,70 +236,110 @@ void updateCamera(GameInstance* this) {
  * @param this Actual GameInstance instance
  */
 void debugLight(GameInstance *this) {
-	Iterator it;
-	int i = 0;
-	for (it = this->map->lights->first; it != NULL; it = it->next, ++i) {
-		glPushMatrix();
-		glTranslatef(this->lighting->lightPosition[i * 3 + 0],
-				this->lighting->lightPosition[i * 3 + 1],
-				this->lighting->lightPosition[i * 3 + 2]);
-		glColor3fv(this->lighting->lightColor + (i * 3));
-		renderFontTo(this, ",", this->lighting->lightPosition + (i * 3), (GLfloat[]) {
-			*(this->lighting->lightColor + (i * 3)),
-			*(this->lighting->lightColor + (i * 3) + 1),
-			*(this->lighting->lightColor + (i * 3) + 2), 1.0 }, FS_LOW_DPI);
-		glPopMatrix();
+	LightBlock *block = &this->lighting->block;
+	int i;
+	for (i = 0; i < block->numLights; ++i) {
+		renderFontTo(this, ",", block->lightPosition[i], (GLfloat[]) {
+			block->lightColor[i][R],
+			block->lightColor[i][G],
+			block->lightColor[i][B], 1.0 }, FS_LOW_DPI);
 	}
 }
 
 /**
- * The renderer method
+ * Select the cheapest lit variant that gives the same result with the lights of the frame
  *
- * This method will call all the renderer methods needed.
+ * @param this Actual GameInstance instance
+ */
+static ShaderVariant getLightingVariant(GameInstance *this) {
+	LightBlock *block = &this->lighting->block;
+	if (block->numLights == 0)
+		return SV_AMBIENT;
+
+	int i;
+	for (i = 0; i < block->numLights; ++i)
+		if (block->lightInfo[i][0] > 0)
+			return SV_LIT;
+	return SV_DIFFUSE;
+}
+
+/**
+ * Use a variant of the shader program and set its uniforms of the frame
+ *
+ * The values are cached per program, so only the first switch to a variant in a frame
+ * uploads them.
  *
  * @param this Actual GameInstance instance
+ * @param variant The variant
  */
-void onRender(GameInstance *this) {
-	static const GLfloat TILE_MOVE_MAT[16] = {
+void useShaderVariant(GameInstance *this, ShaderVariant variant) {
+	static const GLfloat IDENTITY[16] = {
 			1.0f, 0.0f, 0.0f, 0.0f,
 			0.0f, 1.0f, 0.0f, 0.0f,
 			0.0f, 0.0f, 1.0f, 0.0f,
 			0.0f, 0.0f, 0.0f, 1.0f};
-	static const GLfloat BASE_COLOR[4] = {1.0f, 1.0f, 1.0f, 1.0f};
-
-	glUseProgram(this->shader->shaderId);
-	glUniform3fv(this->shader->cameraPosition, 1, this->camera->position);
-	glUniform3fv(this->shader->lightPosition, this->lighting->numLights, this->lighting->lightPosition);
-	glUniform3fv(this->shader->lightColor, this->lighting->numLights, this->lighting->lightColor);
-	glUniform3fv(this->shader->lightInfo, this->lighting->numLights, this->lighting->lightInfo);
-	glUniform1i(this->shader->numLights, this->lighting->numLights);
-	glUniform4fv(this->shader->baseColor, 1, BASE_COLOR);
-	glUniformMatrix4fv(this->shader->projMat, 1, GL_FALSE, this->camera->projMat);
-	updateCamera(this);
-	glGetFloatv(GL_MODELVIEW_MATRIX, &this->camera->viewMat);
-	glUniformMatrix4fv(this->shader->viewMat, 1, GL_FALSE, this->camera->viewMat);
-	glUniformMatrix4fv(this->shader->moveMat, 1, GL_FALSE, TILE_MOVE_MAT);
-
-	glBindVertexArray(this->tileVAO);
-	glActiveTexture(GL_TEXTURE0);
-	glUniform1i(this->shader->texturePosition, 0);
+	ShaderInfo *shader = &this->shaders[variant];
+
+	this->shader = shader;
+	useProgram(this, shader->shaderId);
+	setUniform3fv(this, shader->cameraPosition, this->camera->position);
+	setUniformMatrix4fv(this, shader->projMat, this->camera->projMat);
+	setUniformMatrix4fv(this, shader->viewMat, this->camera->viewMat);
+	setUniformMatrix4fv(this, shader->modelMat, IDENTITY);
+	setUniform4fv(this, shader->clusterScale, 1, this->lighting->clusters.scale);
+	setUniform1i(this, shader->texturePosition, 0);
+	setUniform1i(this, shader->lightClusters, CLUSTER_TEXTURE_UNIT);
+	setUniform1i(this, shader->lightIndices, CLUSTER_TEXTURE_UNIT + 1);
+	setUniform1i(this, shader->faces, FACE_TEXTURE_UNIT);
+	setUniform1i(this, shader->palette, PALETTE_TEXTURE_UNIT);
+	setUniform1i(this, shader->staticShadows, SHADOW_TEXTURE_UNIT);
+	setUniform1i(this, shader->dynamicShadows, SHADOW_TEXTURE_UNIT + 1);
+	setUniform1i(this, shader->lightMasks, LIGHT_MASK_TEXTURE_UNIT);
+	setUniform1f(this, shader->time, this->lighting->time);
+}
 
-	Iterator it;
-	foreach (it, this->map->tiles->first)
-		renderTile(this, it->data);
+/**
+ * The renderer method
+ *
+ * This method will call all the renderer methods needed. They submit their draw calls
+ * into the render queue, which is sorted and executed at the end.
+ *
+ * @param this Actual GameInstance instance
+ */
+void onRender(GameInstance *this) {
+	invalidateStateCache(this->glState);
+	updateCamera(this);
+	this->lighting->time = (GLfloat) glfwGetTime();
+
+	updateLightClusters(this);
+	bindSceneFaces(this);
+	this->lighting->variant = getLightingVariant(this);
+	useShaderVariant(this, this->lighting->variant);
+	if (this->lighting->changed) {
+		glBindBuffer(GL_UNIFORM_BUFFER, this->lighting->uniformBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightBlock), &this->lighting->block);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		this->lighting->changed = GL_FALSE;
+	}
+	renderShadowMaps(this);
+	bindTexture(this, LIGHT_MASK_TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, this->lighting->masks.texture);
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+	renderTileChunks(this);
 
 #ifdef DEBUG_LIGHT
 	debugLight(this);
 #endif
 
-	foreach (it, this->map->objects->staticInstances->first)
-		renderStaticObject(this, it->data);
-	foreach (it, this->map->objects->dynamicInstances->first)
-		renderDynamicObject(this, it->data);
-	foreach (it, this->map->objects->activeInstances->first)
-		renderActiveObject(this, it->data);
+	Iterator it;
+	renderStaticBatches(this);
+	if (this->culling->enabled) {
+		cullObjectInstances(this);
+	} else {
+		foreach (it, this->map->objects->dynamicInstances->first)
+			renderDynamicObject(this, it->data);
+		foreach (it, this->map->objects->activeInstances->first)
+			renderActiveObject(this, it->data);
+	}
 
 	foreach (it, this->map->menu->components->first) {
 		Component* comp = it->data;
@@ -241,7 +357,10 @@ void onRender(GameInstance *this) {
 		renderFontTo(this, m->message, m->position.xyz, m->color.rgba, m->size);
 	}
 
-    glUseProgram(0);
+	endRenderFrame(this);
+
+	bindTexture(this, 0, GL_TEXTURE_2D_ARRAY, 0);
+	useProgram(this, 0);
 
 }
 
@@ -557,14 +676,19 @@ void activateAction(GameInstance *this, GLint id) {
 			this->map->score += *((int *) action->value->value);
 		} else if (action->type == ACTION_SET_DOBJ) {
 			processDobjAction(this, action);
+			invalidateShadowMaps(this);
+			invalidateCullInstances(this);
 		} else if (action->type == ACTION_SET_AOBJ) {
 			processAobjAction(this, action);
+			invalidateShadowMaps(this);
+			invalidateCullInstances(this);
 		} else if (action->type == ACTION_SET_ITEM) {
 			this->player->item = *((int *) action->value->value);
 		} else if (action->type == ACTION_SET_LIGHT) {
 			processLightAction(this, action);
 		} else if (action->type == ACTION_OBJECT_PSX) {
 			processObjPhysics(this, action);
+			invalidateShadowMaps(this);
 		} else if (action->type == ACTION_WIN) {
 			processVictory(this, action);
 		} else if (action->type == ACTION_LOSE) {
@@ -981,9 +1105,16 @@ static GLfloat getDelta(void) {
 /**
  * Calculate and finalize the lights
  *
+ * Only the lights whose range reaches the view frustum are kept. The LightBlock is marked
+ * as changed only if any value is different.
+ *
  * @param this Actual GameInstance instance
  */
 static void calcLights(GameInstance *this) {
+	LightBlock block;
+	Light *lights[MAX_NUM_LIGHTS];
+	memset(&block, 0, sizeof(LightBlock));
+
 	int i = 0;
 	Iterator it;
 	foreach (it, this->map->lights->first) {
@@ -991,21 +1122,31 @@ static void calcLights(GameInstance *this) {
 
 		if (!light->visible)
 			continue;
-		if (getDistSquared2DDelta(light->position, light->reference->position, this->camera->position) > 100)
+		GLfloat position[3] = {
+				light->position[X] + light->reference->position[X],
+				light->position[Y] + light->reference->position[Y],
+				light->position[Z] + light->reference->position[Z]};
+		const GLfloat strength2 = light->period > 0 ? light->strength2 : light->strength;
+		if (!isSphereInFrustum(this->camera->frustum, position, LIGHT_MAX_DIST * sqrtf(max(light->strength, strength2))))
 			continue;
-
-		this->lighting->lightColor[i * 3 + R] = light->color[R];
-		this->lighting->lightColor[i * 3 + G] = light->color[G];
-		this->lighting->lightColor[i * 3 + B] = light->color[B];
-		this->lighting->lightPosition[i * 3 + X] = light->position[X] + light->reference->position[X];
-		this->lighting->lightPosition[i * 3 + Y] = light->position[Y] + light->reference->position[Y];
-		this->lighting->lightPosition[i * 3 + Z] = light->position[Z] + light->reference->position[Z];
-		this->lighting->lightInfo[i * 3 + 0] = light->specular;
-		this->lighting->lightInfo[i * 3 + 1] = light->strength;
-		this->lighting->lightInfo[i * 3 + 2] = light->intensity;
+		if (i == MAX_NUM_LIGHTS)
+			break;
+
+		setColor(block.lightColor[i], light->color[R], light->color[G], light->color[B], strength2);
+		setColor(block.lightPosition[i], position[X], position[Y], position[Z], light->period);
+		setPosition(block.lightInfo[i], light->specular, light->strength, light->intensity);
+		setColor(block.lightAnimation[i], light->color2[R], light->color2[G], light->color2[B], light->phase);
+		lights[i] = light;
 		++i;
 	}
-	this->lighting->numLights = i;
+	block.numLights = i;
+	assignShadowLights(this, &block, lights);
+	updateLightMasks(this, &block, lights);
+
+	if (memcmp(&block, &this->lighting->block, sizeof(LightBlock)) != 0) {
+		this->lighting->block = block;
+		this->lighting->changed = GL_TRUE;
+	}
 }
 
 /**
@@ -1043,5 +1184,6 @@ void onLogic(GameInstance *this) {
 	else
 		onLogicMenu(this, delta);
 
+	updateCamera(this);
 	calcLights(this);
 }
@@ -16,8 +16,8 @@
 #include "map.h"
 #include "player.h"
 
-/** Maximum allowed lights to render */
-#define MAX_NUM_LIGHTS 28
+/** Uniform buffer binding point of the LightBlock */
+#define LIGHT_BLOCK_BINDING 0
 /** Ingame camera distance */
 #define CAMERA_DISTANCE 5.2
 
@@ -31,11 +31,30 @@ typedef enum {
 	PAUSE
 } GameState;
 
+/**
+ * Shader program variants (compiled from the same files with different defines)
+ *
+ * The lit objects use the cheapest variant for the lights of the frame.
+ */
+typedef enum {
+	/** Diffuse and specular lighting */
+	SV_LIT = 0,
+	/** No light has specular component */
+	SV_DIFFUSE = 1,
+	/** No lights, ambient only */
+	SV_AMBIENT = 2,
+	/** No lighting (the texts of the overlay layer) */
+	SV_UNLIT = 3,
+	SHADER_VARIANT_COUNT = 4
+} ShaderVariant;
+
 /**
  * It contains all the data that the game requires.
  */
 struct GameInstance {
+	/** The program in use (one of the variants) */
 	ShaderInfo *shader;
+	ShaderInfo *shaders;
 	CameraInfo *camera;
 	Map *map;
 	LigingInfo *lighting;
@@ -43,9 +62,11 @@ struct GameInstance {
 	Font *font;
 	Options *options;
 	Cursor *cursor;
+	RenderQueue *renderQueue;
+	SceneBuffer *sceneBuffer;
+	InstanceCulling *culling;
+	GLStateCache *glState;
 
-	GLuint tileVAO;
-	GLuint blankTextureId;
 	GLFWwindow *window;
 	GameState state;
 
@@ -70,7 +91,14 @@ struct Options {
 	GLint windowedHeight;
 	GLint windowedWidth;
 	GLboolean shadow;
+	/** Size of the shadow maps and count of the lights with shadows (if shadow is set) */
+	GLint shadowResolution;
+	GLint shadowLights;
 	GLboolean cameraMovement;
+	GLfloat viewDistance;
+	/** Distance of the coarse meshes and the impostors of the dynamic and active objects */
+	GLfloat lodDistance;
+	GLfloat impostorDistance;
 	GLfloat tanFov;
 	GLfloat aspectRatio;
 
@@ -91,20 +119,29 @@ struct Options {
 
 /**
  * Shader program uniform ids
+ *
+ * The uniforms that are not used by a variant have -1 location.
  */
 struct ShaderInfo {
 	GLuint shaderId;
 	GLuint cameraPosition;
-	GLuint lightPosition;
-	GLuint lightColor;
-	GLuint lightInfo;
+	GLuint lightBlock;
+	GLuint clusterScale;
+	GLuint lightClusters;
+	GLuint lightIndices;
 	GLuint texturePosition;
-	GLuint numLights;
 	GLuint baseColor;
 	GLuint projMat;
 	GLuint viewMat;
-	GLuint moveMat;
 	GLuint modelMat;
+	GLuint packedFaces;
+	GLuint faces;
+	GLuint palette;
+	GLuint staticShadows;
+	GLuint dynamicShadows;
+	GLuint lightMasks;
+	GLuint time;
+	GLuint alphaCutoff;
 };
 
 /**
@@ -115,21 +152,59 @@ struct CameraInfo {
 	GLfloat position[3];
 	GLfloat projMat[16];
 	GLfloat viewMat[16];
+	/** Clipping planes of the view (limited by Options::viewDistance) */
+	GLfloat frustum[6][4];
 
 	GLfloat destinationRotation[3];
 	GLfloat destinationPosition[3];
 };
 
+/**
+ * Light uniform block (std140 layout)
+ *
+ * lightPosition: position, period of the animation (0 if the light is not animated)
+ * lightColor: color, strength2 (the strength at the other end of the animation)
+ * lightInfo: specular, strength, intensity, shadow map layer (-1 if the light has no shadow)
+ * lightAnimation: color2, phase
+ * shadowMat: projection * view matrix of the shadow map layers
+ *
+ * The animated lights are evaluated in the fragment shader, so the block is not changed
+ * by them.
+ */
+struct LightBlock {
+	GLint numLights;
+	GLint padding[3];
+	GLfloat lightPosition[MAX_NUM_LIGHTS][4];
+	GLfloat lightColor[MAX_NUM_LIGHTS][4];
+	GLfloat lightInfo[MAX_NUM_LIGHTS][4];
+	GLfloat lightAnimation[MAX_NUM_LIGHTS][4];
+	GLfloat shadowMat[MAX_SHADOW_LIGHTS][16];
+};
+
+/** Range of a light of a LightBlock (an animated light reaches as far as its stronger end) */
+#define getLightRange(block, i) \
+		(LIGHT_MAX_DIST * sqrtf((block)->lightInfo[i][1] > (block)->lightColor[i][3] \
+				? (block)->lightInfo[i][1] : (block)->lightColor[i][3]))
+
 /**
  * Finalized light info
  *
- * These values will be sent to the GPU
+ * The block is sent to the GPU only if it was changed.
+ * @see LightClusters
+ * @see ShadowMaps
+ * @see LightMasks
  */
 struct LigingInfo {
-	int numLights;
-	GLfloat lightPosition[MAX_NUM_LIGHTS * 3];
-	GLfloat lightColor[MAX_NUM_LIGHTS * 3];
-	GLfloat lightInfo[MAX_NUM_LIGHTS * 3];
+	LightBlock block;
+	LightClusters clusters;
+	ShadowMaps shadows;
+	LightMasks masks;
+	GLuint uniformBuffer;
+	GLboolean changed;
+	/** Variant of the lit passes in this frame */
+	ShaderVariant variant;
+	/** Time of the frame in seconds (the animated lights are evaluated from it) */
+	GLfloat time;
 };
 
 /** Color value setter */
@@ -152,6 +227,7 @@ struct LigingInfo {
 
 void gameInit(GameInstance* this);
 void onRender(GameInstance* this);
+void useShaderVariant(GameInstance *this, ShaderVariant variant);
 void updateCamera(GameInstance* this);
 void onLogic(GameInstance* this);
 
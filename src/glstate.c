@@ -0,0 +1,229 @@
+/**
+ * @file glstate.c
+ * @author Gerviba (Szabo Gergely)
+ * @brief OpenGL state cache
+ *
+ * @par Header:
+ * 		glstate.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stdgame.h"
+
+static GLboolean isUniformChanged(GameInstance *this, GLint location, const void *value, GLsizei size);
+
+/**
+ * Initialize the cache (nothing is known)
+ *
+ * @note Must be called after the OpenGL context is (re)created.
+ *
+ * @param cache The cache
+ */
+void initStateCache(GLStateCache *cache) {
+	cache->programCount = 0;
+	invalidateStateCache(cache);
+}
+
+/**
+ * Forget the bound program, VAO and textures
+ *
+ * Called at the beginning of the frame and after the code that binds them directly.
+ * The uniform values are kept.
+ *
+ * @param cache The cache
+ */
+void invalidateStateCache(GLStateCache *cache) {
+	cache->programKnown = GL_FALSE;
+	cache->vaoKnown = GL_FALSE;
+	memset(cache->textureTarget, 0, sizeof(cache->textureTarget));
+}
+
+/**
+ * Use a shader program
+ *
+ * @param this Actual GameInstance instance
+ * @param program The program
+ */
+void useProgram(GameInstance *this, GLuint program) {
+	GLStateCache *cache = this->glState;
+	RenderStats *stats = &this->renderQueue->current;
+
+	if (cache->programKnown && cache->program == program) {
+		++stats->stateSkipped;
+		return;
+	}
+
+	glUseProgram(program);
+	cache->programKnown = GL_TRUE;
+	cache->program = program;
+	++stats->stateChanges;
+}
+
+/**
+ * Bind a VAO
+ *
+ * @param this Actual GameInstance instance
+ * @param vao The VAO
+ */
+void bindVertexArray(GameInstance *this, GLuint vao) {
+	GLStateCache *cache = this->glState;
+	RenderStats *stats = &this->renderQueue->current;
+
+	if (cache->vaoKnown && cache->vao == vao) {
+		++stats->stateSkipped;
+		return;
+	}
+
+	glBindVertexArray(vao);
+	cache->vaoKnown = GL_TRUE;
+	cache->vao = vao;
+	++stats->stateChanges;
+}
+
+/**
+ * Bind a texture to a texture unit
+ *
+ * The active texture unit is set back to GL_TEXTURE0.
+ *
+ * @param this Actual GameInstance instance
+ * @param unit Texture unit (0 - STATE_TEXTURE_UNITS-1)
+ * @param target Texture target (eg. GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BUFFER)
+ * @param texture The texture
+ */
+void bindTexture(GameInstance *this, GLuint unit, GLenum target, GLuint texture) {
+	GLStateCache *cache = this->glState;
+	RenderStats *stats = &this->renderQueue->current;
+
+	if (cache->textureTarget[unit] == target && cache->texture[unit] == texture) {
+		++stats->stateSkipped;
+		return;
+	}
+
+	if (unit != 0)
+		glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(target, texture);
+	if (unit != 0)
+		glActiveTexture(GL_TEXTURE0);
+
+	cache->textureTarget[unit] = target;
+	cache->texture[unit] = texture;
+	++stats->stateChanges;
+}
+
+/**
+ * Check and store the value of a uniform of the current program
+ *
+ * @param this Actual GameInstance instance
+ * @param location Location of the uniform
+ * @param value The new value
+ * @param size Size of the value in bytes
+ * @return The value must be uploaded
+ */
+static GLboolean isUniformChanged(GameInstance *this, GLint location, const void *value, GLsizei size) {
+	GLStateCache *cache = this->glState;
+	RenderStats *stats = &this->renderQueue->current;
+
+	++stats->stateChanges;
+	if (!cache->programKnown || location < 0 || location >= STATE_UNIFORMS
+			|| size > (GLsizei) sizeof(GLfloat[16]))
+		return GL_TRUE;
+
+	ProgramUniforms *uniforms = NULL;
+	int i;
+	for (i = 0; i < cache->programCount; ++i)
+		if (cache->programs[i].program == cache->program)
+			uniforms = &cache->programs[i];
+
+	if (uniforms == NULL) {
+		if (cache->programCount == STATE_PROGRAMS)
+			return GL_TRUE;
+		uniforms = &cache->programs[cache->programCount++];
+		uniforms->program = cache->program;
+		memset(uniforms->size, 0, sizeof(uniforms->size));
+	}
+
+	if (uniforms->size[location] == size && memcmp(uniforms->value[location], value, size) == 0) {
+		--stats->stateChanges;
+		++stats->stateSkipped;
+		return GL_FALSE;
+	}
+
+	uniforms->size[location] = size;
+	memcpy(uniforms->value[location], value, size);
+	return GL_TRUE;
+}
+
+/**
+ * Set an int (or sampler) uniform of the current program
+ *
+ * @param this Actual GameInstance instance
+ * @param location Location of the uniform
+ * @param value The value
+ */
+void setUniform1i(GameInstance *this, GLint location, GLint value) {
+	if (isUniformChanged(this, location, &value, sizeof(GLint)))
+		glUniform1i(location, value);
+}
+
+/**
+ * Set an unsigned int uniform of the current program
+ *
+ * @param this Actual GameInstance instance
+ * @param location Location of the uniform
+ * @param value The value
+ */
+void setUniform1ui(GameInstance *this, GLint location, GLuint value) {
+	if (isUniformChanged(this, location, &value, sizeof(GLuint)))
+		glUniform1ui(location, value);
+}
+
+/**
+ * Set a float uniform of the current program
+ *
+ * @param this Actual GameInstance instance
+ * @param location Location of the uniform
+ * @param value The value
+ */
+void setUniform1f(GameInstance *this, GLint location, GLfloat value) {
+	if (isUniformChanged(this, location, &value, sizeof(GLfloat)))
+		glUniform1f(location, value);
+}
+
+/**
+ * Set a vec3 uniform of the current program
+ *
+ * @param this Actual GameInstance instance
+ * @param location Location of the uniform
+ * @param value The value
+ */
+void setUniform3fv(GameInstance *this, GLint location, const GLfloat value[3]) {
+	if (isUniformChanged(this, location, value, sizeof(GLfloat[3])))
+		glUniform3fv(location, 1, value);
+}
+
+/**
+ * Set a vec4 (or vec4 array) uniform of the current program
+ *
+ * @param this Actual GameInstance instance
+ * @param location Location of the uniform
+ * @param count Count of the vectors
+ * @param value The values
+ */
+void setUniform4fv(GameInstance *this, GLint location, GLsizei count, const GLfloat *value) {
+	if (isUniformChanged(this, location, value, sizeof(GLfloat[4]) * count))
+		glUniform4fv(location, count, value);
+}
+
+/**
+ * Set a mat4 uniform of the current program
+ *
+ * @param this Actual GameInstance instance
+ * @param location Location of the uniform
+ * @param value The matrix (column-major)
+ */
+void setUniformMatrix4fv(GameInstance *this, GLint location, const GLfloat value[16]) {
+	if (isUniformChanged(this, location, value, sizeof(GLfloat[16])))
+		glUniformMatrix4fv(location, 1, GL_FALSE, value);
+}
@@ -0,0 +1,71 @@
+/**
+ * @file glstate.h
+ * @author Gerviba (Szabo Gergely)
+ * @brief OpenGL state cache (header)
+ *
+ * @par Definition:
+ * 		glstate.c
+ */
+
+#ifndef GLSTATE_H_
+#define GLSTATE_H_
+
+#include "stdgame.h"
+
+/** Count of the tracked texture units */
+#define STATE_TEXTURE_UNITS 8
+/** Count of the programs with cached uniform values */
+#define STATE_PROGRAMS 4
+/** Uniforms with a larger location are not cached */
+#define STATE_UNIFORMS 64
+
+/**
+ * Last value of the uniforms of a program
+ *
+ * The size is 0 if the value is not known. Values larger than a mat4 are not cached.
+ */
+struct ProgramUniforms {
+	GLuint program;
+	GLsizei size[STATE_UNIFORMS];
+	GLfloat value[STATE_UNIFORMS][16];
+};
+
+/**
+ * Last bound program, VAO, textures and uniform values
+ *
+ * The calls are skipped if the value is the same as the tracked one. The counters are
+ * stored in RenderStats (stateChanges, stateSkipped).
+ *
+ * The binds are only tracked in a frame: the loading code binds VAOs and textures directly,
+ * so the bindings are invalidated at the beginning of the frame. The uniform values are
+ * stored in the program objects, they are kept until the context is recreated.
+ *
+ * @note The active texture unit is always GL_TEXTURE0 outside of these methods.
+ */
+struct GLStateCache {
+	GLboolean programKnown;
+	GLuint program;
+	GLboolean vaoKnown;
+	GLuint vao;
+	/** Target of the bound texture (0 if it is not known) */
+	GLenum textureTarget[STATE_TEXTURE_UNITS];
+	GLuint texture[STATE_TEXTURE_UNITS];
+	ProgramUniforms programs[STATE_PROGRAMS];
+	GLsizei programCount;
+};
+
+void initStateCache(GLStateCache *cache);
+void invalidateStateCache(GLStateCache *cache);
+
+void useProgram(GameInstance *this, GLuint program);
+void bindVertexArray(GameInstance *this, GLuint vao);
+void bindTexture(GameInstance *this, GLuint unit, GLenum target, GLuint texture);
+
+void setUniform1i(GameInstance *this, GLint location, GLint value);
+void setUniform1ui(GameInstance *this, GLint location, GLuint value);
+void setUniform1f(GameInstance *this, GLint location, GLfloat value);
+void setUniform3fv(GameInstance *this, GLint location, const GLfloat value[3]);
+void setUniform4fv(GameInstance *this, GLint location, GLsizei count, const GLfloat *value);
+void setUniformMatrix4fv(GameInstance *this, GLint location, const GLfloat value[16]);
+
+#endif /* GLSTATE_H_ */
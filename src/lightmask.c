@@ -0,0 +1,401 @@
+/**
+ * @file lightmask.c
+ * @author Gerviba (Szabo Gergely)
+ * @brief 2D occlusion masks of the lights
+ *
+ * @par Header:
+ * 		lightmask.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include "stdgame.h"
+
+static void fillOcclusionGrid(Map *map);
+static void growOcclusionGrid(OcclusionGrid *grid, GLint x, GLint y);
+static GLboolean isSolid(const OcclusionGrid *grid, GLint x, GLint y);
+static GLboolean isOccluderCorner(const OcclusionGrid *grid, GLint x, GLint y, GLint lightX, GLint lightY);
+static GLfloat castRay(const OcclusionGrid *grid, const GLfloat origin[2], const GLfloat dir[2], GLfloat maxT);
+static int compareAngles(const void *a, const void *b);
+static void computeLightMask(const OcclusionGrid *grid, LightMask *mask);
+
+/**
+ * Build the grid of the solid tiles
+ *
+ * Called after the map is loaded.
+ *
+ * @param map The map
+ */
+void buildOcclusionGrid(Map *map) {
+	map->occlusion = new(OcclusionGrid);
+	fillOcclusionGrid(map);
+}
+
+/**
+ * Resize and fill the grid from the tiles of the map
+ *
+ * @param map The map
+ */
+static void fillOcclusionGrid(Map *map) {
+	OcclusionGrid *grid = map->occlusion;
+	GLint minX = 0, minY = 0, maxX = -1, maxY = -1, solidCount = 0;
+	GLboolean first = GL_TRUE;
+
+	Iterator it;
+	foreach (it, map->tiles->first) {
+		Tile *tile = it->data;
+		GLint x = (GLint) floorf(tile->x);
+		GLint y = (GLint) floorf(tile->y);
+		minX = first ? x : min(minX, x);
+		minY = first ? y : min(minY, y);
+		maxX = first ? x : max(maxX, x);
+		maxY = first ? y : max(maxY, y);
+		first = GL_FALSE;
+	}
+
+	grid->x = minX;
+	grid->y = minY;
+	grid->width = maxX - minX + 1;
+	grid->height = maxY - minY + 1;
+	grid->solid = calloc(max(1, grid->width * grid->height), sizeof(GLboolean));
+
+	foreach (it, map->tiles->first) {
+		Tile *tile = it->data;
+		if ((tile->type & TTMASK_RENDER_FRONT) == 0)
+			continue;
+
+		GLint index = ((GLint) floorf(tile->y) - grid->y) * grid->width + (GLint) floorf(tile->x) - grid->x;
+		if (!grid->solid[index])
+			++solidCount;
+		grid->solid[index] = GL_TRUE;
+	}
+
+	DEBUG("Map", "Occlusion grid: %dx%d, %d solid tiles", grid->width, grid->height, solidCount);
+}
+
+/**
+ * Extend the grid to contain a cell (the solid cells are kept)
+ *
+ * @param grid The grid
+ * @param x X coordinate of the cell
+ * @param y Y coordinate of the cell
+ */
+static void growOcclusionGrid(OcclusionGrid *grid, GLint x, GLint y) {
+	const GLint minX = min(grid->x, x), minY = min(grid->y, y);
+	const GLint width = max(grid->x + grid->width, x + 1) - minX;
+	const GLint height = max(grid->y + grid->height, y + 1) - minY;
+	GLboolean *solid = calloc(width * height, sizeof(GLboolean));
+
+	int row;
+	for (row = 0; row < grid->height; ++row)
+		memcpy(&solid[(grid->y - minY + row) * width + grid->x - minX], &grid->solid[row * grid->width],
+				sizeof(GLboolean) * grid->width);
+
+	free(grid->solid);
+	grid->solid = solid;
+	grid->x = minX;
+	grid->y = minY;
+	grid->width = width;
+	grid->height = height;
+}
+
+/**
+ * Update a cell of the grid and invalidate the masks of the lights around it
+ *
+ * Called by markTileChunkDirty() (after a tile is added or changed). Only the masks whose
+ * range overlaps the cell are invalidated.
+ *
+ * @param map The map
+ * @param x X coordinate of the cell
+ * @param y Y coordinate of the cell
+ * @param solid There is a foreground tile in the cell
+ */
+void markOcclusionDirty(Map *map, GLint x, GLint y, GLboolean solid) {
+	OcclusionGrid *grid = map->occlusion;
+	if (x < grid->x || y < grid->y || x >= grid->x + grid->width || y >= grid->y + grid->height) {
+		if (!solid)
+			return;
+		growOcclusionGrid(grid, x, y);
+	}
+
+	GLboolean *cell = &grid->solid[(y - grid->y) * grid->width + x - grid->x];
+	if (*cell == solid)
+		return;
+	*cell = solid;
+
+	Iterator it;
+	foreach (it, map->lights->first) {
+		LightMask *mask = ((Light *) it->data)->mask;
+		if (mask != NULL && fabsf(x + 0.5f - mask->position[X]) <= mask->range + 0.5f
+				&& fabsf(y + 0.5f - mask->position[Y]) <= mask->range + 0.5f)
+			mask->valid = GL_FALSE;
+	}
+}
+
+/**
+ * Free the grid and the cached masks of the lights
+ *
+ * @param map The map
+ */
+void freeOcclusionGrid(Map *map) {
+	Iterator it;
+	foreach (it, map->lights->first) {
+		Light *light = it->data;
+		free(light->mask);
+		light->mask = NULL;
+	}
+
+	free(map->occlusion->solid);
+	free(map->occlusion);
+}
+
+/**
+ * Get a cell of the grid
+ *
+ * @param grid The grid
+ * @param x X coordinate of the tile
+ * @param y Y coordinate of the tile
+ * @return There is a solid tile (the outside of the map is empty)
+ */
+static GLboolean isSolid(const OcclusionGrid *grid, GLint x, GLint y) {
+	x -= grid->x;
+	y -= grid->y;
+	if (x < 0 || y < 0 || x >= grid->width || y >= grid->height)
+		return GL_FALSE;
+	return grid->solid[y * grid->width + x];
+}
+
+/**
+ * Check if a grid corner is a corner of a solid tile
+ *
+ * The tile of the light is not an occluder (a light can be placed into a wall).
+ *
+ * @param grid The grid
+ * @param x X coordinate of the corner
+ * @param y Y coordinate of the corner
+ * @param lightX X coordinate of the tile of the light
+ * @param lightY Y coordinate of the tile of the light
+ * @return The rays next to the corner are needed
+ */
+static GLboolean isOccluderCorner(const OcclusionGrid *grid, GLint x, GLint y, GLint lightX, GLint lightY) {
+	int dx, dy;
+	for (dx = -1; dx <= 0; ++dx)
+		for (dy = -1; dy <= 0; ++dy)
+			if ((x + dx != lightX || y + dy != lightY) && isSolid(grid, x + dx, y + dy))
+				return GL_TRUE;
+	return GL_FALSE;
+}
+
+/**
+ * Cast a ray through the grid
+ *
+ * The tile of the origin is skipped.
+ *
+ * @param grid The grid
+ * @param origin Start of the ray
+ * @param dir Normalized direction of the ray
+ * @param maxT Maximum distance
+ * @return Distance of the first solid tile (or maxT)
+ */
+static GLfloat castRay(const OcclusionGrid *grid, const GLfloat origin[2], const GLfloat dir[2], GLfloat maxT) {
+	GLint x = (GLint) floorf(origin[X]);
+	GLint y = (GLint) floorf(origin[Y]);
+	const GLint startX = x, startY = y;
+	const GLint stepX = dir[X] > 0 ? 1 : -1;
+	const GLint stepY = dir[Y] > 0 ? 1 : -1;
+	const GLfloat deltaX = dir[X] != 0 ? fabsf(1.0f / dir[X]) : FLT_MAX;
+	const GLfloat deltaY = dir[Y] != 0 ? fabsf(1.0f / dir[Y]) : FLT_MAX;
+	GLfloat nextX = dir[X] > 0 ? (x + 1 - origin[X]) * deltaX : dir[X] < 0 ? (origin[X] - x) * deltaX : FLT_MAX;
+	GLfloat nextY = dir[Y] > 0 ? (y + 1 - origin[Y]) * deltaY : dir[Y] < 0 ? (origin[Y] - y) * deltaY : FLT_MAX;
+	GLfloat t = 0.0f;
+
+	while (t < maxT) {
+		if ((x != startX || y != startY) && isSolid(grid, x, y))
+			return t;
+
+		if (nextX < nextY) {
+			t = nextX;
+			nextX += deltaX;
+			x += stepX;
+		} else {
+			t = nextY;
+			nextY += deltaY;
+			y += stepY;
+		}
+	}
+	return maxT;
+}
+
+/**
+ * qsort comparator of the ray angles
+ */
+static int compareAngles(const void *a, const void *b) {
+	const GLfloat angleA = *(const GLfloat *) a;
+	const GLfloat angleB = *(const GLfloat *) b;
+	return (angleA > angleB) - (angleA < angleB);
+}
+
+/**
+ * Compute the visibility polygon of a light and rasterize it into the mask
+ *
+ * Rays are sent to the corners of the solid tiles in the range (and next to them), and
+ * to the corners of the mask. The sorted hit points form a triangle fan around the light.
+ * A texel is visible if it is inside the triangle of its angle.
+ *
+ * @param grid The grid
+ * @param mask The mask (position and range are set)
+ */
+static void computeLightMask(const OcclusionGrid *grid, LightMask *mask) {
+	const GLfloat range = mask->range;
+	const GLint lightX = (GLint) floorf(mask->position[X]);
+	const GLint lightY = (GLint) floorf(mask->position[Y]);
+	const GLint minX = (GLint) floorf(mask->position[X] - range);
+	const GLint minY = (GLint) floorf(mask->position[Y] - range);
+	const GLint maxX = (GLint) ceilf(mask->position[X] + range);
+	const GLint maxY = (GLint) ceilf(mask->position[Y] + range);
+
+	GLfloat *angles = malloc(sizeof(GLfloat) * ((maxX - minX + 1) * (maxY - minY + 1) * 3 + 4));
+	GLint count = 0, x, y, k;
+
+	/** The corners of the mask close the polygon */
+	for (k = 0; k < 4; ++k)
+		angles[count++] = (GLfloat) M_PI * (k * 0.5f - 0.75f);
+
+	for (x = minX; x <= maxX; ++x) {
+		for (y = minY; y <= maxY; ++y) {
+			if (!isOccluderCorner(grid, x, y, lightX, lightY))
+				continue;
+
+			GLfloat angle = atan2f(y - mask->position[Y], x - mask->position[X]);
+			angles[count++] = angle - LIGHT_MASK_EPSILON;
+			angles[count++] = angle;
+			angles[count++] = angle + LIGHT_MASK_EPSILON;
+		}
+	}
+	qsort(angles, count, sizeof(GLfloat), compareAngles);
+
+	/** Hit points relative to the light */
+	GLfloat (*points)[2] = malloc(sizeof(GLfloat[2]) * count);
+	for (k = 0; k < count; ++k) {
+		const GLfloat dir[2] = {cosf(angles[k]), sinf(angles[k])};
+		const GLfloat rangeX = fabsf(dir[X]) > 0 ? range / fabsf(dir[X]) : FLT_MAX;
+		const GLfloat rangeY = fabsf(dir[Y]) > 0 ? range / fabsf(dir[Y]) : FLT_MAX;
+		const GLfloat t = castRay(grid, mask->position, dir, min(rangeX, rangeY));
+		points[k][X] = dir[X] * t;
+		points[k][Y] = dir[Y] * t;
+	}
+
+	for (y = 0; y < LIGHT_MASK_SIZE; ++y) {
+		for (x = 0; x < LIGHT_MASK_SIZE; ++x) {
+			const GLfloat px = ((x + 0.5f) / LIGHT_MASK_SIZE * 2.0f - 1.0f) * range;
+			const GLfloat py = ((y + 0.5f) / LIGHT_MASK_SIZE * 2.0f - 1.0f) * range;
+			const GLfloat angle = atan2f(py, px);
+
+			/** Last ray before the angle (binary search), the first triangle is wrapped */
+			GLint low = 0, high = count;
+			while (low < high) {
+				GLint middle = (low + high) / 2;
+				if (angles[middle] <= angle)
+					low = middle + 1;
+				else
+					high = middle;
+			}
+			const GLfloat *a = points[(low + count - 1) % count];
+			const GLfloat *b = points[low % count];
+
+			/** The texel and the light are on the same side of the far edge */
+			const GLfloat edge = (b[X] - a[X]) * (py - a[Y]) - (b[Y] - a[Y]) * (px - a[X]);
+			const GLfloat light = (b[X] - a[X]) * -a[Y] - (b[Y] - a[Y]) * -a[X];
+			mask->texels[y * LIGHT_MASK_SIZE + x] = edge * light >= 0.0f ? 255 : 0;
+		}
+	}
+
+	free(points);
+	free(angles);
+}
+
+/**
+ * Initialize the light masks (the texture is created when it is first used)
+ *
+ * @note Must be called after the OpenGL context is (re)created.
+ *
+ * @param masks The light masks
+ */
+void initLightMasks(LightMasks *masks) {
+	memset(masks, 0, sizeof(LightMasks));
+}
+
+/**
+ * Update the masks of the lights of the block and upload the changed layers
+ *
+ * A mask is recomputed only if its light is moved or the tiles around it are changed
+ * (see markOcclusionDirty()). A layer is uploaded only if its light or mask is changed.
+ *
+ * @param this Actual GameInstance instance
+ * @param block The light block
+ * @param lights The lights of the block
+ */
+void updateLightMasks(GameInstance *this, const LightBlock *block, Light **lights) {
+	/** Not reset with the masks, so a recomputed mask never gets the version of an uploaded layer */
+	static GLuint version = 0;
+	LightMasks *masks = &this->lighting->masks;
+
+	if (masks->texture == 0) {
+		glGenTextures(1, &masks->texture);
+		bindTexture(this, LIGHT_MASK_TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, masks->texture);
+		glActiveTexture(GL_TEXTURE0 + LIGHT_MASK_TEXTURE_UNIT);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8, LIGHT_MASK_SIZE, LIGHT_MASK_SIZE, LIGHT_MASK_LAYERS, 0,
+				GL_RED, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	int i;
+	for (i = 0; i < block->numLights; ++i) {
+		Light *light = lights[i];
+		const GLfloat range = getLightRange(block, i);
+
+		if (light->mask == NULL) {
+			light->mask = new(LightMask);
+			light->mask->valid = GL_FALSE;
+		}
+
+		LightMask *mask = light->mask;
+		if (!mask->valid || mask->range != range
+				|| memcmp(mask->position, block->lightPosition[i], sizeof(GLfloat[3])) != 0) {
+			memcpy(mask->position, block->lightPosition[i], sizeof(GLfloat[3]));
+			mask->range = range;
+			computeLightMask(this->map->occlusion, mask);
+			mask->valid = GL_TRUE;
+			mask->version = ++version;
+			++masks->recomputed;
+		}
+
+		if (masks->layers[i] != mask || masks->versions[i] != mask->version) {
+			bindTexture(this, LIGHT_MASK_TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, masks->texture);
+			glActiveTexture(GL_TEXTURE0 + LIGHT_MASK_TEXTURE_UNIT);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, LIGHT_MASK_SIZE, LIGHT_MASK_SIZE, 1,
+					GL_RED, GL_UNSIGNED_BYTE, mask->texels);
+			glActiveTexture(GL_TEXTURE0);
+			masks->layers[i] = mask;
+			masks->versions[i] = mask->version;
+		}
+	}
+}
+
+/**
+ * Delete the texture of the light masks
+ *
+ * @param masks The light masks
+ */
+void freeLightMasks(LightMasks *masks) {
+	if (masks->texture != 0)
+		glDeleteTextures(1, &masks->texture);
+	initLightMasks(masks);
+}
@@ -0,0 +1,70 @@
+/**
+ * @file lightmask.h
+ * @author Gerviba (Szabo Gergely)
+ * @brief 2D occlusion masks of the lights (header)
+ *
+ * @par Definition:
+ * 		lightmask.c
+ */
+
+#ifndef LIGHTMASK_H_
+#define LIGHTMASK_H_
+
+#include "stdgame.h"
+
+/** Width and height of a light mask (it covers the range of the light) */
+#define LIGHT_MASK_SIZE 64
+/** Layers of the light mask texture (one per light of the LightBlock) */
+#define LIGHT_MASK_LAYERS MAX_NUM_LIGHTS
+/** Texture unit of the light masks */
+#define LIGHT_MASK_TEXTURE_UNIT 7
+/** Angle between the rays sent next to a tile corner */
+#define LIGHT_MASK_EPSILON 0.0001f
+
+/**
+ * Solid tiles of the map (the foreground tiles block the lights)
+ */
+struct OcclusionGrid {
+	GLint x, y;
+	GLint width, height;
+	GLboolean *solid;
+};
+
+/**
+ * Visible region of a light in the tile plane (cached per Light)
+ *
+ * The visibility polygon of the light is computed from the OcclusionGrid and rasterized
+ * into a LIGHT_MASK_SIZE x LIGHT_MASK_SIZE square around the light. It is recomputed only
+ * if the light is moved or the tiles around it are changed.
+ */
+struct LightMask {
+	GLfloat position[3];
+	GLfloat range;
+	GLboolean valid;
+	/** Changed at every recompute (the texture layers are uploaded again) */
+	GLuint version;
+	GLubyte texels[LIGHT_MASK_SIZE * LIGHT_MASK_SIZE];
+};
+
+/**
+ * Texture array of the light masks
+ *
+ * The layer of a light is its index in the LightBlock.
+ */
+struct LightMasks {
+	GLuint texture;
+	const LightMask *layers[LIGHT_MASK_LAYERS];
+	GLuint versions[LIGHT_MASK_LAYERS];
+	/** Count of the recomputed masks since the start */
+	GLuint recomputed;
+};
+
+void buildOcclusionGrid(Map *map);
+void markOcclusionDirty(Map *map, GLint x, GLint y, GLboolean solid);
+void freeOcclusionGrid(Map *map);
+
+void initLightMasks(LightMasks *masks);
+void updateLightMasks(GameInstance *this, const LightBlock *block, Light **lights);
+void freeLightMasks(LightMasks *masks);
+
+#endif /* LIGHTMASK_H_ */
@@ -0,0 +1,312 @@
+/**
+ * @file lod.c
+ * @author Gerviba (Szabo Gergely)
+ * @brief Level of detail of the dynamic and active objects
+ *
+ * The objects further than Options::lodDistance are drawn with their coarse mesh (the parts
+ * merged by 2x2x2 at load time), the ones further than Options::impostorDistance with one
+ * textured quad. The impostors are rendered once per map (per object and animation frame)
+ * into the layers of a texture array.
+ *
+ * @par Header:
+ * 		lod.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stdgame.h"
+
+static GLsizei collectImpostorObjects(Map *map, DynamicObject **objects);
+static void getImpostorRotation(Map *map, const DynamicObject *obj, GLfloat rotation[3]);
+static void bakeImpostor(GameInstance *this, Map *map, DynamicObject *obj, GLint layer);
+
+/**
+ * Select the level of detail of an object
+ *
+ * @param this Actual GameInstance instance
+ * @param obj The object (or a part of an ActiveObject)
+ * @param position World space origin of the instance
+ * @return The level of detail
+ */
+ObjectLod getObjectLod(GameInstance *this, const DynamicObject *obj, const GLfloat position[3]) {
+	const GLfloat dx = position[X] - this->camera->position[X];
+	const GLfloat dy = position[Y] - this->camera->position[Y];
+	const GLfloat dz = position[Z] - this->camera->position[Z];
+	const GLfloat distance = dx * dx + dy * dy + dz * dz;
+
+	if (obj->impostorMesh.indexCount > 0
+			&& distance >= this->options->impostorDistance * this->options->impostorDistance)
+		return LOD_IMPOSTOR;
+	if (obj->lodMesh.indexCount > 0
+			&& distance >= this->options->lodDistance * this->options->lodDistance)
+		return LOD_COARSE;
+	return LOD_FULL;
+}
+
+/**
+ * Calculate the move matrix of an impostor
+ *
+ * The quad is already rotated, only the scale (rows of the basis) and the translation is used.
+ *
+ * @param lodMat Output matrix
+ * @param moveMat Move matrix of the instance
+ */
+void getImpostorMatrix(GLfloat lodMat[16], const GLfloat moveMat[16]) {
+	int i;
+	mat4Identity(lodMat);
+	for (i = 0; i < 3; ++i) {
+		lodMat[i * 5] = sqrtf(moveMat[i] * moveMat[i] + moveMat[4 + i] * moveMat[4 + i]
+				+ moveMat[8 + i] * moveMat[8 + i]);
+		lodMat[12 + i] = moveMat[12 + i];
+	}
+}
+
+/**
+ * Submit an object with the mesh of its level of detail
+ *
+ * The impostors are drawn without the rotation of the instance (they are rendered with the
+ * rotation of the first instance of the object).
+ *
+ * @param this Actual GameInstance instance
+ * @param obj The object (or the active part of an ActiveObject)
+ * @param moveMat Move matrix of the instance
+ * @param baseColor Base color of the object meshes
+ */
+void submitObjectLod(GameInstance *this, DynamicObject *obj, const GLfloat moveMat[16],
+		const GLfloat baseColor[4]) {
+	GLfloat lodMat[16];
+
+	switch (getObjectLod(this, obj, &moveMat[12])) {
+		case LOD_IMPOSTOR:
+			getImpostorMatrix(lodMat, moveMat);
+			submitRenderItem(this, RL_OBJECTS, &obj->impostorMesh, this->map->objects->impostorAtlas,
+					lodMat, baseColor);
+			break;
+		case LOD_COARSE:
+			mat4Multiply(lodMat, moveMat, obj->lodMat);
+			submitRenderItem(this, RL_OBJECTS, &obj->lodMesh, this->map->textureArray, lodMat, baseColor);
+			break;
+		default:
+			submitRenderItem(this, RL_OBJECTS, &obj->mesh, this->map->textureArray, moveMat, baseColor);
+			break;
+	}
+}
+
+/**
+ * Collect the objects of the map which can have an impostor
+ *
+ * The translucent objects are left out (they are blended in the transparent pass anyway).
+ *
+ * @param map The map
+ * @param objects Output (can be NULL to count only)
+ * @return Count of the objects
+ */
+static GLsizei collectImpostorObjects(Map *map, DynamicObject **objects) {
+	GLsizei count = 0;
+	Iterator it;
+	int i;
+
+	foreach (it, map->objects->dynamicObjects->first) {
+		DynamicObject *obj = it->data;
+		if (obj->mesh.indexCount > 0 && !obj->mesh.transparent) {
+			if (objects != NULL)
+				objects[count] = obj;
+			++count;
+		}
+	}
+	foreach (it, map->objects->activeObjects->first) {
+		ActiveObject *aobj = it->data;
+		for (i = 0; i < aobj->size; ++i) {
+			DynamicObject *obj = &aobj->parts[i];
+			if (obj->mesh.indexCount > 0 && !obj->mesh.transparent) {
+				if (objects != NULL)
+					objects[count] = obj;
+				++count;
+			}
+		}
+	}
+	return count;
+}
+
+/**
+ * Get the rotation of the first instance of an object (the rotation of the object if it has no instance)
+ *
+ * The reference points are not moved while the map is loaded, so they are left out.
+ *
+ * @param map The map
+ * @param obj The object (or a part of an ActiveObject)
+ * @param rotation Output: rotation angles (same as in the move matrix of the instance)
+ */
+static void getImpostorRotation(Map *map, const DynamicObject *obj, GLfloat rotation[3]) {
+	const GLfloat *instanceRotation = NULL;
+	Iterator it;
+
+	foreach (it, map->objects->dynamicInstances->first) {
+		DynamicObjectInstance *instance = it->data;
+		if (instance->object == obj) {
+			instanceRotation = instance->rotation;
+			break;
+		}
+	}
+	if (instanceRotation == NULL) {
+		foreach (it, map->objects->activeInstances->first) {
+			ActiveObjectInstance *instance = it->data;
+			if (obj >= instance->object->parts && obj < instance->object->parts + instance->object->size) {
+				instanceRotation = instance->rotation;
+				break;
+			}
+		}
+	}
+
+	int i;
+	for (i = 0; i < 3; ++i)
+		rotation[i] = obj->rotation[i] + (instanceRotation != NULL ? instanceRotation[i] : 0.0f);
+}
+
+/**
+ * Render the front view of an object into the bound atlas layer and make its quad
+ *
+ * The object is rendered unlit (only the colors) with the rotation of its first instance,
+ * the quad is lit like a face looking to the camera. The projection is flipped vertically,
+ * so the first row of the layer is the top of the object (the V coordinate of the quad
+ * starts at the top).
+ *
+ * @param this Actual GameInstance instance
+ * @param map The map of the object (not the current one yet)
+ * @param obj The object
+ * @param layer Layer of the atlas
+ */
+static void bakeImpostor(GameInstance *this, Map *map, DynamicObject *obj, GLint layer) {
+	static const GLfloat WHITE[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+	GLfloat rotation[3], rotationMat[16], min[3], max[3];
+
+	getImpostorRotation(map, obj, rotation);
+	mat4Identity(rotationMat);
+	mat4Rotate(rotationMat, -rotation[X], 1.0f, 0.0f, 0.0f);
+	mat4Rotate(rotationMat, -rotation[Y], 0.0f, 1.0f, 0.0f);
+	mat4Rotate(rotationMat, -rotation[Z], 0.0f, 0.0f, 1.0f);
+	transformBox(min, max, rotationMat, obj->mesh.min, obj->mesh.max);
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	mat4Ortho(this->camera->projMat, min[X], max[X], max[Y], min[Y], -max[Z] - 0.5f, -min[Z] + 0.5f);
+	submitRenderItem(this, RL_OVERLAY, &obj->mesh, map->textureArray, rotationMat, WHITE);
+	flushRenderQueue(this);
+
+	MeshBuilder builder;
+	initMeshBuilder(&builder);
+	meshAddTexturedQuad(&builder, (GLfloat[]) {
+			max[X] - min[X], 0.0f, 0.0f, 0.0f,
+			0.0f, max[Y] - min[Y], 0.0f, 0.0f,
+			0.0f, 0.0f, 1.0f, 0.0f,
+			min[X], min[Y], max[Z], 1.0f}, layer, 1.0f, 1.0f);
+	uploadMesh(&obj->impostorMesh, &builder);
+	freeMeshBuilder(&builder);
+
+	/** The pixels around the object are transparent */
+	obj->impostorMesh.transparent = GL_TRUE;
+}
+
+/**
+ * Render the impostors of the dynamic and active objects of the map
+ *
+ * One layer of the impostor atlas per object and animation frame.
+ *
+ * @note Called after the map is loaded (the camera is reset after this).
+ *
+ * @param this Actual GameInstance instance
+ * @param map The map
+ */
+void buildImpostors(GameInstance *this, Map *map) {
+	GLint maxLayers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+	GLsizei count = collectImpostorObjects(map, NULL);
+	if (count == 0)
+		return;
+	DynamicObject **objects = malloc(sizeof(DynamicObject *) * count);
+	collectImpostorObjects(map, objects);
+	if (count > maxLayers) {
+		WARNING("Only %d of %d objects have impostor", maxLayers, count);
+		count = maxLayers;
+	}
+
+	glGenTextures(1, &map->objects->impostorAtlas);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, map->objects->impostorAtlas);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, IMPOSTOR_SIZE, IMPOSTOR_SIZE, count, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	GLint framebufferBinding, viewport[4];
+	GLfloat clearColor[4], projMat[16], viewMat[16];
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebufferBinding);
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+	memcpy(projMat, this->camera->projMat, sizeof(projMat));
+	memcpy(viewMat, this->camera->viewMat, sizeof(viewMat));
+
+	GLuint framebuffer, depth;
+	glGenRenderbuffers(1, &depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, IMPOSTOR_SIZE, IMPOSTOR_SIZE);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+	glViewport(0, 0, IMPOSTOR_SIZE, IMPOSTOR_SIZE);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	/** The flipped projection changes the winding */
+	glFrontFace(GL_CW);
+	mat4Identity(this->camera->viewMat);
+	invalidateStateCache(this->glState);
+	bindSceneFaces(this);
+
+	int i;
+	for (i = 0; i < count; ++i) {
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, map->objects->impostorAtlas, 0, i);
+		if (i == 0 && glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			WARNING("Impostor framebuffer is not complete, the objects have no impostor");
+			glDeleteTextures(1, &map->objects->impostorAtlas);
+			map->objects->impostorAtlas = 0;
+			break;
+		}
+		bakeImpostor(this, map, objects[i], i);
+	}
+
+	glFrontFace(GL_CCW);
+	glClearColor(clearColor[R], clearColor[G], clearColor[B], clearColor[A]);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebufferBinding);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteRenderbuffers(1, &depth);
+	memcpy(this->camera->projMat, projMat, sizeof(projMat));
+	memcpy(this->camera->viewMat, viewMat, sizeof(viewMat));
+	invalidateStateCache(this->glState);
+
+	if (map->objects->impostorAtlas != 0) {
+		glBindTexture(GL_TEXTURE_2D_ARRAY, map->objects->impostorAtlas);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		DEBUG("Object", "%d impostors rendered (%dx%d)", count, IMPOSTOR_SIZE, IMPOSTOR_SIZE);
+	}
+	free(objects);
+}
+
+/**
+ * Free the impostor atlas of the map
+ *
+ * The quads are freed with the objects (freeDynamicObjectMeshes()).
+ *
+ * @param map The map
+ */
+void freeImpostors(Map *map) {
+	if (map->objects->impostorAtlas != 0)
+		glDeleteTextures(1, &map->objects->impostorAtlas);
+	map->objects->impostorAtlas = 0;
+}
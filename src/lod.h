@@ -0,0 +1,38 @@
+/**
+ * @file lod.h
+ * @author Gerviba (Szabo Gergely)
+ * @brief Level of detail of the dynamic and active objects (header)
+ *
+ * @par Definition:
+ * 		lod.c
+ */
+
+#ifndef LOD_H_
+#define LOD_H_
+
+#include "stdgame.h"
+
+/** Width and height of an impostor (atlas layer) in pixels */
+#define IMPOSTOR_SIZE 64
+
+/**
+ * Level of detail of a DynamicObject (or a part of an ActiveObject)
+ */
+typedef enum {
+	/** The greedy meshed parts */
+	LOD_FULL = 0,
+	/** The parts merged by 2x2x2 (DynamicObject::lodMesh) */
+	LOD_COARSE = 1,
+	/** One textured quad (DynamicObject::impostorMesh) */
+	LOD_IMPOSTOR = 2
+} ObjectLod;
+
+ObjectLod getObjectLod(GameInstance *this, const DynamicObject *obj, const GLfloat position[3]);
+void getImpostorMatrix(GLfloat lodMat[16], const GLfloat moveMat[16]);
+void submitObjectLod(GameInstance *this, DynamicObject *obj, const GLfloat moveMat[16],
+		const GLfloat baseColor[4]);
+
+void buildImpostors(GameInstance *this, Map *map);
+void freeImpostors(Map *map);
+
+#endif /* LOD_H_ */
@@ -11,6 +11,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <math.h>
 #include "stdgame.h"
 
 static void (*getAction(int id)) (Component*, GameInstance*);
@@ -19,12 +20,14 @@ static void initMapDefaults(Map* map);
 static void initLists(Map* map);
 static void initObjects(Map* map);
 static void initMenu(Map* map);
+static void loadTextureArray(Map *map);
 
 static void processMeta(GameInstance *this, Map *map, char buff[255]);
 static void processTexture(GameInstance *this, Map *map, char buff[255]);
 static void processTextureBlock(GameInstance *this, Map *map, char buff[255]);
 static void processTile(GameInstance *this, Map *map, char buff[255]);
 static void processStaticLight(GameInstance *this, Map *map, char buff[255]);
+static void processAnimatedLight(GameInstance *this, Map *map, char buff[255]);
 static void processObject(GameInstance *this, Map *map, char buff[255]);
 static void processObjectInstance(GameInstance *this, Map *map, char buff[255]);
 static void processTextComponent(GameInstance *this, Map *map, char buff[255]);
@@ -36,30 +39,75 @@ static void processEntity(GameInstance *this, Map *map, char buff[255]);
 static void processPhysics(GameInstance *this, Map *map, char buff[255]);
 
 /**
- * Loads a texture
+ * Load the textures of the map into a texture array
+ *
+ * Layer 0 is blank (white), the X lines follow from layer 1. All the layers have the
+ * size of the largest texture, smaller ones are resized (nearest neighbour).
  *
  * @note It uses SOIL2
  *
- * @param textureId The texture id pointer
- * @param path Texture file path
+ * @param map The loaded map
  */
-void loadTexture(GLuint *textureId, char path[]) {
-	glGenTextures(1, textureId);
-	glBindTexture(GL_TEXTURE_2D, *textureId);
-
-	char finalPath[255] = "assets/textures/";
-	strcat(finalPath, path);
-	DEBUG("Map", "Loading texture: %s", finalPath);
-
-	int width, height;
-	unsigned char* image = SOIL_load_image(finalPath, &width, &height, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	SOIL_free_image_data(image);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+static void loadTextureArray(Map *map) {
+	int count = 1, width = 1, height = 1;
+	unsigned char **images = NULL;
+	int *sizes = NULL;
+
+	Iterator it;
+	foreach (it, map->textures->first) {
+		Texture *texture = it->data;
+		char finalPath[255] = "assets/textures/";
+		strcat(finalPath, texture->path);
+		DEBUG("Map", "Loading texture: %s", finalPath);
+
+		images = realloc(images, sizeof(unsigned char*) * (count + 1));
+		sizes = realloc(sizes, sizeof(int) * 2 * (count + 1));
+		images[count] = SOIL_load_image(finalPath, &sizes[2 * count], &sizes[2 * count + 1], 0, SOIL_LOAD_RGB);
+		if (images[count] == NULL) {
+			WARNING("Failed to load texture: %s", finalPath);
+			sizes[2 * count] = sizes[2 * count + 1] = 0;
+		}
+		width = max(width, sizes[2 * count]);
+		height = max(height, sizes[2 * count + 1]);
+		++count;
+	}
+
+	/** The RGB rows are tightly packed, the previous alignment is restored after the upload */
+	GLint alignment;
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+	glGenTextures(1, &map->textureArray);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, map->textureArray);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, width, height, count, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+
+	unsigned char *layer = malloc(width * height * 3);
+	int i, x, y;
+	for (i = 0; i < count; ++i) {
+		if (i == TEXTURE_LAYER_BLANK || images[i] == NULL) {
+			memset(layer, 255, width * height * 3);
+		} else {
+			for (y = 0; y < height; ++y) {
+				for (x = 0; x < width; ++x) {
+					int src = (y * sizes[2 * i + 1] / height * sizes[2 * i] + x * sizes[2 * i] / width) * 3;
+					memcpy(&layer[(y * width + x) * 3], &images[i][src], 3);
+				}
+			}
+			SOIL_free_image_data(images[i]);
+		}
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1, GL_RGB, GL_UNSIGNED_BYTE, layer);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+	free(layer);
+	free(images);
+	free(sizes);
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	DEBUG("Map", "Texture array: %d layers of %dx%d", count, width, height);
 }
 
 /**
@@ -319,6 +367,7 @@ static void initLists(Map* map) {
 	map->messages = newList(Message);
 	map->physics = newList(PhysicsArea);
 	map->entities = newList(Entity);
+	map->chunks = newList(TileChunk);
 }
 
 /**
@@ -330,10 +379,12 @@ static void initObjects(Map* map) {
 	map->objects = new(ObjectInfo);
 	map->objects->staticObjects = newList(StaticObject);
 	map->objects->staticInstances = newList(StaticObjectInstance);
+	map->objects->staticBatches = newList(StaticBatch);
 	map->objects->dynamicObjects = newList(DynamicObject);
 	map->objects->dynamicInstances = newList(DynamicObjectInstance);
 	map->objects->activeObjects = newList(ActiveObject);
 	map->objects->activeInstances = newList(ActiveObjectInstance);
+	map->objects->impostorAtlas = 0;
 }
 
 /**
@@ -409,10 +460,9 @@ static void processMeta(GameInstance *this, Map *map, char buff[255]) {
  */
 static void processTexture(GameInstance *this, Map *map, char buff[255]) {
 	Texture texture;
-	char path[255];
 
-	sscanf(buff, "X %d %s", &texture.id, path);
-	loadTexture(&texture.textureId, path);
+	sscanf(buff, "X %d %254s", &texture.id, texture.path);
+	texture.layer = map->textures->last == NULL ? 1 : ((Texture *) map->textures->last->data)->layer + 1;
 	listPush(map->textures, &texture);
 }
 
@@ -431,22 +481,22 @@ static void processTextureBlock(GameInstance *this, Map *map, char buff[255]) {
 
 	sscanf(buff, "Y %d %d %d %d %d %d", &block.id, &side[0], &side[1], &side[2], &side[3], &side[4]);
 
-	Texture **pointers[5] = {&block.base, &block.top, &block.right, &block.bottom, &block.left};
+	GLint *layers[5] = {&block.base, &block.top, &block.right, &block.bottom, &block.left};
 	int i;
 	for (i = 0; i < 5; ++i) {
-		*pointers[i] = NULL;
+		*layers[i] = -1;
 		if (side[i] < 0)
 			continue;
 
 		Iterator it;
 		foreach (it, map->textures->first) {
 			if (((Texture *)it->data)->id == side[i]) {
-				*pointers[i] = (Texture *)it->data;
+				*layers[i] = ((Texture *)it->data)->layer;
 				break;
 			}
 		}
 
-		if (*pointers[i] == NULL)
+		if (*layers[i] == -1)
 			printf("[Map] Texture with id '%d' not found\n", side[i]);
 	}
 
@@ -500,6 +550,11 @@ static void processStaticLight(GameInstance *this, Map *map, char buff[255]) {
 	light.color[G] = (float) g / 255;
 	light.color[B] = (float) b / 255;
 	light.visible = visible == 1;
+	light.strength2 = light.strength;
+	setPositionArray(light.color2, light.color);
+	light.period = 0.0f;
+	light.phase = 0.0f;
+	light.mask = NULL;
 
 	Iterator it;
 	foreach (it, this->referencePoints->first) {
@@ -512,6 +567,50 @@ static void processStaticLight(GameInstance *this, Map *map, char buff[255]) {
 	listPush(map->lights, &light);
 }
 
+/**
+ * Animated light loader processor
+ *
+ * The light has no id (it can't be changed by actions) and it is on the fixed reference
+ * point. The phase is derived from the position.
+ *
+ * @see fileformats.md -> Map and Menu table
+ *
+ * @param this Actual GameInstance instance
+ * @param map The loading map
+ * @param buff The current line
+ */
+static void processAnimatedLight(GameInstance *this, Map *map, char buff[255]) {
+	Light light;
+	unsigned int r, g, b, r2, g2, b2;
+	sscanf(buff, "L %f %f %f %02x%02x%02x %f %02x%02x%02x %f",
+			&light.position[X], &light.position[Y], &light.strength, &r, &g, &b,
+			&light.strength2, &r2, &g2, &b2, &light.period);
+	light.id = -1;
+	light.position[Z] = ANIMATED_LIGHT_Z;
+	light.color[R] = (float) r / 255;
+	light.color[G] = (float) g / 255;
+	light.color[B] = (float) b / 255;
+	light.color2[R] = (float) r2 / 255;
+	light.color2[G] = (float) g2 / 255;
+	light.color2[B] = (float) b2 / 255;
+	light.period = max(light.period, 0.0f);
+	light.phase = fmodf(fabsf(light.position[X] * 0.37f + light.position[Y] * 0.61f), 1.0f);
+	light.specular = 0.0f;
+	light.intensity = 1.0f;
+	light.visible = GL_TRUE;
+	light.mask = NULL;
+
+	Iterator it;
+	foreach (it, this->referencePoints->first) {
+		if (((ReferencePoint *) it->data)->id == FIXED_REFERENCEPOINT_ID) {
+			light.reference = it->data;
+			break;
+		}
+	}
+
+	listPush(map->lights, &light);
+}
+
 /**
  * Object loader processor
  *
@@ -932,6 +1031,7 @@ Map* loadMap(GameInstance *this, char path[]) {
 			case 'Y': processTextureBlock(this, map, buff); break;
 			case 'T': processTile(this, map, buff); break;
 			case 'S': processStaticLight(this, map, buff); break;
+			case 'L': processAnimatedLight(this, map, buff); break;
 			case 'O': processObject(this, map, buff); break;
 			case 'I': processObjectInstance(this, map, buff); break;
 			case 'A': processTextComponent(this, map, buff); break;
@@ -962,6 +1062,13 @@ Map* loadMap(GameInstance *this, char path[]) {
 	}
 
 	fclose(file);
+	loadTextureArray(map);
+	buildTileChunks(map);
+	buildOcclusionGrid(map);
+	buildStaticBatches(map);
+	buildImpostors(this, map);
+	buildCullingMeshes(this, map);
+	invalidateShadowMaps(this);
 	setPosition(this->camera->position, 0.0f, 0.0f, 0.0f);
 	fixViewport(this);
 
@@ -986,6 +1093,10 @@ void freeMap(Map *map) {
 	listFree(map->actions);
 	free(map->actions);
 
+	freeTileChunks(map);
+	freeOcclusionGrid(map);
+	freeImpostors(map);
+	glDeleteTextures(1, &map->textureArray);
 	listFree(map->tiles);
 	free(map->tiles);
 	listFree(map->lights);
@@ -1005,6 +1116,7 @@ void freeMap(Map *map) {
 
 	foreach (it, map->objects->staticObjects->first) {
 		StaticObject *temp = it->data;
+		freeMesh(&temp->mesh);
 		listFree(temp->parts);
 		free(temp->parts);
 		listFree(temp->colors);
@@ -1012,11 +1124,13 @@ void freeMap(Map *map) {
 	}
 	listFree(map->objects->staticObjects);
 	free(map->objects->staticObjects);
+	freeStaticBatches(map);
 	listFree(map->objects->staticInstances);
 	free(map->objects->staticInstances);
 
 	foreach (it, map->objects->dynamicObjects->first) {
 		DynamicObject *temp = it->data;
+		freeDynamicObjectMeshes(temp);
 		listFree(temp->parts);
 		free(temp->parts);
 		listFree(temp->colors);
@@ -1031,6 +1145,7 @@ void freeMap(Map *map) {
 		ActiveObject *temp = it->data;
 		int i;
 		for (i = 0; i < temp->size; ++i) {
+			freeDynamicObjectMeshes(&temp->parts[i]);
 			listFree(temp->parts[i].parts);
 			free(temp->parts[i].parts);
 		}
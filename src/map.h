@@ -75,9 +75,27 @@ typedef enum {
 #define HEALT_COMPONENT_ID 		-1000
 #define SCORE_COMPONENT_ID 		-1001
 #define ENTITY_FLOATING_REFERENCEPOINT_ID 8
+/** The reference point that is never moved */
+#define FIXED_REFERENCEPOINT_ID 0
+
+/** Height of the animated lights (L lines have no Z coordinate) */
+#define ANIMATED_LIGHT_Z 1.4f
+
+/**
+ * Maximum allowed lights to render (same as in the fragment shader)
+ *
+ * The LightBlock must fit into 16384 bytes, the minimum of GL_MAX_UNIFORM_BLOCK_SIZE.
+ */
+#define MAX_NUM_LIGHTS 248
+
+/** Texture array layer of the blank (white) texture, used by objects and fonts */
+#define TEXTURE_LAYER_BLANK 0
 
 /**
  * Point light object
+ *
+ * An animated light (L line) oscillates between strength/color and strength2/color2.
+ * It is evaluated in the fragment shader, so it costs no CPU work per frame.
  */
 struct Light {
 	GLint id;
@@ -88,26 +106,37 @@ struct Light {
 	GLfloat intensity;
 	ReferencePoint *reference;
 	GLboolean visible;
+	GLfloat strength2;
+	GLfloat color2[3];
+	/** Length of an oscillation in seconds (0 if the light is not animated) */
+	GLfloat period;
+	/** Phase offset (0.0 - 1.0), so the animated lights are not in sync */
+	GLfloat phase;
+	/** Cached occlusion mask (NULL until the light is first rendered) */
+	LightMask *mask;
 };
 
 /**
- * Loaded texture
+ * Map texture (a layer of Map::textureArray)
  */
 struct Texture {
 	int id;
-	GLuint textureId;
+	GLint layer;
+	char path[255];
 };
 
 /**
  * Block sides textures
+ *
+ * Texture array layers, -1 if the side has no texture.
  */
 struct TextureBlock {
 	int id;
-	Texture *base;
-	Texture *top;
-	Texture *right;
-	Texture *bottom;
-	Texture *left;
+	GLint base;
+	GLint top;
+	GLint right;
+	GLint bottom;
+	GLint left;
 };
 
 /**
@@ -244,6 +273,9 @@ struct Map {
 	LinkedList /*Message*/ *messages;
 	LinkedList /*PhysicsArea*/ *physics;
 	LinkedList /*Entity*/ *entities;
+	LinkedList /*TileChunk*/ *chunks;
+	OcclusionGrid *occlusion;
+	GLuint textureArray;
 
 	ObjectInfo *objects;
 	Menu *menu;
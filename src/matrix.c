@@ -0,0 +1,378 @@
+/**
+ * @file matrix.c
+ * @author Gerviba (Szabo Gergely)
+ * @brief 4x4 matrix operations and frustum tests
+ *
+ * Replaces the fixed-function matrix stack (glTranslatef, glRotatef, glGetFloatv, ...),
+ * so the matrices are calculated without any driver round trip.
+ *
+ * @par Header:
+ * 		matrix.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stdgame.h"
+
+#if defined(__SSE__) && !defined(MATRIX_NO_SIMD)
+#include <xmmintrin.h>
+#define MATRIX_SSE
+#endif
+
+static void multiplyBasis(GLfloat m[16], const GLfloat r[9]);
+
+/**
+ * Load the identity matrix
+ *
+ * @param m Target matrix
+ */
+void mat4Identity(GLfloat m[16]) {
+	static const GLfloat IDENTITY[16] = {
+			1.0f, 0.0f, 0.0f, 0.0f,
+			0.0f, 1.0f, 0.0f, 0.0f,
+			0.0f, 0.0f, 1.0f, 0.0f,
+			0.0f, 0.0f, 0.0f, 1.0f};
+
+	memcpy(m, IDENTITY, sizeof(IDENTITY));
+}
+
+/**
+ * Multiply two matrices (out = a * b)
+ *
+ * @note The output can be the same as any of the inputs.
+ *
+ * @param out Result
+ * @param a Left side
+ * @param b Right side
+ */
+void mat4Multiply(GLfloat out[16], const GLfloat a[16], const GLfloat b[16]) {
+#ifdef MATRIX_SSE
+	const __m128 a0 = _mm_loadu_ps(a);
+	const __m128 a1 = _mm_loadu_ps(a + 4);
+	const __m128 a2 = _mm_loadu_ps(a + 8);
+	const __m128 a3 = _mm_loadu_ps(a + 12);
+	__m128 result[4];
+	int i;
+
+	for (i = 0; i < 4; ++i) {
+		result[i] = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(b[i * 4])), _mm_mul_ps(a1, _mm_set1_ps(b[i * 4 + 1]))),
+				_mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(b[i * 4 + 2])), _mm_mul_ps(a3, _mm_set1_ps(b[i * 4 + 3]))));
+	}
+
+	for (i = 0; i < 4; ++i)
+		_mm_storeu_ps(out + i * 4, result[i]);
+#else
+	GLfloat result[16];
+	int i, j;
+
+	for (i = 0; i < 4; ++i)
+		for (j = 0; j < 4; ++j)
+			result[i * 4 + j] = a[j] * b[i * 4] + a[4 + j] * b[i * 4 + 1]
+					+ a[8 + j] * b[i * 4 + 2] + a[12 + j] * b[i * 4 + 3];
+
+	memcpy(out, result, sizeof(result));
+#endif
+}
+
+/**
+ * Multiply by a translation matrix (same as glTranslatef)
+ *
+ * @param m Matrix to modify
+ * @param x Translation along X
+ * @param y Translation along Y
+ * @param z Translation along Z
+ */
+void mat4Translate(GLfloat m[16], GLfloat x, GLfloat y, GLfloat z) {
+#ifdef MATRIX_SSE
+	__m128 column = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m), _mm_set1_ps(x)), _mm_mul_ps(_mm_loadu_ps(m + 4), _mm_set1_ps(y))),
+			_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m + 8), _mm_set1_ps(z)), _mm_loadu_ps(m + 12)));
+	_mm_storeu_ps(m + 12, column);
+#else
+	int i;
+	for (i = 0; i < 4; ++i)
+		m[12 + i] += m[i] * x + m[4 + i] * y + m[8 + i] * z;
+#endif
+}
+
+/**
+ * Multiply by a scale matrix (same as glScalef)
+ *
+ * @param m Matrix to modify
+ * @param x Scale along X
+ * @param y Scale along Y
+ * @param z Scale along Z
+ */
+void mat4Scale(GLfloat m[16], GLfloat x, GLfloat y, GLfloat z) {
+#ifdef MATRIX_SSE
+	_mm_storeu_ps(m, _mm_mul_ps(_mm_loadu_ps(m), _mm_set1_ps(x)));
+	_mm_storeu_ps(m + 4, _mm_mul_ps(_mm_loadu_ps(m + 4), _mm_set1_ps(y)));
+	_mm_storeu_ps(m + 8, _mm_mul_ps(_mm_loadu_ps(m + 8), _mm_set1_ps(z)));
+#else
+	int i;
+	for (i = 0; i < 4; ++i) {
+		m[i] *= x;
+		m[4 + i] *= y;
+		m[8 + i] *= z;
+	}
+#endif
+}
+
+/**
+ * Multiply the first three columns by a 3x3 matrix
+ *
+ * @param m Matrix to modify
+ * @param r Column-major 3x3 matrix
+ */
+static void multiplyBasis(GLfloat m[16], const GLfloat r[9]) {
+#ifdef MATRIX_SSE
+	const __m128 c0 = _mm_loadu_ps(m);
+	const __m128 c1 = _mm_loadu_ps(m + 4);
+	const __m128 c2 = _mm_loadu_ps(m + 8);
+	__m128 result[3];
+	int i;
+
+	for (i = 0; i < 3; ++i) {
+		result[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(r[i * 3])),
+				_mm_mul_ps(c1, _mm_set1_ps(r[i * 3 + 1]))), _mm_mul_ps(c2, _mm_set1_ps(r[i * 3 + 2])));
+	}
+
+	for (i = 0; i < 3; ++i)
+		_mm_storeu_ps(m + i * 4, result[i]);
+#else
+	GLfloat result[12];
+	int i, j;
+
+	for (i = 0; i < 3; ++i)
+		for (j = 0; j < 4; ++j)
+			result[i * 4 + j] = m[j] * r[i * 3] + m[4 + j] * r[i * 3 + 1] + m[8 + j] * r[i * 3 + 2];
+
+	memcpy(m, result, sizeof(result));
+#endif
+}
+
+/**
+ * Multiply by a rotation matrix (same as glRotatef)
+ *
+ * @param m Matrix to modify
+ * @param angle Angle in degrees
+ * @param x X component of the axis
+ * @param y Y component of the axis
+ * @param z Z component of the axis
+ */
+void mat4Rotate(GLfloat m[16], GLfloat angle, GLfloat x, GLfloat y, GLfloat z) {
+	if (angle == 0.0f)
+		return;
+
+	const GLfloat length = sqrtf(x * x + y * y + z * z);
+	if (length == 0.0f)
+		return;
+
+	x /= length;
+	y /= length;
+	z /= length;
+
+	const GLfloat s = (GLfloat) sin(angle * PI / 180.0);
+	const GLfloat c = (GLfloat) cos(angle * PI / 180.0);
+	const GLfloat t = 1.0f - c;
+
+	multiplyBasis(m, (GLfloat[9]) {
+			x * x * t + c, y * x * t + z * s, x * z * t - y * s,
+			x * y * t - z * s, y * y * t + c, y * z * t + x * s,
+			x * z * t + y * s, y * z * t - x * s, z * z * t + c});
+}
+
+/**
+ * Set an orthographic projection matrix (same as glOrtho)
+ *
+ * @param m Result
+ * @param left Left clipping plane
+ * @param right Right clipping plane
+ * @param bottom Bottom clipping plane
+ * @param top Top clipping plane
+ * @param near Near clipping plane (distance)
+ * @param far Far clipping plane (distance)
+ */
+void mat4Ortho(GLfloat m[16], GLfloat left, GLfloat right, GLfloat bottom, GLfloat top,
+		GLfloat near, GLfloat far) {
+	mat4Identity(m);
+	m[0] = 2.0f / (right - left);
+	m[5] = 2.0f / (top - bottom);
+	m[10] = -2.0f / (far - near);
+	m[12] = -(right + left) / (right - left);
+	m[13] = -(top + bottom) / (top - bottom);
+	m[14] = -(far + near) / (far - near);
+}
+
+/**
+ * Create a perspective projection matrix (same as gluPerspective)
+ *
+ * @param m Result
+ * @param fovY Vertical field of view in degrees
+ * @param aspect Width / height
+ * @param near Near clipping plane (distance)
+ * @param far Far clipping plane (distance)
+ */
+void mat4Perspective(GLfloat m[16], GLfloat fovY, GLfloat aspect, GLfloat near, GLfloat far) {
+	const GLfloat f = 1.0f / tanf(fovY * PI / 360.0f);
+
+	memset(m, 0, sizeof(GLfloat[16]));
+	m[0] = f / aspect;
+	m[5] = f;
+	m[10] = (far + near) / (near - far);
+	m[11] = -1.0f;
+	m[14] = 2.0f * far * near / (near - far);
+}
+
+/**
+ * Invert a matrix
+ *
+ * @note The output can be the same as the input.
+ *
+ * @param out Result
+ * @param m Matrix to invert
+ * @return GL_FALSE if the matrix is singular (the output is not modified)
+ */
+GLboolean mat4Invert(GLfloat out[16], const GLfloat m[16]) {
+	GLfloat inv[16];
+
+	inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15]
+			+ m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+	inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15]
+			- m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+	inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15]
+			+ m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+	inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14]
+			- m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+	inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15]
+			- m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+	inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15]
+			+ m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+	inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15]
+			- m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+	inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14]
+			+ m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+	inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15]
+			+ m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+	inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15]
+			- m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+	inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15]
+			+ m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+	inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14]
+			- m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+	inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11]
+			- m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+	inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11]
+			+ m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+	inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11]
+			- m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+	inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10]
+			+ m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+	GLfloat det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+	if (det == 0.0f)
+		return GL_FALSE;
+
+	det = 1.0f / det;
+
+#ifdef MATRIX_SSE
+	const __m128 scale = _mm_set1_ps(det);
+	int i;
+	for (i = 0; i < 4; ++i)
+		_mm_storeu_ps(out + i * 4, _mm_mul_ps(_mm_loadu_ps(inv + i * 4), scale));
+#else
+	int i;
+	for (i = 0; i < 16; ++i)
+		out[i] = inv[i] * det;
+#endif
+	return GL_TRUE;
+}
+
+/**
+ * Extract the clipping planes of the view frustum
+ *
+ * The planes are normalized and point inwards: `dot(plane.xyz, p) + plane.w >= 0` inside.
+ * Order: left, right, bottom, top, near, far.
+ *
+ * @param planes Result
+ * @param viewProj Projection matrix multiplied by the view matrix
+ */
+void extractFrustumPlanes(GLfloat planes[6][4], const GLfloat viewProj[16]) {
+	int i, j;
+	for (i = 0; i < 6; ++i) {
+		const int row = i / 2;
+		const GLfloat sign = (i % 2 == 0) ? 1.0f : -1.0f;
+		for (j = 0; j < 4; ++j)
+			planes[i][j] = viewProj[j * 4 + 3] + sign * viewProj[j * 4 + row];
+
+		const GLfloat length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1]
+				+ planes[i][2] * planes[i][2]);
+		if (length > 0.0f)
+			for (j = 0; j < 4; ++j)
+				planes[i][j] /= length;
+	}
+}
+
+/**
+ * Axis aligned bounding box of a transformed box
+ *
+ * @param outMin Minimum of the result
+ * @param outMax Maximum of the result
+ * @param m Transformation
+ * @param min Minimum of the box
+ * @param max Maximum of the box
+ */
+void transformBox(GLfloat outMin[3], GLfloat outMax[3], const GLfloat m[16],
+		const GLfloat min[3], const GLfloat max[3]) {
+	const GLfloat center[3] = {(min[X] + max[X]) * 0.5f, (min[Y] + max[Y]) * 0.5f, (min[Z] + max[Z]) * 0.5f};
+	const GLfloat extent[3] = {(max[X] - min[X]) * 0.5f, (max[Y] - min[Y]) * 0.5f, (max[Z] - min[Z]) * 0.5f};
+
+	int i;
+	for (i = 0; i < 3; ++i) {
+		const GLfloat c = m[i] * center[X] + m[4 + i] * center[Y] + m[8 + i] * center[Z] + m[12 + i];
+		const GLfloat e = fabsf(m[i]) * extent[X] + fabsf(m[4 + i]) * extent[Y] + fabsf(m[8 + i]) * extent[Z];
+		outMin[i] = c - e;
+		outMax[i] = c + e;
+	}
+}
+
+/**
+ * Check if a box is (at least partially) inside the frustum
+ *
+ * Conservative: a box near a corner of the frustum can be reported as visible.
+ *
+ * @param planes Frustum planes
+ * @param min Minimum of the box
+ * @param max Maximum of the box
+ * @return GL_FALSE if the box is outside
+ */
+GLboolean isBoxInFrustum(GLfloat planes[6][4], const GLfloat min[3], const GLfloat max[3]) {
+	int i;
+	for (i = 0; i < 6; ++i) {
+		const GLfloat *p = planes[i];
+		if (p[0] * (p[0] >= 0.0f ? max[X] : min[X]) + p[1] * (p[1] >= 0.0f ? max[Y] : min[Y])
+				+ p[2] * (p[2] >= 0.0f ? max[Z] : min[Z]) + p[3] < 0.0f)
+			return GL_FALSE;
+	}
+	return GL_TRUE;
+}
+
+/**
+ * Check if a sphere is (at least partially) inside the frustum
+ *
+ * @param planes Frustum planes
+ * @param center Center of the sphere
+ * @param radius Radius of the sphere
+ * @return GL_FALSE if the sphere is outside
+ */
+GLboolean isSphereInFrustum(GLfloat planes[6][4], const GLfloat center[3], GLfloat radius) {
+	int i;
+	for (i = 0; i < 6; ++i)
+		if (planes[i][0] * center[X] + planes[i][1] * center[Y] + planes[i][2] * center[Z]
+				+ planes[i][3] < -radius)
+			return GL_FALSE;
+	return GL_TRUE;
+}
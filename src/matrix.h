@@ -0,0 +1,34 @@
+/**
+ * @file matrix.h
+ * @author Gerviba (Szabo Gergely)
+ * @brief 4x4 matrix operations and frustum tests (header)
+ *
+ * The matrices are column-major GLfloat[16] arrays (same as in OpenGL). The operations
+ * use SSE if the compiler supports it. Define MATRIX_NO_SIMD to use the scalar version.
+ *
+ * @par Definition:
+ * 		matrix.c
+ */
+
+#ifndef MATRIX_H_
+#define MATRIX_H_
+
+#include "stdgame.h"
+
+void mat4Identity(GLfloat m[16]);
+void mat4Multiply(GLfloat out[16], const GLfloat a[16], const GLfloat b[16]);
+void mat4Translate(GLfloat m[16], GLfloat x, GLfloat y, GLfloat z);
+void mat4Scale(GLfloat m[16], GLfloat x, GLfloat y, GLfloat z);
+void mat4Rotate(GLfloat m[16], GLfloat angle, GLfloat x, GLfloat y, GLfloat z);
+void mat4Ortho(GLfloat m[16], GLfloat left, GLfloat right, GLfloat bottom, GLfloat top,
+		GLfloat near, GLfloat far);
+void mat4Perspective(GLfloat m[16], GLfloat fovY, GLfloat aspect, GLfloat near, GLfloat far);
+GLboolean mat4Invert(GLfloat out[16], const GLfloat m[16]);
+
+void extractFrustumPlanes(GLfloat planes[6][4], const GLfloat viewProj[16]);
+void transformBox(GLfloat outMin[3], GLfloat outMax[3], const GLfloat m[16],
+		const GLfloat min[3], const GLfloat max[3]);
+GLboolean isBoxInFrustum(GLfloat planes[6][4], const GLfloat min[3], const GLfloat max[3]);
+GLboolean isSphereInFrustum(GLfloat planes[6][4], const GLfloat center[3], GLfloat radius);
+
+#endif /* MATRIX_H_ */
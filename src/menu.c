@@ -70,6 +70,12 @@ static void setOptionsDefaults(GameInstance* this) {
 	this->options->windowedHeight = 0;
 	this->options->windowedWidth = 0;
 	this->options->cameraMovement = GL_TRUE;
+	this->options->viewDistance = VIEW_DISTANCE_MID;
+	this->options->lodDistance = LOD_DISTANCE_DEFAULT;
+	this->options->impostorDistance = IMPOSTOR_DISTANCE_DEFAULT;
+	this->options->shadow = GL_FALSE;
+	this->options->shadowResolution = SHADOW_RESOLUTION_MID;
+	this->options->shadowLights = SHADOW_LIGHTS_MID;
 
 	array3(this->options->moveLeft.id, GLFW_KEY_A, GLFW_KEY_LEFT, -1.0f);
 	array3(this->options->moveRight.id, GLFW_KEY_D, GLFW_KEY_RIGHT, -1.0f);
@@ -117,6 +123,12 @@ void loadDefaultOptions(GameInstance *this) {
 	fwrite(&this->options->height, sizeof(GLuint), 1, file);
 	fwrite(&this->options->width, sizeof(GLuint), 1, file);
 	fwrite(&this->options->cameraMovement, sizeof(GLboolean), 1, file);
+	fwrite(&this->options->viewDistance, sizeof(GLfloat), 1, file);
+	fwrite(&this->options->lodDistance, sizeof(GLfloat), 1, file);
+	fwrite(&this->options->impostorDistance, sizeof(GLfloat), 1, file);
+	fwrite(&this->options->shadow, sizeof(GLboolean), 1, file);
+	fwrite(&this->options->shadowResolution, sizeof(GLint), 1, file);
+	fwrite(&this->options->shadowLights, sizeof(GLint), 1, file);
 
 	int i;
 	for (i = 0; i < 10; ++i)
@@ -165,6 +177,12 @@ void loadOptions(GameInstance *this) {
 	fread(&this->options->height, sizeof(GLuint), 1, file);
 	fread(&this->options->width, sizeof(GLuint), 1, file);
 	fread(&this->options->cameraMovement, sizeof(GLboolean), 1, file);
+	fread(&this->options->viewDistance, sizeof(GLfloat), 1, file);
+	fread(&this->options->lodDistance, sizeof(GLfloat), 1, file);
+	fread(&this->options->impostorDistance, sizeof(GLfloat), 1, file);
+	fread(&this->options->shadow, sizeof(GLboolean), 1, file);
+	fread(&this->options->shadowResolution, sizeof(GLint), 1, file);
+	fread(&this->options->shadowLights, sizeof(GLint), 1, file);
 
 	int i;
 	for (i = 0; i < 10; ++i)
@@ -207,6 +225,12 @@ void saveOptions(GameInstance *this) {
 	fwrite(&this->options->height, sizeof(GLuint), 1, file);
 	fwrite(&this->options->width, sizeof(GLuint), 1, file);
 	fwrite(&this->options->cameraMovement, sizeof(GLboolean), 1, file);
+	fwrite(&this->options->viewDistance, sizeof(GLfloat), 1, file);
+	fwrite(&this->options->lodDistance, sizeof(GLfloat), 1, file);
+	fwrite(&this->options->impostorDistance, sizeof(GLfloat), 1, file);
+	fwrite(&this->options->shadow, sizeof(GLboolean), 1, file);
+	fwrite(&this->options->shadowResolution, sizeof(GLint), 1, file);
+	fwrite(&this->options->shadowLights, sizeof(GLint), 1, file);
 
 	int i;
 	for (i = 0; i < 10; ++i)
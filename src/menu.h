@@ -11,7 +11,22 @@
 #define MENU_H_
 
 /** Used to determine the up-to-date status of the data/options.dat */
-#define CURRENT_OPTIONS_VERSION 1
+#define CURRENT_OPTIONS_VERSION 4
+
+/** Selectable values of Options::viewDistance (in cubes) */
+#define VIEW_DISTANCE_NEAR 15.0f
+#define VIEW_DISTANCE_MID 30.0f
+#define VIEW_DISTANCE_FAR 60.0f
+
+/** Default values of Options::lodDistance and Options::impostorDistance (in cubes) */
+#define LOD_DISTANCE_DEFAULT 12.0f
+#define IMPOSTOR_DISTANCE_DEFAULT 20.0f
+
+/** Shadow presets of the options menu (Options::shadowResolution and Options::shadowLights) */
+#define SHADOW_RESOLUTION_MID 512
+#define SHADOW_LIGHTS_MID 2
+#define SHADOW_RESOLUTION_AWESOME 1024
+#define SHADOW_LIGHTS_AWESOME 4
 
 /**
  * Menu object
@@ -0,0 +1,893 @@
+/**
+ * @file mesh.c
+ * @author Gerviba (Szabo Gergely)
+ * @brief Mesh builder and baked vertex buffers
+ *
+ * @par Header:
+ * 		mesh.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "stdgame.h"
+
+static void enableInstanceAttributes(void);
+static void reserveMeshBuilder(MeshBuilder *builder, GLsizei vertices, GLsizei indices);
+static void reserveFaces(MeshBuilder *builder, GLsizei faces);
+static void initSceneHeap(SceneHeap *heap, GLsizei capacity);
+static GLint allocSceneRange(SceneHeap *heap, GLsizei count);
+static void releaseSceneRange(SceneHeap *heap, GLint first, GLsizei count);
+static GLboolean growSceneStorage(GLuint *buffer, SceneHeap *heap, GLsizeiptr elementSize);
+static void uploadSceneMesh(Mesh *mesh, MeshBuilder *builder);
+static GLboolean isPackable(const MeshBuilder *builder);
+static GLint getPaletteIndex(SceneBuffer *scene, const GLfloat color[4]);
+static void uploadPalette(SceneBuffer *scene);
+static void reserveQuadPattern(SceneBuffer *scene, GLsizei faces);
+static GLboolean uploadPackedMesh(Mesh *mesh, MeshBuilder *builder);
+
+/** The scene buffer of the new meshes (NULL if the multi-draw path is disabled) */
+static SceneBuffer *sharedScene = NULL;
+/** Id of the last uploaded mesh */
+static GLuint lastMeshId = 0;
+
+/** Corners of the unit quad (3 x Position, 2 x Texture coord) */
+static const GLfloat QUAD_CORNERS[4][5] = {
+		{0.0f, 0.0f, 0.0f,	0.0f, 1.0f},
+		{1.0f, 0.0f, 0.0f,	1.0f, 1.0f},
+		{1.0f, 1.0f, 0.0f,	1.0f, 0.0f},
+		{0.0f, 1.0f, 0.0f,	0.0f, 0.0f}
+};
+
+/**
+ * Enable the per-instance move matrix (INSTANCE_MAT_ATTRIBUTE) of the bound VAO
+ *
+ * Its pointers are set by the render queue before every draw call.
+ */
+static void enableInstanceAttributes(void) {
+	int i;
+	for (i = 0; i < 4; ++i) {
+		glEnableVertexAttribArray(INSTANCE_MAT_ATTRIBUTE + i);
+		glVertexAttribDivisor(INSTANCE_MAT_ATTRIBUTE + i, 1);
+	}
+}
+
+/**
+ * Setup the vertex attribute pointers of the currently bound VBO
+ *
+ * The per-instance move matrix (INSTANCE_MAT_ATTRIBUTE) is only enabled here,
+ * its pointers are set by the render queue before every draw call.
+ *
+ * @see Vertex
+ */
+void setupVertexAttributes(void) {
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) 0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) (sizeof(GLfloat) * 3));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) (sizeof(GLfloat) * 6));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) (sizeof(GLfloat) * 9));
+	glEnableVertexAttribArray(3);
+	enableInstanceAttributes();
+}
+
+/**
+ * Initialize an empty mesh builder
+ *
+ * @param builder The builder
+ */
+void initMeshBuilder(MeshBuilder *builder) {
+	builder->vertexCount = 0;
+	builder->indexCount = 0;
+	builder->vertexCapacity = MESH_BUILDER_CAPACITY;
+	builder->indexCapacity = MESH_BUILDER_CAPACITY / 4 * 6;
+	builder->vertices = malloc(sizeof(Vertex) * builder->vertexCapacity);
+	builder->indices = malloc(sizeof(GLuint) * builder->indexCapacity);
+	builder->faces = NULL;
+	builder->faceCount = 0;
+	builder->faceCapacity = 0;
+}
+
+/**
+ * Grow the storage of the builder
+ *
+ * @param builder The builder
+ * @param vertices Count of the vertices to be added
+ * @param indices Count of the indices to be added
+ */
+static void reserveMeshBuilder(MeshBuilder *builder, GLsizei vertices, GLsizei indices) {
+	if (builder->vertexCount + vertices > builder->vertexCapacity) {
+		while (builder->vertexCount + vertices > builder->vertexCapacity)
+			builder->vertexCapacity *= 2;
+		builder->vertices = realloc(builder->vertices, sizeof(Vertex) * builder->vertexCapacity);
+	}
+	if (builder->indexCount + indices > builder->indexCapacity) {
+		while (builder->indexCount + indices > builder->indexCapacity)
+			builder->indexCapacity *= 2;
+		builder->indices = realloc(builder->indices, sizeof(GLuint) * builder->indexCapacity);
+	}
+}
+
+/**
+ * Grow the face storage of the builder
+ *
+ * @param builder The builder
+ * @param faces Count of the faces to be added
+ */
+static void reserveFaces(MeshBuilder *builder, GLsizei faces) {
+	if (builder->faceCount + faces <= builder->faceCapacity)
+		return;
+
+	if (builder->faceCapacity == 0)
+		builder->faceCapacity = MESH_BUILDER_CAPACITY;
+	while (builder->faceCount + faces > builder->faceCapacity)
+		builder->faceCapacity *= 2;
+	builder->faces = realloc(builder->faces, sizeof(FaceQuad) * builder->faceCapacity);
+}
+
+/**
+ * Add a unit quad with scaled texture coordinates
+ *
+ * @param builder The builder
+ * @param modelMat Model matrix of the face (column-major)
+ * @param color RGBA color of the face
+ * @param layer Texture array layer
+ * @param repeatU Texture repeat count along the first axis
+ * @param repeatV Texture repeat count along the second axis
+ */
+static void addQuad(MeshBuilder *builder, const GLfloat modelMat[16], const GLfloat color[4],
+		GLint layer, GLfloat repeatU, GLfloat repeatV) {
+	reserveMeshBuilder(builder, 4, 6);
+
+	GLuint first = builder->vertexCount;
+	int i;
+	for (i = 0; i < 4; ++i) {
+		Vertex *v = &builder->vertices[builder->vertexCount++];
+		const GLfloat *c = QUAD_CORNERS[i];
+
+		v->position[X] = modelMat[0] * c[X] + modelMat[4] * c[Y] + modelMat[12];
+		v->position[Y] = modelMat[1] * c[X] + modelMat[5] * c[Y] + modelMat[13];
+		v->position[Z] = modelMat[2] * c[X] + modelMat[6] * c[Y] + modelMat[14];
+		v->texCoord[0] = c[3] * repeatU;
+		v->texCoord[1] = c[4] * repeatV;
+		v->texCoord[2] = layer;
+		setPosition(v->normal, modelMat[8], modelMat[9], modelMat[10]);
+		setColor(v->color, color[R], color[G], color[B], color[A]);
+	}
+
+	/** Triangle fan (0, 1, 2, 3) as two triangles */
+	builder->indices[builder->indexCount++] = first;
+	builder->indices[builder->indexCount++] = first + 1;
+	builder->indices[builder->indexCount++] = first + 2;
+	builder->indices[builder->indexCount++] = first;
+	builder->indices[builder->indexCount++] = first + 2;
+	builder->indices[builder->indexCount++] = first + 3;
+}
+
+/**
+ * Add a unit quad transformed by the model matrix
+ *
+ * The quad is the same as the one in the tile VAO, so the already used face matrices
+ * can be baked without any change. The quad uses the blank (white) texture layer.
+ *
+ * @param builder The builder
+ * @param modelMat Model matrix of the face (column-major)
+ * @param color RGBA color of the face
+ */
+void meshAddQuad(MeshBuilder *builder, const GLfloat modelMat[16], const GLfloat color[4]) {
+	addQuad(builder, modelMat, color, TEXTURE_LAYER_BLANK, 1.0f, 1.0f);
+}
+
+/**
+ * Add a white, textured quad transformed by the model matrix
+ *
+ * Used for merged faces. The texture must use `GL_REPEAT` wrapping.
+ *
+ * @param builder The builder
+ * @param modelMat Model matrix of the face (column-major)
+ * @param layer Texture array layer
+ * @param repeatU Texture repeat count along the first axis
+ * @param repeatV Texture repeat count along the second axis
+ */
+void meshAddTexturedQuad(MeshBuilder *builder, const GLfloat modelMat[16], GLint layer,
+		GLfloat repeatU, GLfloat repeatV) {
+	static const GLfloat WHITE[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+	addQuad(builder, modelMat, WHITE, layer, repeatU, repeatV);
+}
+
+/**
+ * Add a voxel face: the quad of the model matrix and its packed form
+ *
+ * The model matrix must be the one of the face in the face table (the vertex shader),
+ * with the edges scaled by the width and the height.
+ *
+ * @param builder The builder
+ * @param modelMat Model matrix of the face (column-major)
+ * @param color RGBA color of the face
+ * @param face Index of the face in the face table
+ * @param width Length of the first edge (units)
+ * @param height Length of the second edge (units)
+ */
+void meshAddFace(MeshBuilder *builder, const GLfloat modelMat[16], const GLfloat color[4],
+		GLint face, GLint width, GLint height) {
+	addQuad(builder, modelMat, color, TEXTURE_LAYER_BLANK, 1.0f, 1.0f);
+	reserveFaces(builder, 1);
+
+	FaceQuad *quad = &builder->faces[builder->faceCount++];
+	int i;
+	for (i = 0; i < 3; ++i) {
+		quad->origin[i] = (GLint) lroundf(modelMat[12 + i] * 2);
+		/** The packed origin must give exactly the same vertices */
+		if (quad->origin[i] * 0.5f != modelMat[12 + i])
+			face = -1;
+	}
+	quad->face = face;
+	quad->width = width;
+	quad->height = height;
+	memcpy(quad->color, color, sizeof(quad->color));
+}
+
+/**
+ * Append the content of another builder, translated by the offset
+ *
+ * The voxel faces are appended too, so the result can still be packed.
+ *
+ * @param builder Target builder
+ * @param source Source builder
+ * @param offset Translation of the source vertices
+ * @return Index of the first appended vertex
+ */
+GLsizei meshAppend(MeshBuilder *builder, const MeshBuilder *source, const GLfloat offset[3]) {
+	reserveMeshBuilder(builder, source->vertexCount, source->indexCount);
+
+	GLsizei first = builder->vertexCount;
+	int i;
+	for (i = 0; i < source->vertexCount; ++i) {
+		Vertex *v = &builder->vertices[first + i];
+		*v = source->vertices[i];
+		v->position[X] += offset[X];
+		v->position[Y] += offset[Y];
+		v->position[Z] += offset[Z];
+	}
+	for (i = 0; i < source->indexCount; ++i)
+		builder->indices[builder->indexCount + i] = source->indices[i] + first;
+
+	builder->vertexCount += source->vertexCount;
+	builder->indexCount += source->indexCount;
+
+	reserveFaces(builder, source->faceCount);
+	for (i = 0; i < source->faceCount; ++i) {
+		FaceQuad *quad = &builder->faces[builder->faceCount++];
+		*quad = source->faces[i];
+
+		int j;
+		for (j = 0; j < 3; ++j) {
+			quad->origin[j] += (GLint) lroundf(offset[j] * 2);
+			if (lroundf(offset[j] * 2) * 0.5f != offset[j])
+				quad->face = -1;
+		}
+	}
+	return first;
+}
+
+/**
+ * Set the color of the vertices and the faces from a vertex to the end of the builder
+ *
+ * @param builder The builder
+ * @param first First vertex to recolor (the first vertex of a quad)
+ * @param color New RGBA color
+ */
+void meshSetColor(MeshBuilder *builder, GLsizei first, const GLfloat color[4]) {
+	int i;
+	for (i = first; i < builder->vertexCount; ++i)
+		setColor(builder->vertices[i].color, color[R], color[G], color[B], color[A]);
+	for (i = first / 4; i < builder->faceCount; ++i)
+		memcpy(builder->faces[i].color, color, sizeof(GLfloat[4]));
+}
+
+/**
+ * Append the content of another builder, transformed by a matrix
+ *
+ * The normals are transformed the same way as in the vertex shader (not normalized).
+ *
+ * @param builder Target builder
+ * @param source Source builder
+ * @param m Transformation of the source vertices (column-major)
+ * @return Index of the first appended vertex
+ */
+GLsizei meshAppendTransformed(MeshBuilder *builder, const MeshBuilder *source, const GLfloat m[16]) {
+	reserveMeshBuilder(builder, source->vertexCount, source->indexCount);
+
+	GLsizei first = builder->vertexCount;
+	int i;
+	for (i = 0; i < source->vertexCount; ++i) {
+		const Vertex *s = &source->vertices[i];
+		Vertex *v = &builder->vertices[first + i];
+		*v = *s;
+		setPosition(v->position,
+				m[0] * s->position[X] + m[4] * s->position[Y] + m[8] * s->position[Z] + m[12],
+				m[1] * s->position[X] + m[5] * s->position[Y] + m[9] * s->position[Z] + m[13],
+				m[2] * s->position[X] + m[6] * s->position[Y] + m[10] * s->position[Z] + m[14]);
+		setPosition(v->normal,
+				m[0] * s->normal[X] + m[4] * s->normal[Y] + m[8] * s->normal[Z],
+				m[1] * s->normal[X] + m[5] * s->normal[Y] + m[9] * s->normal[Z],
+				m[2] * s->normal[X] + m[6] * s->normal[Y] + m[10] * s->normal[Z]);
+	}
+	for (i = 0; i < source->indexCount; ++i)
+		builder->indices[builder->indexCount + i] = source->indices[i] + first;
+
+	builder->vertexCount += source->vertexCount;
+	builder->indexCount += source->indexCount;
+	return first;
+}
+
+/**
+ * Free the CPU side storage of the builder
+ *
+ * @param builder The builder
+ */
+void freeMeshBuilder(MeshBuilder *builder) {
+	free(builder->vertices);
+	free(builder->indices);
+	free(builder->faces);
+	builder->vertices = NULL;
+	builder->indices = NULL;
+	builder->faces = NULL;
+	builder->vertexCount = 0;
+	builder->indexCount = 0;
+	builder->faceCount = 0;
+}
+
+/**
+ * Initialize an empty range allocator
+ *
+ * @param heap The allocator
+ * @param capacity Initial size of the storage
+ */
+static void initSceneHeap(SceneHeap *heap, GLsizei capacity) {
+	heap->used = 0;
+	heap->capacity = capacity;
+	heap->freeCount = 0;
+	heap->freeCapacity = 16;
+	heap->free = malloc(sizeof(SceneRange) * heap->freeCapacity);
+}
+
+/**
+ * Allocate a range (first fit)
+ *
+ * @note If there is no free range large enough, the range is allocated at the end and
+ * 		SceneHeap::used can be larger than the capacity. The storage must be grown then.
+ *
+ * @param heap The allocator
+ * @param count Size of the range
+ * @return First element of the range
+ */
+static GLint allocSceneRange(SceneHeap *heap, GLsizei count) {
+	int i;
+	for (i = 0; i < heap->freeCount; ++i) {
+		SceneRange *range = &heap->free[i];
+		if (range->count < count)
+			continue;
+
+		GLint first = range->first;
+		range->first += count;
+		range->count -= count;
+		if (range->count == 0) {
+			memmove(range, range + 1, sizeof(SceneRange) * (heap->freeCount - i - 1));
+			--heap->freeCount;
+		}
+		return first;
+	}
+
+	GLint first = heap->used;
+	heap->used += count;
+	return first;
+}
+
+/**
+ * Release a range
+ *
+ * @param heap The allocator
+ * @param first First element of the range
+ * @param count Size of the range
+ */
+static void releaseSceneRange(SceneHeap *heap, GLint first, GLsizei count) {
+	if (count == 0)
+		return;
+
+	int i;
+	for (i = 0; i < heap->freeCount && heap->free[i].first < first; ++i);
+
+	GLboolean mergePrevious = i > 0 && heap->free[i - 1].first + heap->free[i - 1].count == first;
+	GLboolean mergeNext = i < heap->freeCount && first + count == heap->free[i].first;
+	if (mergePrevious && mergeNext) {
+		heap->free[i - 1].count += count + heap->free[i].count;
+		memmove(&heap->free[i], &heap->free[i + 1], sizeof(SceneRange) * (heap->freeCount - i - 1));
+		--heap->freeCount;
+	} else if (mergePrevious) {
+		heap->free[i - 1].count += count;
+	} else if (mergeNext) {
+		heap->free[i].first = first;
+		heap->free[i].count += count;
+	} else {
+		if (heap->freeCount == heap->freeCapacity) {
+			heap->freeCapacity *= 2;
+			heap->free = realloc(heap->free, sizeof(SceneRange) * heap->freeCapacity);
+		}
+		memmove(&heap->free[i + 1], &heap->free[i], sizeof(SceneRange) * (heap->freeCount - i));
+		heap->free[i].first = first;
+		heap->free[i].count = count;
+		++heap->freeCount;
+	}
+
+	/** The free range at the end is given back */
+	SceneRange *last = &heap->free[heap->freeCount - 1];
+	if (last->first + last->count == heap->used) {
+		heap->used = last->first;
+		--heap->freeCount;
+	}
+}
+
+/**
+ * Grow the buffer of the storage if the allocated ranges do not fit into it
+ *
+ * The content is copied into a new buffer.
+ *
+ * @param buffer The buffer (replaced by the new one)
+ * @param heap The allocator of the buffer
+ * @param elementSize Size of one element in bytes
+ * @return The buffer is replaced
+ */
+static GLboolean growSceneStorage(GLuint *buffer, SceneHeap *heap, GLsizeiptr elementSize) {
+	if (heap->used <= heap->capacity)
+		return GL_FALSE;
+
+	GLsizei capacity = heap->capacity;
+	while (capacity < heap->used)
+		capacity *= 2;
+
+	GLuint grown;
+	glGenBuffers(1, &grown);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+	glBufferData(GL_COPY_WRITE_BUFFER, elementSize * capacity, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_READ_BUFFER, *buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, elementSize * heap->capacity);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(1, buffer);
+
+	DEBUG("Mesh", "Scene buffer grown from %d to %d elements", heap->capacity, capacity);
+	*buffer = grown;
+	heap->capacity = capacity;
+	return GL_TRUE;
+}
+
+/**
+ * Create the scene buffer and use it for the meshes uploaded after this call
+ *
+ * If the multi-draw path is not supported, the meshes keep their own VAOs.
+ *
+ * @note Must be called after the OpenGL context is created.
+ *
+ * @param scene The scene buffer
+ */
+void initSceneBuffer(SceneBuffer *scene) {
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+	scene->multiDraw = major > 4 || (major == 4 && minor >= 3)
+			|| (major >= 3 && glfwExtensionSupported("GL_ARB_multi_draw_indirect")
+					&& glfwExtensionSupported("GL_ARB_base_instance"));
+	sharedScene = NULL;
+	if (!scene->multiDraw) {
+		DEBUG("Info", "Multi-draw is not supported, using the plain render path");
+		return;
+	}
+
+	initSceneHeap(&scene->vertices, SCENE_BUFFER_CAPACITY);
+	initSceneHeap(&scene->indices, SCENE_BUFFER_CAPACITY / 2 * 3);
+
+	glGenVertexArrays(1, &scene->vao);
+	glBindVertexArray(scene->vao);
+
+	glGenBuffers(1, &scene->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, scene->vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * scene->vertices.capacity, NULL, GL_STATIC_DRAW);
+	setupVertexAttributes();
+
+	glGenBuffers(1, &scene->ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, scene->ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * scene->indices.capacity, NULL, GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	/** Packed faces: no vertex attributes, only the instance matrix */
+	initSceneHeap(&scene->faces, SCENE_FACE_CAPACITY);
+	glGenBuffers(1, &scene->faceBuffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, scene->faceBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(PackedFace) * scene->faces.capacity, NULL, GL_STATIC_DRAW);
+	glGenTextures(1, &scene->faceTexture);
+	glBindTexture(GL_TEXTURE_BUFFER, scene->faceTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, scene->faceBuffer);
+
+	scene->paletteCount = 0;
+	scene->paletteCapacity = SCENE_PALETTE_CAPACITY;
+	scene->palette = malloc(sizeof(GLfloat[4]) * scene->paletteCapacity);
+	glGenBuffers(1, &scene->paletteBuffer);
+	glGenTextures(1, &scene->paletteTexture);
+	uploadPalette(scene);
+
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glGenVertexArrays(1, &scene->faceVao);
+	glBindVertexArray(scene->faceVao);
+	enableInstanceAttributes();
+	glGenBuffers(1, &scene->quadIbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, scene->quadIbo);
+	glBindVertexArray(0);
+	scene->quadCapacity = 0;
+	reserveQuadPattern(scene, MESH_BUILDER_CAPACITY / 4);
+
+	sharedScene = scene;
+	DEBUG("Info", "Multi-draw scene buffer enabled (OpenGL %d.%d)", major, minor);
+}
+
+/**
+ * Bind the packed faces and the palette for the vertex shader
+ *
+ * The sampler uniforms are set by useShaderVariant() even if the packed faces are not
+ * used, because samplers of different types must not use the same texture unit.
+ *
+ * @param this Actual GameInstance instance
+ */
+void bindSceneFaces(GameInstance *this) {
+	SceneBuffer *scene = this->sceneBuffer;
+
+	if (!scene->multiDraw)
+		return;
+
+	bindTexture(this, FACE_TEXTURE_UNIT, GL_TEXTURE_BUFFER, scene->faceTexture);
+	bindTexture(this, PALETTE_TEXTURE_UNIT, GL_TEXTURE_BUFFER, scene->paletteTexture);
+}
+
+/**
+ * Free the scene buffer
+ *
+ * @param scene The scene buffer
+ */
+void freeSceneBuffer(SceneBuffer *scene) {
+	if (sharedScene == scene)
+		sharedScene = NULL;
+	if (!scene->multiDraw)
+		return;
+
+	glDeleteVertexArrays(1, &scene->vao);
+	glDeleteBuffers(1, &scene->vbo);
+	glDeleteBuffers(1, &scene->ibo);
+	free(scene->vertices.free);
+	free(scene->indices.free);
+
+	glDeleteVertexArrays(1, &scene->faceVao);
+	glDeleteTextures(1, &scene->faceTexture);
+	glDeleteBuffers(1, &scene->faceBuffer);
+	glDeleteBuffers(1, &scene->quadIbo);
+	glDeleteTextures(1, &scene->paletteTexture);
+	glDeleteBuffers(1, &scene->paletteBuffer);
+	free(scene->faces.free);
+	free(scene->palette);
+	scene->multiDraw = GL_FALSE;
+}
+
+/**
+ * Upload the content of the builder into the scene buffer
+ *
+ * The indices are relative to Mesh::baseVertex.
+ *
+ * @param mesh Target mesh
+ * @param builder Source builder
+ */
+static void uploadSceneMesh(Mesh *mesh, MeshBuilder *builder) {
+	SceneBuffer *scene = sharedScene;
+	mesh->shared = GL_TRUE;
+	mesh->vao = scene->vao;
+	mesh->vbo = 0;
+	mesh->ibo = 0;
+	mesh->vertexCount = builder->vertexCount;
+	mesh->baseVertex = allocSceneRange(&scene->vertices, builder->vertexCount);
+	mesh->firstIndex = allocSceneRange(&scene->indices, builder->indexCount);
+
+	GLboolean grown = growSceneStorage(&scene->vbo, &scene->vertices, sizeof(Vertex));
+	grown |= growSceneStorage(&scene->ibo, &scene->indices, sizeof(GLuint));
+	if (grown) {
+		glBindVertexArray(scene->vao);
+		glBindBuffer(GL_ARRAY_BUFFER, scene->vbo);
+		setupVertexAttributes();
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, scene->ibo);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, scene->vbo);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(Vertex) * mesh->baseVertex,
+			sizeof(Vertex) * builder->vertexCount, builder->vertices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, scene->ibo);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * mesh->firstIndex,
+			sizeof(GLuint) * builder->indexCount, builder->indices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+/**
+ * Check if the builder can be stored as packed faces
+ *
+ * Every quad must be a voxel face (meshAddFace()) that fits into the bits of PackedFace.
+ *
+ * @param builder The builder
+ */
+static GLboolean isPackable(const MeshBuilder *builder) {
+	if (builder->faceCount == 0 || builder->faceCount * 4 != builder->vertexCount
+			|| builder->faceCount * 6 != builder->indexCount)
+		return GL_FALSE;
+
+	int i, j;
+	for (i = 0; i < builder->faceCount; ++i) {
+		const FaceQuad *quad = &builder->faces[i];
+		if (quad->face < 0 || quad->width < 1 || quad->width > PACKED_MAX_SIZE
+				|| quad->height < 1 || quad->height > PACKED_MAX_SIZE)
+			return GL_FALSE;
+		for (j = 0; j < 3; ++j)
+			if (quad->origin[j] < -PACKED_ORIGIN_BIAS || quad->origin[j] >= PACKED_ORIGIN_BIAS)
+				return GL_FALSE;
+	}
+	return GL_TRUE;
+}
+
+/**
+ * Find or add a color of the palette
+ *
+ * @param scene The scene buffer
+ * @param color RGBA color
+ * @return Index of the color, -1 if the palette is full
+ */
+static GLint getPaletteIndex(SceneBuffer *scene, const GLfloat color[4]) {
+	int i;
+	for (i = 0; i < scene->paletteCount; ++i)
+		if (memcmp(scene->palette[i], color, sizeof(GLfloat[4])) == 0)
+			return i;
+
+	if (scene->paletteCount == PACKED_PALETTE_SIZE)
+		return -1;
+	if (scene->paletteCount == scene->paletteCapacity) {
+		scene->paletteCapacity *= 2;
+		scene->palette = realloc(scene->palette, sizeof(GLfloat[4]) * scene->paletteCapacity);
+	}
+	memcpy(scene->palette[scene->paletteCount], color, sizeof(GLfloat[4]));
+	return scene->paletteCount++;
+}
+
+/**
+ * Add colors to the palette of the packed faces
+ *
+ * Used for the color banks at load time, so the palette is uploaded once per bank
+ * instead of once per baked mesh. Does nothing if the scene buffer is disabled.
+ *
+ * @param colors RGBA colors
+ * @param count Count of the colors
+ */
+void addSceneColors(const GLfloat (*colors)[4], GLsizei count) {
+	if (sharedScene == NULL)
+		return;
+
+	const GLsizei paletteCount = sharedScene->paletteCount;
+	int i;
+	for (i = 0; i < count; ++i)
+		if (getPaletteIndex(sharedScene, colors[i]) < 0)
+			break;
+	if (sharedScene->paletteCount != paletteCount)
+		uploadPalette(sharedScene);
+}
+
+/**
+ * Upload the palette into its texture buffer
+ *
+ * @param scene The scene buffer
+ */
+static void uploadPalette(SceneBuffer *scene) {
+	glBindBuffer(GL_TEXTURE_BUFFER, scene->paletteBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(GLfloat[4]) * scene->paletteCapacity, NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(GLfloat[4]) * scene->paletteCount, scene->palette);
+	glBindTexture(GL_TEXTURE_BUFFER, scene->paletteTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, scene->paletteBuffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+/**
+ * Grow the quad index pattern to cover the faces of a mesh
+ *
+ * The pattern is uploaded through GL_COPY_WRITE_BUFFER, so the element array binding
+ * of the bound VAO is not changed.
+ *
+ * @param scene The scene buffer
+ * @param faces Count of the faces of the mesh
+ */
+static void reserveQuadPattern(SceneBuffer *scene, GLsizei faces) {
+	if (faces <= scene->quadCapacity)
+		return;
+
+	GLsizei capacity = scene->quadCapacity == 0 ? faces : scene->quadCapacity;
+	while (capacity < faces)
+		capacity *= 2;
+
+	GLuint *indices = malloc(sizeof(GLuint) * 6 * capacity);
+	int i;
+	for (i = 0; i < capacity; ++i) {
+		indices[i * 6] = i * 4;
+		indices[i * 6 + 1] = i * 4 + 1;
+		indices[i * 6 + 2] = i * 4 + 2;
+		indices[i * 6 + 3] = i * 4;
+		indices[i * 6 + 4] = i * 4 + 2;
+		indices[i * 6 + 5] = i * 4 + 3;
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, scene->quadIbo);
+	glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * 6 * capacity, indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	free(indices);
+	scene->quadCapacity = capacity;
+}
+
+/**
+ * Upload the faces of the builder into the face buffer of the scene
+ *
+ * The mesh ranges are set in vertices and indices like the ones of the scene VBO,
+ * so the draw commands do not depend on the format: the base vertex is 4 times
+ * the first face, the indices start at the beginning of the quad pattern.
+ *
+ * @param mesh Target mesh
+ * @param builder Source builder
+ * @return The faces are uploaded (false if the builder can not be packed)
+ */
+static GLboolean uploadPackedMesh(Mesh *mesh, MeshBuilder *builder) {
+	SceneBuffer *scene = sharedScene;
+	if (!isPackable(builder))
+		return GL_FALSE;
+
+	const GLsizei paletteCount = scene->paletteCount;
+	PackedFace *packed = malloc(sizeof(PackedFace) * builder->faceCount);
+	int i;
+	for (i = 0; i < builder->faceCount; ++i) {
+		const FaceQuad *quad = &builder->faces[i];
+		GLint color = getPaletteIndex(scene, quad->color);
+		if (color < 0) {
+			WARNING("The face palette is full, the mesh is not packed");
+			scene->paletteCount = paletteCount;
+			free(packed);
+			return GL_FALSE;
+		}
+
+		packed[i].position = (GLuint) (quad->origin[X] + PACKED_ORIGIN_BIAS)
+				| (GLuint) (quad->origin[Y] + PACKED_ORIGIN_BIAS) << 10
+				| (GLuint) (quad->origin[Z] + PACKED_ORIGIN_BIAS) << 20;
+		packed[i].info = (GLuint) quad->face | (GLuint) (quad->width - 1) << 3
+				| (GLuint) (quad->height - 1) << 10 | (GLuint) color << 17;
+	}
+	if (scene->paletteCount != paletteCount)
+		uploadPalette(scene);
+
+	mesh->shared = GL_TRUE;
+	mesh->packed = GL_TRUE;
+	mesh->vao = scene->faceVao;
+	mesh->vbo = 0;
+	mesh->ibo = 0;
+	mesh->baseVertex = allocSceneRange(&scene->faces, builder->faceCount) * 4;
+	mesh->vertexCount = builder->faceCount * 4;
+	mesh->firstIndex = 0;
+	reserveQuadPattern(scene, builder->faceCount);
+
+	if (growSceneStorage(&scene->faceBuffer, &scene->faces, sizeof(PackedFace))) {
+		glBindTexture(GL_TEXTURE_BUFFER, scene->faceTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, scene->faceBuffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, scene->faceBuffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(PackedFace) * (mesh->baseVertex / 4),
+			sizeof(PackedFace) * builder->faceCount, packed);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	free(packed);
+
+	DEBUG("Mesh", "Packed %d faces (%d bytes instead of %d)", builder->faceCount,
+			(int) (sizeof(PackedFace) * builder->faceCount),
+			(int) (sizeof(Vertex) * builder->vertexCount + sizeof(GLuint) * builder->indexCount));
+	return GL_TRUE;
+}
+
+/**
+ * Upload the content of the builder into a new VAO
+ *
+ * Also calculates the bounding box and the transparency of the mesh.
+ * If the SceneBuffer is enabled, the mesh is stored in it instead (as packed faces
+ * if every quad of the builder is a voxel face).
+ *
+ * @note The builder is not freed.
+ *
+ * @param mesh Target mesh
+ * @param builder Source builder
+ */
+void uploadMesh(Mesh *mesh, MeshBuilder *builder) {
+	mesh->indexCount = builder->indexCount;
+	mesh->id = ++lastMeshId;
+
+	int i, j;
+	setPosition(mesh->min, 0.0f, 0.0f, 0.0f);
+	setPosition(mesh->max, 0.0f, 0.0f, 0.0f);
+	mesh->transparent = GL_FALSE;
+	mesh->packed = GL_FALSE;
+	for (i = 0; i < builder->vertexCount; ++i) {
+		if (builder->vertices[i].color[A] < 1.0f)
+			mesh->transparent = GL_TRUE;
+		for (j = 0; j < 3; ++j) {
+			const GLfloat p = builder->vertices[i].position[j];
+			if (i == 0 || p < mesh->min[j])
+				mesh->min[j] = p;
+			if (i == 0 || p > mesh->max[j])
+				mesh->max[j] = p;
+		}
+	}
+
+	if (sharedScene != NULL) {
+		if (!uploadPackedMesh(mesh, builder))
+			uploadSceneMesh(mesh, builder);
+		return;
+	}
+
+	mesh->shared = GL_FALSE;
+	mesh->baseVertex = 0;
+	mesh->vertexCount = builder->vertexCount;
+	mesh->firstIndex = 0;
+
+	glGenVertexArrays(1, &mesh->vao);
+	glBindVertexArray(mesh->vao);
+
+	glGenBuffers(1, &mesh->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * builder->vertexCount, builder->vertices, GL_STATIC_DRAW);
+	setupVertexAttributes();
+
+	glGenBuffers(1, &mesh->ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * builder->indexCount, builder->indices, GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+}
+
+/**
+ * Free the GPU side buffers of the mesh
+ *
+ * @param mesh Mesh to free
+ */
+void freeMesh(Mesh *mesh) {
+	if (mesh->packed) {
+		if (sharedScene != NULL)
+			releaseSceneRange(&sharedScene->faces, mesh->baseVertex / 4, mesh->vertexCount / 4);
+		mesh->indexCount = 0;
+		return;
+	}
+	if (mesh->shared) {
+		if (sharedScene != NULL) {
+			releaseSceneRange(&sharedScene->vertices, mesh->baseVertex, mesh->vertexCount);
+			releaseSceneRange(&sharedScene->indices, mesh->firstIndex, mesh->indexCount);
+		}
+		mesh->indexCount = 0;
+		return;
+	}
+
+	glDeleteBuffers(1, &mesh->vbo);
+	glDeleteBuffers(1, &mesh->ibo);
+	glDeleteVertexArrays(1, &mesh->vao);
+	mesh->indexCount = 0;
+}
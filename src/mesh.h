@@ -0,0 +1,201 @@
+/**
+ * @file mesh.h
+ * @author Gerviba (Szabo Gergely)
+ * @brief Mesh builder and baked vertex buffers (header)
+ *
+ * @par Definition:
+ * 		mesh.c
+ */
+
+#ifndef MESH_H_
+#define MESH_H_
+
+#include "stdgame.h"
+
+/** Initial vertex capacity of a MeshBuilder */
+#define MESH_BUILDER_CAPACITY 64
+/** First location of the per-instance move matrix (mat4, uses 4 locations) */
+#define INSTANCE_MAT_ATTRIBUTE 4
+/** Initial vertex capacity of the SceneBuffer (the index capacity is 1.5 times more) */
+#define SCENE_BUFFER_CAPACITY 65536
+/** Initial capacity of the packed faces and the palette of the SceneBuffer */
+#define SCENE_FACE_CAPACITY 16384
+#define SCENE_PALETTE_CAPACITY 256
+/** Texture units of the packed faces and the palette (the light clusters use 1 and 2) */
+#define FACE_TEXTURE_UNIT 3
+#define PALETTE_TEXTURE_UNIT 4
+/** Bias of the packed origin coordinates (10 bits, half units) */
+#define PACKED_ORIGIN_BIAS 512
+/** Largest packed face edge (7 bits) */
+#define PACKED_MAX_SIZE 128
+/** Count of the palette entries (15 bits) */
+#define PACKED_PALETTE_SIZE 32768
+
+/**
+ * Interleaved vertex
+ *
+ * (3 x Position, 3 x Texture coord (u, v, texture array layer), 3 x Normal vector, 4 x Color)
+ */
+struct Vertex {
+	GLfloat position[3];
+	GLfloat texCoord[3];
+	GLfloat normal[3];
+	GLfloat color[4];
+};
+
+/**
+ * Voxel face recorded next to its quad
+ *
+ * The origin is the translation of the quad in half units, the width and the height are
+ * the edge lengths in units. The face is the index in the face table of the vertex shader.
+ * @see meshAddFace()
+ */
+struct FaceQuad {
+	GLint origin[3];
+	GLint face;
+	GLint width;
+	GLint height;
+	GLfloat color[4];
+};
+
+/**
+ * Mesh builder
+ *
+ * CPU side vertex and index storage. Used only while loading.
+ * If every quad is a voxel face, the faces can be uploaded in the packed format.
+ * @see uploadMesh()
+ */
+struct MeshBuilder {
+	Vertex *vertices;
+	GLuint *indices;
+	GLsizei vertexCount;
+	GLsizei indexCount;
+	GLsizei vertexCapacity;
+	GLsizei indexCapacity;
+	FaceQuad *faces;
+	GLsizei faceCount;
+	GLsizei faceCapacity;
+};
+
+/**
+ * Packed voxel face (64 bits instead of 4 vertices and 6 indices)
+ *
+ *  - position: origin X, Y, Z (10 bits each, half units, PACKED_ORIGIN_BIAS added)
+ *  - info: face (3 bits), width - 1 (7 bits), height - 1 (7 bits), palette index (15 bits)
+ *
+ * The vertex shader generates the corners from gl_VertexID.
+ */
+struct PackedFace {
+	GLuint position;
+	GLuint info;
+};
+
+/**
+ * Baked mesh
+ *
+ * One VAO with an interleaved VBO and an IBO. It can be rendered with a single draw call.
+ * If the SceneBuffer is enabled, the VAO and the buffers are shared and the mesh is
+ * only a range of them. The voxel models are stored as packed faces there.
+ */
+struct Mesh {
+	GLuint vao;
+	GLuint vbo;
+	GLuint ibo;
+	GLsizei indexCount;
+	/** Unique id of the uploaded mesh */
+	GLuint id;
+	/** The mesh is stored in the SceneBuffer */
+	GLboolean shared;
+	/** The mesh is stored as packed faces (4 vertices per face) */
+	GLboolean packed;
+	/** Range of the mesh in the SceneBuffer */
+	GLint baseVertex;
+	GLsizei vertexCount;
+	GLuint firstIndex;
+	/** Bounding box of the vertices (model space) */
+	GLfloat min[3];
+	GLfloat max[3];
+	/** Any of the vertex colors is translucent (rendered in the transparent pass) */
+	GLboolean transparent;
+};
+
+/**
+ * Free range of a SceneHeap
+ */
+struct SceneRange {
+	GLint first;
+	GLsizei count;
+};
+
+/**
+ * Range allocator of a SceneBuffer storage (vertices or indices)
+ *
+ * The free ranges are sorted and the adjacent ones are merged.
+ */
+struct SceneHeap {
+	/** End of the last allocated range */
+	GLsizei used;
+	GLsizei capacity;
+	SceneRange *free;
+	GLsizei freeCount;
+	GLsizei freeCapacity;
+};
+
+/**
+ * Shared vertex and index storage of the meshes (multi-draw path)
+ *
+ * Every mesh uploaded after initSceneBuffer() is a range of the same VBO and IBO, so the
+ * render queue can draw all of them with glMultiDrawElementsIndirect().
+ * It is only enabled if the OpenGL version is at least 4.3 (or ARB_multi_draw_indirect
+ * and ARB_base_instance are supported).
+ *
+ * The voxel models are stored in the face buffer instead (PackedFace). Their VAO has no
+ * vertex attributes, only the instance matrix and a shared quad index pattern, so
+ * the vertex of gl_VertexID is the corner (gl_VertexID % 4) of the face (gl_VertexID / 4).
+ */
+struct SceneBuffer {
+	GLboolean multiDraw;
+	GLuint vao;
+	GLuint vbo;
+	GLuint ibo;
+	SceneHeap vertices;
+	SceneHeap indices;
+
+	GLuint faceVao;
+	GLuint faceBuffer;
+	GLuint faceTexture;
+	SceneHeap faces;
+	/** Quad index pattern (0, 1, 2, 0, 2, 3, 4, 5, ...) of the largest packed mesh */
+	GLuint quadIbo;
+	GLsizei quadCapacity;
+
+	/** Colors of the packed faces (CPU side copy of the palette texture) */
+	GLfloat (*palette)[4];
+	GLsizei paletteCount;
+	GLsizei paletteCapacity;
+	GLuint paletteBuffer;
+	GLuint paletteTexture;
+};
+
+void setupVertexAttributes(void);
+
+void initMeshBuilder(MeshBuilder *builder);
+void meshAddQuad(MeshBuilder *builder, const GLfloat modelMat[16], const GLfloat color[4]);
+void meshAddTexturedQuad(MeshBuilder *builder, const GLfloat modelMat[16], GLint layer,
+		GLfloat repeatU, GLfloat repeatV);
+void meshAddFace(MeshBuilder *builder, const GLfloat modelMat[16], const GLfloat color[4],
+		GLint face, GLint width, GLint height);
+GLsizei meshAppend(MeshBuilder *builder, const MeshBuilder *source, const GLfloat offset[3]);
+void meshSetColor(MeshBuilder *builder, GLsizei first, const GLfloat color[4]);
+GLsizei meshAppendTransformed(MeshBuilder *builder, const MeshBuilder *source, const GLfloat m[16]);
+void freeMeshBuilder(MeshBuilder *builder);
+
+void initSceneBuffer(SceneBuffer *scene);
+void bindSceneFaces(GameInstance *this);
+void addSceneColors(const GLfloat (*colors)[4], GLsizei count);
+void freeSceneBuffer(SceneBuffer *scene);
+
+void uploadMesh(Mesh *mesh, MeshBuilder *builder);
+void freeMesh(Mesh *mesh);
+
+#endif /* MESH_H_ */
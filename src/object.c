@@ -9,9 +9,503 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "stdgame.h"
 
+/**
+ * Face of a cube part
+ *
+ * Rotation (column-major 3x3) and offset of the unit quad. The axes are the world axes
+ * of the first and second quad edge and the normal vector.
+ */
+typedef struct {
+	PartType mask;
+	GLfloat rotation[9];
+	GLfloat offset[3];
+	int axis[3];
+} PartFace;
+
+/** The six faces of a cube part (the same order as FACE_AXES in the vertex shader) */
+static const PartFace PART_FACES[6] = {
+		{PTMASK_RENDER_UP,		{1.0f, 0.0f, 0.0f,	0.0f, 0.0f, -1.0f,	0.0f, 1.0f, 0.0f},	{0.0f, 1.0f, 0.0f},		{X, Z, Y}},
+		{PTMASK_RENDER_DOWN,	{1.0f, 0.0f, 0.0f,	0.0f, 0.0f, 1.0f,	0.0f, -1.0f, 0.0f},	{0.0f, 0.0f, -1.0f},	{X, Z, Y}},
+		{PTMASK_RENDER_TOP,		{-1.0f, 0.0f, 0.0f,	0.0f, 1.0f, 0.0f,	0.0f, 0.0f, -1.0f},	{1.0f, 0.0f, -1.0f},	{X, Y, Z}},
+		{PTMASK_RENDER_LEFT,	{0.0f, 0.0f, 1.0f,	0.0f, 1.0f, 0.0f,	-1.0f, 0.0f, 0.0f},	{0.0f, 0.0f, -1.0f},	{Z, Y, X}},
+		{PTMASK_RENDER_BOTTOM,	{1.0f, 0.0f, 0.0f,	0.0f, 1.0f, 0.0f,	0.0f, 0.0f, 1.0f},	{0.0f, 0.0f, 0.0f},		{X, Y, Z}},
+		{PTMASK_RENDER_RIGHT,	{0.0f, 0.0f, -1.0f,	0.0f, 1.0f, 0.0f,	1.0f, 0.0f, 0.0f},	{1.0f, 0.0f, 0.0f},		{Z, Y, X}}
+};
+
+/** Base color of the object meshes (the colors are baked into the vertices) */
+static const GLfloat OBJECT_BASE_COLOR[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+/**
+ * Visible face of a part, input of the greedy mesher
+ *
+ * The coordinates are doubled, so half unit positions are also exact.
+ */
+typedef struct {
+	int face;
+	int key[3];
+	const GLfloat *color;
+} FaceRecord;
+
+/**
+ * Part of an object in a 2x2x2 cell, input of the coarse mesh
+ */
+typedef struct {
+	int cell[3];
+	const StaticObjectPart *part;
+} LodRecord;
+
+static int compareOccupancyKeys(const void *a, const void *b);
+static void cullParts(LinkedList *parts);
+static int compareFaceRecords(const void *a, const void *b);
+static GLboolean isSameFaceGroup(const FaceRecord *a, const FaceRecord *b);
+static void mergeFaceGroup(MeshBuilder *builder, const FaceRecord *records, int count);
+static void addPartColors(LinkedList *colors);
+static int compareLodRecords(const void *a, const void *b);
+static void bakeLodParts(DynamicObject *obj);
+static StaticBatch *getStaticBatch(Map *map, GLint x, GLint y, GLboolean transparent);
+static void updateStaticBatchRanges(StaticBatch *batch);
+
+/**
+ * Add the visible faces of a cube part to the mesh builder
+ *
+ * @param builder The mesh builder
+ * @param type Visible faces of the part
+ * @param position Position of the part
+ * @param color Color of the part
+ */
+void bakePart(MeshBuilder *builder, PartType type, const GLfloat position[3], const GLfloat color[4]) {
+	int i;
+	for (i = 0; i < 6; ++i) {
+		const PartFace *face = &PART_FACES[i];
+		if ((type & face->mask) == 0)
+			continue;
+
+		meshAddQuad(builder, (GLfloat[]) {
+				face->rotation[0], face->rotation[1], face->rotation[2], 0.0f,
+				face->rotation[3], face->rotation[4], face->rotation[5], 0.0f,
+				face->rotation[6], face->rotation[7], face->rotation[8], 0.0f,
+				position[X] + face->offset[X], position[Y] + face->offset[Y],
+				position[Z] + face->offset[Z], 1.0f}, color);
+	}
+}
+
+/**
+ * Initialize an empty occupancy set
+ *
+ * @param occupancy The set
+ */
+void initPartOccupancy(PartOccupancy *occupancy) {
+	occupancy->count = 0;
+	occupancy->capacity = MESH_BUILDER_CAPACITY;
+	occupancy->keys = malloc(sizeof(GLint[4]) * occupancy->capacity);
+	occupancy->sorted = GL_TRUE;
+}
+
+/**
+ * Add a part position to the occupancy set
+ *
+ * @param occupancy The set
+ * @param position Position of the part
+ * @param opaque The part hides its neighbours' faces (alpha = 1)
+ */
+void addPartOccupancy(PartOccupancy *occupancy, const GLfloat position[3], GLboolean opaque) {
+	if (occupancy->count == occupancy->capacity) {
+		occupancy->capacity *= 2;
+		occupancy->keys = realloc(occupancy->keys, sizeof(GLint[4]) * occupancy->capacity);
+	}
+
+	GLint *key = occupancy->keys[occupancy->count++];
+	key[X] = (GLint) lroundf(position[X] * 2);
+	key[Y] = (GLint) lroundf(position[Y] * 2);
+	key[Z] = (GLint) lroundf(position[Z] * 2);
+	key[3] = opaque;
+	occupancy->sorted = GL_FALSE;
+}
+
+/**
+ * Order of the occupancy keys (position only)
+ */
+static int compareOccupancyKeys(const void *a, const void *b) {
+	const GLint *k1 = a, *k2 = b;
+	if (k1[X] != k2[X])
+		return k1[X] - k2[X];
+	if (k1[Y] != k2[Y])
+		return k1[Y] - k2[Y];
+	return k1[Z] - k2[Z];
+}
+
+/**
+ * Clear the face bits hidden by an opaque neighbour
+ *
+ * Faces next to transparent (alpha < 1) parts are kept.
+ *
+ * @param occupancy The set (sorted on the first call)
+ * @param type Face mask of the part
+ * @param position Position of the part
+ * @return The visible faces
+ */
+PartType getVisibleFaces(PartOccupancy *occupancy, PartType type, const GLfloat position[3]) {
+	int i;
+	if (!occupancy->sorted) {
+		qsort(occupancy->keys, occupancy->count, sizeof(GLint[4]), compareOccupancyKeys);
+
+		/** Merge duplicates, any opaque part hides */
+		int count = 0;
+		for (i = 0; i < occupancy->count; ++i) {
+			if (count > 0 && compareOccupancyKeys(occupancy->keys[count - 1], occupancy->keys[i]) == 0) {
+				occupancy->keys[count - 1][3] |= occupancy->keys[i][3];
+			} else {
+				memcpy(occupancy->keys[count++], occupancy->keys[i], sizeof(GLint[4]));
+			}
+		}
+		occupancy->count = count;
+		occupancy->sorted = GL_TRUE;
+	}
+
+	for (i = 0; i < 6; ++i) {
+		const PartFace *face = &PART_FACES[i];
+		if ((type & face->mask) == 0)
+			continue;
+
+		GLint key[4] = {
+				(GLint) lroundf(position[X] * 2) + 2 * (GLint) face->rotation[6],
+				(GLint) lroundf(position[Y] * 2) + 2 * (GLint) face->rotation[7],
+				(GLint) lroundf(position[Z] * 2) + 2 * (GLint) face->rotation[8],
+				GL_FALSE};
+		GLint *neighbour = bsearch(key, occupancy->keys, occupancy->count, sizeof(GLint[4]), compareOccupancyKeys);
+		if (neighbour != NULL && neighbour[3])
+			type &= ~face->mask;
+	}
+	return type;
+}
+
+/**
+ * Free the occupancy set
+ *
+ * @param occupancy The set
+ */
+void freePartOccupancy(PartOccupancy *occupancy) {
+	free(occupancy->keys);
+	occupancy->keys = NULL;
+	occupancy->count = 0;
+}
+
+/**
+ * Remove the hidden faces of the parts of an object
+ *
+ * @param parts StaticObjectPart list
+ */
+static void cullParts(LinkedList *parts) {
+	PartOccupancy occupancy;
+	initPartOccupancy(&occupancy);
+
+	Iterator it;
+	foreach (it, parts->first) {
+		StaticObjectPart *part = it->data;
+		addPartOccupancy(&occupancy, part->position, part->color[A] >= 1.0f);
+	}
+
+	foreach (it, parts->first) {
+		StaticObjectPart *part = it->data;
+		part->type = getVisibleFaces(&occupancy, part->type, part->position);
+	}
+
+	freePartOccupancy(&occupancy);
+}
+
+/**
+ * Order of the face records: face, plane, color, lattice, row, column
+ */
+static int compareFaceRecords(const void *a, const void *b) {
+	const FaceRecord *r1 = a, *r2 = b;
+	if (r1->face != r2->face)
+		return r1->face - r2->face;
+
+	const int *axis = PART_FACES[r1->face].axis;
+	if (r1->key[axis[2]] != r2->key[axis[2]])
+		return r1->key[axis[2]] - r2->key[axis[2]];
+
+	int i;
+	for (i = 0; i < 4; ++i)
+		if (r1->color[i] != r2->color[i])
+			return r1->color[i] < r2->color[i] ? -1 : 1;
+
+	if ((r1->key[axis[0]] & 1) != (r2->key[axis[0]] & 1))
+		return (r1->key[axis[0]] & 1) - (r2->key[axis[0]] & 1);
+	if ((r1->key[axis[1]] & 1) != (r2->key[axis[1]] & 1))
+		return (r1->key[axis[1]] & 1) - (r2->key[axis[1]] & 1);
+	if (r1->key[axis[1]] != r2->key[axis[1]])
+		return r1->key[axis[1]] - r2->key[axis[1]];
+	return r1->key[axis[0]] - r2->key[axis[0]];
+}
+
+/**
+ * The faces are coplanar, have the same color and lie on the same unit grid
+ */
+static GLboolean isSameFaceGroup(const FaceRecord *a, const FaceRecord *b) {
+	if (a->face != b->face)
+		return GL_FALSE;
+
+	const int *axis = PART_FACES[a->face].axis;
+	return a->key[axis[2]] == b->key[axis[2]]
+			&& a->color[R] == b->color[R] && a->color[G] == b->color[G]
+			&& a->color[B] == b->color[B] && a->color[A] == b->color[A]
+			&& (a->key[axis[0]] & 1) == (b->key[axis[0]] & 1)
+			&& (a->key[axis[1]] & 1) == (b->key[axis[1]] & 1);
+}
+
+/**
+ * Merge a group of faces into maximal rectangles (greedy meshing)
+ *
+ * @param builder Target builder
+ * @param records Faces of the same group
+ * @param count Count of the records
+ */
+static void mergeFaceGroup(MeshBuilder *builder, const FaceRecord *records, int count) {
+	const PartFace *face = &PART_FACES[records[0].face];
+	const int *axis = face->axis;
+	int minU = records[0].key[axis[0]], maxU = minU;
+	int minV = records[0].key[axis[1]], maxV = minV;
+	int i, j, u, v;
+
+	for (i = 1; i < count; ++i) {
+		minU = min(minU, records[i].key[axis[0]]);
+		maxU = max(maxU, records[i].key[axis[0]]);
+		minV = min(minV, records[i].key[axis[1]]);
+		maxV = max(maxV, records[i].key[axis[1]]);
+	}
+
+	int width = (maxU - minU) / 2 + 1, height = (maxV - minV) / 2 + 1;
+	GLboolean *cells = calloc(width * height, sizeof(GLboolean));
+	for (i = 0; i < count; ++i)
+		cells[(records[i].key[axis[1]] - minV) / 2 * width + (records[i].key[axis[0]] - minU) / 2] = GL_TRUE;
+
+	for (v = 0; v < height; ++v) {
+		for (u = 0; u < width; ++u) {
+			if (!cells[v * width + u])
+				continue;
+
+			int w = 1, h = 1;
+			while (u + w < width && cells[v * width + u + w])
+				++w;
+			for (; v + h < height; ++h) {
+				for (i = 0; i < w; ++i)
+					if (!cells[(v + h) * width + u + i])
+						break;
+				if (i < w)
+					break;
+			}
+
+			for (i = 0; i < w; ++i)
+				for (j = 0; j < h; ++j)
+					cells[(v + j) * width + u + i] = GL_FALSE;
+
+			/** The quad starts at the lower end of positive edges and the upper end of negative ones */
+			GLfloat position[3];
+			position[axis[0]] = (minU + 2 * (face->rotation[axis[0]] > 0 ? u : u + w - 1)) / 2.0f;
+			position[axis[1]] = (minV + 2 * (face->rotation[3 + axis[1]] > 0 ? v : v + h - 1)) / 2.0f;
+			position[axis[2]] = records[0].key[axis[2]] / 2.0f;
+
+			const GLfloat *r = face->rotation;
+			meshAddFace(builder, (GLfloat[]) {
+					r[0] * w, r[1] * w, r[2] * w, 0.0f,
+					r[3] * h, r[4] * h, r[5] * h, 0.0f,
+					r[6], r[7], r[8], 0.0f,
+					position[X] + face->offset[X], position[Y] + face->offset[Y],
+					position[Z] + face->offset[Z], 1.0f}, records[0].color, records[0].face, w, h);
+		}
+	}
+
+	free(cells);
+}
+
+/**
+ * Add the visible faces of the parts to the builder
+ *
+ * Coplanar, adjacent faces with the same color are merged into maximal rectangles.
+ *
+ * @param builder Target builder
+ * @param parts StaticObjectPart list
+ * @return Count of the faces before merging
+ */
+GLint meshParts(MeshBuilder *builder, LinkedList *parts) {
+	int count = 0, capacity = MESH_BUILDER_CAPACITY, i;
+	FaceRecord *records = malloc(sizeof(FaceRecord) * capacity);
+
+	Iterator it;
+	foreach (it, parts->first) {
+		StaticObjectPart *part = it->data;
+		for (i = 0; i < 6; ++i) {
+			if ((part->type & PART_FACES[i].mask) == 0)
+				continue;
+
+			if (count == capacity) {
+				capacity *= 2;
+				records = realloc(records, sizeof(FaceRecord) * capacity);
+			}
+			records[count].face = i;
+			records[count].key[X] = (int) lroundf(part->position[X] * 2);
+			records[count].key[Y] = (int) lroundf(part->position[Y] * 2);
+			records[count].key[Z] = (int) lroundf(part->position[Z] * 2);
+			records[count].color = part->color;
+			++count;
+		}
+	}
+
+	qsort(records, count, sizeof(FaceRecord), compareFaceRecords);
+
+	int first = 0;
+	for (i = 1; i <= count; ++i) {
+		if (i == count || !isSameFaceGroup(&records[first], &records[i])) {
+			mergeFaceGroup(builder, &records[first], i - first);
+			first = i;
+		}
+	}
+
+	free(records);
+	return count;
+}
+
+/**
+ * Add the color bank of an object to the palette of the packed faces
+ *
+ * @param colors PartColor list
+ */
+static void addPartColors(LinkedList *colors) {
+	GLsizei count = 0;
+	Iterator it;
+	foreach (it, colors->first)
+		++count;
+
+	GLfloat (*bank)[4] = malloc(sizeof(GLfloat[4]) * (count + 1));
+	count = 0;
+	foreach (it, colors->first)
+		memcpy(bank[count++], ((PartColor *) it->data)->color, sizeof(GLfloat[4]));
+
+	addSceneColors((const GLfloat (*)[4]) bank, count);
+	free(bank);
+}
+
+/**
+ * Bake the parts of an object into a mesh
+ *
+ * @param parts StaticObjectPart list
+ * @param mesh Target mesh
+ */
+static void bakeParts(LinkedList *parts, Mesh *mesh) {
+	MeshBuilder builder;
+	initMeshBuilder(&builder);
+
+	GLint faces = meshParts(&builder, parts);
+	uploadMesh(mesh, &builder);
+	DEBUG("Object", "Baked %d faces into %d quads (1 draw call)", faces, builder.indexCount / 6);
+	freeMeshBuilder(&builder);
+}
+
+/**
+ * Order of the LOD records: cell X, Y, Z
+ */
+static int compareLodRecords(const void *a, const void *b) {
+	const LodRecord *r1 = a, *r2 = b;
+	int i;
+	for (i = 0; i < 3; ++i)
+		if (r1->cell[i] != r2->cell[i])
+			return r1->cell[i] - r2->cell[i];
+	return 0;
+}
+
+/**
+ * Bake the coarse mesh of an object
+ *
+ * Every 2x2x2 cell of parts is merged into one part with the visible faces of the parts
+ * and their most common color. The merged parts are meshed in cell space (one unit per cell),
+ * DynamicObject::lodMat scales them back. No coarse mesh is made if it has as many quads as
+ * the original one.
+ *
+ * @param obj The object (the hidden faces of the parts must be removed)
+ */
+static void bakeLodParts(DynamicObject *obj) {
+	obj->lodMesh.indexCount = 0;
+	mat4Identity(obj->lodMat);
+
+	int count = 0, first, i, j, k;
+	Iterator it;
+	foreach (it, obj->parts->first)
+		++count;
+	if (count == 0)
+		return;
+
+	/** The cells start at the minimum corner of the part cubes (a cube is below its Z position) */
+	GLfloat origin[3];
+	count = 0;
+	foreach (it, obj->parts->first) {
+		StaticObjectPart *part = it->data;
+		for (i = 0; i < 3; ++i) {
+			const GLfloat corner = part->position[i] - (i == Z ? 1.0f : 0.0f);
+			if (count == 0 || corner < origin[i])
+				origin[i] = corner;
+		}
+		++count;
+	}
+
+	LodRecord *records = malloc(sizeof(LodRecord) * count);
+	count = 0;
+	foreach (it, obj->parts->first) {
+		StaticObjectPart *part = it->data;
+		for (i = 0; i < 3; ++i)
+			records[count].cell[i] = (int) floorf((part->position[i] - (i == Z ? 1.0f : 0.0f)
+					- origin[i]) / 2.0f + 0.001f);
+		records[count++].part = part;
+	}
+	qsort(records, count, sizeof(LodRecord), compareLodRecords);
+
+	LinkedList *parts = newList(StaticObjectPart);
+	for (first = 0; first < count; first = i) {
+		StaticObjectPart merged;
+		merged.type = PT_NULL;
+		merged.color = records[first].part->color;
+		merged.position[X] = records[first].cell[X];
+		merged.position[Y] = records[first].cell[Y];
+		merged.position[Z] = records[first].cell[Z] + 1;
+
+		int best = 0;
+		for (i = first; i < count && compareLodRecords(&records[first], &records[i]) == 0; ++i) {
+			merged.type |= records[i].part->type;
+
+			int same = 0;
+			for (j = first; j < count && compareLodRecords(&records[first], &records[j]) == 0; ++j)
+				same += records[j].part->color == records[i].part->color;
+			if (same > best) {
+				best = same;
+				merged.color = records[i].part->color;
+			}
+		}
+
+		if (merged.type != PT_NULL)
+			listPush(parts, &merged);
+	}
+	free(records);
+	cullParts(parts);
+
+	MeshBuilder builder;
+	initMeshBuilder(&builder);
+	k = meshParts(&builder, parts);
+	if (builder.indexCount < obj->mesh.indexCount) {
+		uploadMesh(&obj->lodMesh, &builder);
+		mat4Translate(obj->lodMat, origin[X], origin[Y], origin[Z]);
+		mat4Scale(obj->lodMat, 2.0f, 2.0f, 2.0f);
+		DEBUG("Object", "Baked %d coarse faces into %d quads (LOD of %d quads)", k,
+				builder.indexCount / 6, obj->mesh.indexCount / 6);
+	}
+	freeMeshBuilder(&builder);
+	listFree(parts);
+	free(parts);
+}
+
 /**
  * Load static object
  *
@@ -87,6 +581,9 @@ StaticObject *loadStaticObject(char path[]) {
 	}
 
 	fclose(file);
+	addPartColors(obj->colors);
+	cullParts(obj->parts);
+	bakeParts(obj->parts, &obj->mesh);
 	return obj;
 }
 
@@ -166,6 +663,12 @@ DynamicObject *loadDynamicObject(char path[]) {
 	}
 
 	fclose(file);
+	addPartColors(obj->colors);
+	cullParts(obj->parts);
+	bakeParts(obj->parts, &obj->mesh);
+	bakeLodParts(obj);
+	obj->impostorMesh.indexCount = 0;
+	obj->cullMesh = CULL_NO_MESH;
 	return obj;
 }
 
@@ -257,87 +760,202 @@ ActiveObject *loadActiveObject(char path[]) {
 	}
 
 	fclose(file);
+	addPartColors(colors);
+
+	int i;
+	for (i = 0; i < aobj->size; ++i) {
+		cullParts(aobj->parts[i].parts);
+		bakeParts(aobj->parts[i].parts, &aobj->parts[i].mesh);
+		bakeLodParts(&aobj->parts[i]);
+		aobj->parts[i].impostorMesh.indexCount = 0;
+		aobj->parts[i].cullMesh = CULL_NO_MESH;
+	}
 	return aobj;
 }
 
 /**
- * Render static object
+ * Find or create the batch at the given chunk coordinates
  *
- * @param this Actual GameInstance instance
- * @param instance Object instance to render
+ * @param map The map
+ * @param x Chunk X coordinate
+ * @param y Chunk Y coordinate
+ * @param transparent Batch of the transparent objects
+ * @return The batch
  */
-void renderStaticObject(GameInstance *this, StaticObjectInstance *instance) {
-	StaticObject *obj = instance->object;
-	glUniformMatrix4fv(this->shader->moveMat, 1, GL_FALSE, instance->moveMat);
+static StaticBatch *getStaticBatch(Map *map, GLint x, GLint y, GLboolean transparent) {
+	Iterator it;
+	foreach (it, map->objects->staticBatches->first) {
+		StaticBatch *batch = it->data;
+		if (batch->x == x && batch->y == y && batch->transparent == transparent)
+			return batch;
+	}
 
-	if (getDistSquared2DDelta(instance->position, obj->position, this->camera->position) > 100)
-		return;
+	StaticBatch batch;
+	batch.x = x;
+	batch.y = y;
+	batch.transparent = transparent;
+	batch.mesh.vao = 0;
+	batch.mesh.indexCount = 0;
+	initMeshBuilder(&batch.builder);
+	batch.instances = NULL;
+	batch.instanceCount = 0;
+	batch.ranges = NULL;
+	batch.rangeCount = 0;
+	batch.dirty = GL_TRUE;
+	listPush(map->objects->staticBatches, &batch);
+	return map->objects->staticBatches->last->data;
+}
 
-	glBindTexture(GL_TEXTURE_2D, this->blankTextureId);
-	Iterator it;
-	foreach (it, obj->parts->first) {
-		StaticObjectPart *part = it->data;
-		glUniform4fv(this->shader->baseColor, 1, part->color);
-
-		if ((part->type & PTMASK_RENDER_UP) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					1.0f, 0.0f, 0.0f, 0.0f,
-					0.0f, 0.0f, -1, 0.0f,
-					0.0f, 1, 0.0f, 0.0f,
-					part->position[X], part->position[Y] + 1, part->position[Z], 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+/**
+ * Merge the static object instances into world space batches
+ *
+ * The instances are grouped by the chunk of the center of their bounding box.
+ * The opaque and the transparent objects are stored in separate batches.
+ *
+ * @note Called after the map is loaded (the instances must not move after this).
+ *
+ * @param map The map
+ */
+void buildStaticBatches(Map *map) {
+	Iterator objectIt, it;
+	foreach (objectIt, map->objects->staticObjects->first) {
+		StaticObject *obj = objectIt->data;
+		MeshBuilder source;
+		initMeshBuilder(&source);
+		meshParts(&source, obj->parts);
+
+		foreach (it, map->objects->staticInstances->first) {
+			StaticObjectInstance *instance = it->data;
+			if (instance->object != obj)
+				continue;
+
+			StaticBatch *batch = getStaticBatch(map,
+					(GLint) floorf((instance->min[X] + instance->max[X]) * 0.5f / CHUNK_SIZE),
+					(GLint) floorf((instance->min[Y] + instance->max[Y]) * 0.5f / CHUNK_SIZE),
+					obj->mesh.transparent);
+
+			instance->batch = batch;
+			instance->firstIndex = batch->builder.indexCount;
+			instance->indexCount = source.indexCount;
+			meshAppendTransformed(&batch->builder, &source, instance->moveMat);
+
+			batch->instances = realloc(batch->instances, sizeof(StaticObjectInstance *) * (batch->instanceCount + 1));
+			batch->instances[batch->instanceCount++] = instance;
 		}
+		freeMeshBuilder(&source);
+	}
 
-		if ((part->type & PTMASK_RENDER_DOWN) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					1.0f, 0.0f, 0.0f, 0.0f,
-					0.0f, cosf(PI + PI / 2), -sinf(PI + PI / 2), 0.0f,
-					0.0f, sinf(PI + PI / 2), cosf(PI + PI / 2), 0.0f,
-					part->position[X], part->position[Y], part->position[Z] - 1, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
+	GLint instances = 0, batches = 0;
+	foreach (it, map->objects->staticBatches->first) {
+		StaticBatch *batch = it->data;
+		uploadMesh(&batch->mesh, &batch->builder);
+		freeMeshBuilder(&batch->builder);
+		batch->ranges = malloc(sizeof(GLsizei[2]) * batch->instanceCount);
+		instances += batch->instanceCount;
+		++batches;
+	}
 
-		if ((part->type & PTMASK_RENDER_TOP) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					cosf(PI), 0.0f, sinf(PI), 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					-sinf(PI), 0.0f, cosf(PI), 0.0f,
-					part->position[X] + 1, part->position[Y], part->position[Z] - 1, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
+	DEBUG("Object", "%d static instances merged into %d batches", instances, batches);
+}
 
-		if ((part->type & PTMASK_RENDER_LEFT) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					cosf(PI / 2), 0.0f, sinf(PI / 2), 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					-sinf(PI / 2), 0.0f, cosf(PI / 2), 0.0f,
-					part->position[X], part->position[Y], part->position[Z] - 1, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
+/**
+ * Show or hide a static object instance
+ *
+ * The batch mesh is not rebuilt, only the drawn index ranges of the batch.
+ * The static layers of the shadow maps are invalidated.
+ *
+ * @param this Actual GameInstance instance
+ * @param instance The instance
+ * @param visible New visibility
+ */
+void setStaticInstanceVisible(GameInstance *this, StaticObjectInstance *instance, GLboolean visible) {
+	if (instance->visible == visible)
+		return;
 
-		if ((part->type & PTMASK_RENDER_BOTTOM) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					1.0f, 0.0f, 0.0f, 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					0.0f, 0.0f, 1.0f, 0.0f,
-					part->position[X], part->position[Y], part->position[Z], 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
+	instance->visible = visible;
+	if (instance->batch != NULL)
+		instance->batch->dirty = GL_TRUE;
+	invalidateShadowMaps(this);
+}
 
-		if ((part->type & PTMASK_RENDER_RIGHT) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					cosf(PI + PI / 2), 0.0f, sinf(PI + PI / 2), 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					-sinf(PI + PI / 2), 0.0f, cosf(PI + PI / 2), 0.0f,
-					part->position[X] + 1, part->position[Y], part->position[Z], 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+/**
+ * Merge the index ranges of the adjacent visible instances of the batch
+ *
+ * @param batch The batch
+ */
+static void updateStaticBatchRanges(StaticBatch *batch) {
+	batch->rangeCount = 0;
+
+	int i;
+	for (i = 0; i < batch->instanceCount; ++i) {
+		StaticObjectInstance *instance = batch->instances[i];
+		if (!instance->visible)
+			continue;
+
+		GLsizei *last = batch->rangeCount > 0 ? batch->ranges[batch->rangeCount - 1] : NULL;
+		if (last != NULL && last[0] + last[1] == instance->firstIndex) {
+			last[1] += instance->indexCount;
+		} else {
+			batch->ranges[batch->rangeCount][0] = instance->firstIndex;
+			batch->ranges[batch->rangeCount][1] = instance->indexCount;
+			++batch->rangeCount;
 		}
 	}
+	batch->dirty = GL_FALSE;
+}
+
+/**
+ * Render the static object batches inside the view frustum
+ *
+ * One draw call per visible range of the batch (submitted to the render queue).
+ *
+ * @param this Actual GameInstance instance
+ */
+void renderStaticBatches(GameInstance *this) {
+	static const GLfloat IDENTITY[16] = {
+			1.0f, 0.0f, 0.0f, 0.0f,
+			0.0f, 1.0f, 0.0f, 0.0f,
+			0.0f, 0.0f, 1.0f, 0.0f,
+			0.0f, 0.0f, 0.0f, 1.0f};
+
+	Iterator it;
+	foreach (it, this->map->objects->staticBatches->first) {
+		StaticBatch *batch = it->data;
+		if (!isBoxInFrustum(this->camera->frustum, batch->mesh.min, batch->mesh.max))
+			continue;
+
+		if (batch->dirty)
+			updateStaticBatchRanges(batch);
+
+		int i;
+		for (i = 0; i < batch->rangeCount; ++i)
+			submitRenderRange(this, RL_OBJECTS, &batch->mesh, batch->ranges[i][0], batch->ranges[i][1],
+					this->map->textureArray, IDENTITY, OBJECT_BASE_COLOR);
+	}
+}
+
+/**
+ * Free the static object batches of the map
+ *
+ * @param map The map
+ */
+void freeStaticBatches(Map *map) {
+	Iterator it;
+	foreach (it, map->objects->staticBatches->first) {
+		StaticBatch *batch = it->data;
+		freeMesh(&batch->mesh);
+		free(batch->instances);
+		free(batch->ranges);
+	}
+	listFree(map->objects->staticBatches);
+	free(map->objects->staticBatches);
 }
 
 /**
  * Render dynamic object
  *
+ * The mesh is selected by the distance from the camera (see submitObjectLod()).
+ *
  * @param this Actual GameInstance instance
  * @param instance Object instance to render
  */
@@ -346,92 +964,32 @@ void renderDynamicObject(GameInstance *this, DynamicObjectInstance *instance) {
 
 	if (!instance->visible)
 		return;
-	if (getDistSquared2DDelta(instance->position, instance->reference->position, this->camera->position) > 100)
-		return;
 
-	glPushMatrix();
-	glLoadIdentity();
+	mat4Identity(instance->moveMat);
 
-	glTranslatef(obj->position[X] + instance->position[X] + instance->reference->position[X],
+	mat4Translate(instance->moveMat, obj->position[X] + instance->position[X] + instance->reference->position[X],
 			obj->position[Y] + instance->position[Y] + instance->reference->position[Y],
 			obj->position[Z] + instance->position[Z] + instance->reference->position[Z]);
-	glScalef(obj->scale[X] * instance->scale[X] * instance->reference->scale[X],
+	mat4Scale(instance->moveMat, obj->scale[X] * instance->scale[X] * instance->reference->scale[X],
 			obj->scale[Y] * instance->scale[Y] * instance->reference->scale[Y],
 			obj->scale[Z] * instance->scale[Z] * instance->reference->scale[Z]);
-	glRotatef(-(obj->rotation[X] + instance->rotation[X] + instance->reference->rotation[X]), 1.0f, 0.0f, 0.0f);
-	glRotatef(-(obj->rotation[Y] + instance->rotation[Y] + instance->reference->rotation[Y]), 0.0f, 1.0f, 0.0f);
-	glRotatef(-(obj->rotation[Z] + instance->rotation[Z] + instance->reference->rotation[Z]), 0.0f, 0.0f, 1.0f);
-
-	glGetFloatv(GL_MODELVIEW_MATRIX, instance->moveMat);
-	glUniformMatrix4fv(this->shader->moveMat, 1, GL_FALSE, instance->moveMat);
-	glPopMatrix();
+	mat4Rotate(instance->moveMat, -(obj->rotation[X] + instance->rotation[X] + instance->reference->rotation[X]), 1.0f, 0.0f, 0.0f);
+	mat4Rotate(instance->moveMat, -(obj->rotation[Y] + instance->rotation[Y] + instance->reference->rotation[Y]), 0.0f, 1.0f, 0.0f);
+	mat4Rotate(instance->moveMat, -(obj->rotation[Z] + instance->rotation[Z] + instance->reference->rotation[Z]), 0.0f, 0.0f, 1.0f);
 
-	glBindTexture(GL_TEXTURE_2D, this->blankTextureId);
-	Iterator it;
-	foreach (it, obj->parts->first) {
-		StaticObjectPart *part = it->data;
-		glUniform4fv(this->shader->baseColor, 1, part->color);
-
-		if ((part->type & PTMASK_RENDER_UP) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					1.0f, 0.0f, 0.0f, 0.0f,
-					0.0f, 0.0f, -1, 0.0f,
-					0.0f, 1, 0.0f, 0.0f,
-					part->position[X], part->position[Y] + 1, part->position[Z], 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
-
-		if ((part->type & PTMASK_RENDER_DOWN) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					1.0f, 0.0f, 0.0f, 0.0f,
-					0.0f, cosf(PI + PI / 2), -sinf(PI + PI / 2), 0.0f,
-					0.0f, sinf(PI + PI / 2), cosf(PI + PI / 2), 0.0f,
-					part->position[X], part->position[Y], part->position[Z] - 1, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
-
-		if ((part->type & PTMASK_RENDER_TOP) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					cosf(PI), 0.0f, sinf(PI), 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					-sinf(PI), 0.0f, cosf(PI), 0.0f,
-					part->position[X] + 1, part->position[Y], part->position[Z] - 1, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
-
-		if ((part->type & PTMASK_RENDER_LEFT) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					cosf(PI / 2), 0.0f, sinf(PI / 2), 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					-sinf(PI / 2), 0.0f, cosf(PI / 2), 0.0f,
-					part->position[X], part->position[Y], part->position[Z] - 1, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
-
-		if ((part->type & PTMASK_RENDER_BOTTOM) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					1.0f, 0.0f, 0.0f, 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					0.0f, 0.0f, 1.0f, 0.0f,
-					part->position[X], part->position[Y], part->position[Z], 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
-
-		if ((part->type & PTMASK_RENDER_RIGHT) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					cosf(PI + PI / 2), 0.0f, sinf(PI + PI / 2), 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					-sinf(PI + PI / 2), 0.0f, cosf(PI + PI / 2), 0.0f,
-					part->position[X] + 1, part->position[Y], part->position[Z], 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
+	GLfloat min[3], max[3];
+	transformBox(min, max, instance->moveMat, obj->mesh.min, obj->mesh.max);
+	if (!isBoxInFrustum(this->camera->frustum, min, max))
+		return;
 
-	}
+	submitObjectLod(this, obj, instance->moveMat, OBJECT_BASE_COLOR);
 }
 
 /**
  * Render active object
  *
+ * The mesh of the active part is selected by the distance from the camera (see submitObjectLod()).
+ *
  * @param this Actual GameInstance instance
  * @param instance Object instance to render
  */
@@ -440,172 +998,60 @@ void renderActiveObject(GameInstance *this, ActiveObjectInstance *instance) {
 
 	if (!instance->visible)
 		return;
-	if (getDistSquared2DDelta(instance->position, obj->position, this->camera->position) > 100)
-		return;
 
-	glPushMatrix();
-	glLoadIdentity();
+	mat4Identity(instance->moveMat);
 
-	glTranslatef(obj->position[X] + instance->position[X] + instance->reference->position[X],
+	mat4Translate(instance->moveMat, obj->position[X] + instance->position[X] + instance->reference->position[X],
 			obj->position[Y] + instance->position[Y] + instance->reference->position[Y],
 			obj->position[Z] + instance->position[Z] + instance->reference->position[Z]);
-	glScalef(obj->scale[X] * instance->scale[X] * instance->reference->scale[X],
+	mat4Scale(instance->moveMat, obj->scale[X] * instance->scale[X] * instance->reference->scale[X],
 			obj->scale[Y] * instance->scale[Y] * instance->reference->scale[Y],
 			obj->scale[Z] * instance->scale[Z] * instance->reference->scale[Z]);
-	glRotatef(-(obj->rotation[X] + instance->rotation[X] + instance->reference->rotation[X]), 1.0f, 0.0f, 0.0f);
-	glRotatef(-(obj->rotation[Y] + instance->rotation[Y] + instance->reference->rotation[Y]), 0.0f, 1.0f, 0.0f);
-	glRotatef(-(obj->rotation[Z] + instance->rotation[Z] + instance->reference->rotation[Z]), 0.0f, 0.0f, 1.0f);
-
-	glGetFloatv(GL_MODELVIEW_MATRIX, instance->moveMat);
-	glUniformMatrix4fv(this->shader->moveMat, 1, GL_FALSE, instance->moveMat);
-	glPopMatrix();
+	mat4Rotate(instance->moveMat, -(obj->rotation[X] + instance->rotation[X] + instance->reference->rotation[X]), 1.0f, 0.0f, 0.0f);
+	mat4Rotate(instance->moveMat, -(obj->rotation[Y] + instance->rotation[Y] + instance->reference->rotation[Y]), 0.0f, 1.0f, 0.0f);
+	mat4Rotate(instance->moveMat, -(obj->rotation[Z] + instance->rotation[Z] + instance->reference->rotation[Z]), 0.0f, 0.0f, 1.0f);
 
-	glBindTexture(GL_TEXTURE_2D, this->blankTextureId);
-	Iterator it;
-	foreach (it, obj->parts->first) {
-		StaticObjectPart *part = it->data;
-		glUniform4fv(this->shader->baseColor, 1, part->color);
-
-		if ((part->type & PTMASK_RENDER_UP) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					1.0f, 0.0f, 0.0f, 0.0f,
-					0.0f, 0.0f, -1, 0.0f,
-					0.0f, 1, 0.0f, 0.0f,
-					part->position[X], part->position[Y] + 1, part->position[Z], 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
-
-		if ((part->type & PTMASK_RENDER_DOWN) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					1.0f, 0.0f, 0.0f, 0.0f,
-					0.0f, cosf(PI + PI / 2), -sinf(PI + PI / 2), 0.0f,
-					0.0f, sinf(PI + PI / 2), cosf(PI + PI / 2), 0.0f,
-					part->position[X], part->position[Y], part->position[Z] - 1, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
-
-		if ((part->type & PTMASK_RENDER_TOP) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					cosf(PI), 0.0f, sinf(PI), 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					-sinf(PI), 0.0f, cosf(PI), 0.0f,
-					part->position[X] + 1, part->position[Y], part->position[Z] - 1, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
-
-		if ((part->type & PTMASK_RENDER_LEFT) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					cosf(PI / 2), 0.0f, sinf(PI / 2), 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					-sinf(PI / 2), 0.0f, cosf(PI / 2), 0.0f,
-					part->position[X], part->position[Y], part->position[Z] - 1, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
-
-		if ((part->type & PTMASK_RENDER_BOTTOM) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					1.0f, 0.0f, 0.0f, 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					0.0f, 0.0f, 1.0f, 0.0f,
-					part->position[X], part->position[Y], part->position[Z], 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
-
-		if ((part->type & PTMASK_RENDER_RIGHT) > 0) {
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					cosf(PI + PI / 2), 0.0f, sinf(PI + PI / 2), 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					-sinf(PI + PI / 2), 0.0f, cosf(PI + PI / 2), 0.0f,
-					part->position[X] + 1, part->position[Y], part->position[Z], 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
+	GLfloat min[3], max[3];
+	transformBox(min, max, instance->moveMat, obj->mesh.min, obj->mesh.max);
+	if (!isBoxInFrustum(this->camera->frustum, min, max))
+		return;
 
-	}
+	submitObjectLod(this, obj, instance->moveMat, OBJECT_BASE_COLOR);
 }
 
 /**
- * Render map tile
+ * Free the meshes of a dynamic object (or a part of an active object)
  *
- * @param this Actual GameInstance instance
- * @param tile Tile to render
+ * @param obj The object
  */
-void renderTile(GameInstance *this, Tile *tile) {
-	if (getDistSquaredXY(tile->x, tile->y, this->camera->position) > 100)
-		return;
-
-	glBindTexture(GL_TEXTURE_2D, tile->texture->base->textureId);
-	glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-			1.0f, 0.0f, 0.0f, 0.0f,
-			0.0f, 1.0f, 0.0f, 0.0f,
-			0.0f, 0.0f, 1.0f, 0.0f,
-			tile->x, tile->y, (tile->type & TTMASK_RENDER_FRONT) == TTMASK_RENDER_FRONT ? 1.0f : 0.0f, 1.0f});
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-
-	if (tile->type != TT_BACKGROUND) {
-		if ((tile->type & TTMASK_RENDER_TOP) > 1) {
-			glBindTexture(GL_TEXTURE_2D, tile->texture->top->textureId);
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					1.0f, 0.0f, 0.0f, 0.0f,
-					0.0f, cosf(PI / 2), -sinf(PI / 2), 0.0f,
-					0.0f, sinf(PI / 2), cosf(PI / 2), 0.0f,
-					tile->x, tile->y + 1, 1.0f, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
-
-		if ((tile->type & TTMASK_RENDER_LEFT) > 1) {
-			glBindTexture(GL_TEXTURE_2D, tile->texture->left->textureId);
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					cosf(PI + PI / 2), 0.0f, sinf(PI + PI / 2), 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					-sinf(PI + PI / 2), 0.0f, cosf(PI + PI / 2), 0.0f,
-					tile->x + 1, tile->y, 1.0f, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
-
-		if ((tile->type & TTMASK_RENDER_BOTTOM) > 1) {
-			glBindTexture(GL_TEXTURE_2D, tile->texture->bottom->textureId);
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					1.0f, 0.0f, 0.0f, 0.0f,
-					0.0f, cosf(PI + PI / 2), -sinf(PI + PI / 2), 0.0f,
-					0.0f, sinf(PI + PI / 2), cosf(PI + PI / 2), 0.0f,
-					tile->x, tile->y, 0.0f, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
-
-		if ((tile->type & TTMASK_RENDER_RIGHT) > 1) {
-			glBindTexture(GL_TEXTURE_2D, tile->texture->right->textureId);
-			glUniformMatrix4fv(this->shader->modelMat, 1, GL_FALSE, (GLfloat[]) {
-					cosf(PI / 2), 0.0f, sinf(PI / 2), 0.0f,
-					0.0f, 1.0f, 0.0f, 0.0f,
-					-sinf(PI / 2), 0.0f, cosf(PI / 2), 0.0f,
-					tile->x, tile->y, 0.0f, 1.0f});
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		}
-	}
+void freeDynamicObjectMeshes(DynamicObject *obj) {
+	freeMesh(&obj->mesh);
+	if (obj->lodMesh.indexCount > 0)
+		freeMesh(&obj->lodMesh);
+	if (obj->impostorMesh.indexCount > 0)
+		freeMesh(&obj->impostorMesh);
 }
 
 /**
- * Calculate the move matrix of the static object instance
+ * Calculate the move matrix and the bounding box of the static object instance
  *
  * @param instance Object instance to init
  */
 void initStraticInstance(StaticObjectInstance *instance) {
 	StaticObject *obj = instance->object;
-	glPushMatrix();
-	glLoadIdentity();
+	mat4Identity(instance->moveMat);
 
-	glTranslatef(obj->position[X] + instance->position[X],
+	mat4Translate(instance->moveMat, obj->position[X] + instance->position[X],
 			obj->position[Y] + instance->position[Y],
 			obj->position[Z] + instance->position[Z]);
-	glScalef(obj->scale[X] * instance->scale[X],
+	mat4Scale(instance->moveMat, obj->scale[X] * instance->scale[X],
 			obj->scale[Y] * instance->scale[Y],
 			obj->scale[Z] * instance->scale[Z]);
-	glRotatef(-(obj->rotation[X] + instance->rotation[X]), 1.0f, 0.0f, 0.0f);
-	glRotatef(-(obj->rotation[Y] + instance->rotation[Y]), 0.0f, 1.0f, 0.0f);
-	glRotatef(-(obj->rotation[Z] + instance->rotation[Z]), 0.0f, 0.0f, 1.0f);
+	mat4Rotate(instance->moveMat, -(obj->rotation[X] + instance->rotation[X]), 1.0f, 0.0f, 0.0f);
+	mat4Rotate(instance->moveMat, -(obj->rotation[Y] + instance->rotation[Y]), 0.0f, 1.0f, 0.0f);
+	mat4Rotate(instance->moveMat, -(obj->rotation[Z] + instance->rotation[Z]), 0.0f, 0.0f, 1.0f);
 
-	glGetFloatv(GL_MODELVIEW_MATRIX, instance->moveMat);
-	glPopMatrix();
+	transformBox(instance->min, instance->max, instance->moveMat, obj->mesh.min, obj->mesh.max);
 }
 
 /**
@@ -130,6 +130,20 @@ struct PartColor {
 	GLfloat color[4];
 };
 
+/**
+ * Occupied part positions of an object
+ *
+ * Used to remove the faces hidden by a neighbouring opaque part.
+ * Keys: doubled X, Y, Z position and the opaque flag.
+ * @see getVisibleFaces()
+ */
+struct PartOccupancy {
+	GLint (*keys)[4];
+	GLint count;
+	GLint capacity;
+	GLboolean sorted;
+};
+
 /**
  * StaticObject - Precalculated move matrix
  *
@@ -146,6 +160,7 @@ struct StaticObject {
 	GLfloat moveMat[16];
 	LinkedList /*StaticObjectPart*/ *parts;
 	LinkedList /*PartColor*/ *colors;
+	Mesh mesh;
 };
 
 /**
@@ -159,8 +174,38 @@ struct StaticObjectInstance {
 	GLfloat rotation[3];
 	GLfloat scale[3];
 	GLfloat moveMat[16];
+	/** World space bounding box */
+	GLfloat min[3];
+	GLfloat max[3];
 	GLboolean visible;
 	StaticObject *object;
+	/** Index range of the instance in the batch mesh */
+	StaticBatch *batch;
+	GLsizei firstIndex;
+	GLsizei indexCount;
+};
+
+/**
+ * Static object instances of a CHUNK_SIZE x CHUNK_SIZE area, merged into one mesh
+ *
+ * The instances are transformed into world space when the map is loaded. Every instance
+ * owns an index range of the mesh, so hiding an instance only changes the drawn ranges.
+ * @see setStaticInstanceVisible()
+ */
+struct StaticBatch {
+	GLint x, y;
+	GLboolean transparent;
+	Mesh mesh;
+	/** Vertices of the batch (only used while building) */
+	MeshBuilder builder;
+	/** Instances of the batch in index order */
+	StaticObjectInstance **instances;
+	GLsizei instanceCount;
+	/** Merged index ranges (first, count) of the visible instances */
+	GLsizei (*ranges)[2];
+	GLsizei rangeCount;
+	/** The ranges are recalculated before the next render */
+	GLboolean dirty;
 };
 
 /**
@@ -191,6 +236,15 @@ struct DynamicObject {
 	GLfloat moveMat[16];
 	LinkedList /*StaticObjectPart*/ *parts;
 	LinkedList /*PartColor*/ *colors;
+	Mesh mesh;
+	/** Index of the mesh in the InstanceCulling (CULL_NO_MESH if not culled on the GPU) */
+	GLint cullMesh;
+	/** Parts merged by 2x2x2 (empty if it is not smaller), drawn beyond Options::lodDistance */
+	Mesh lodMesh;
+	/** Transformation of the lodMesh into the space of the mesh */
+	GLfloat lodMat[16];
+	/** Quad of the object in the impostor atlas (empty if there is none), rotated like the first instance */
+	Mesh impostorMesh;
 };
 
 /**
@@ -246,12 +300,16 @@ struct ActiveObjectInstance {
 struct ObjectInfo {
 	LinkedList /*StaticObject*/ *staticObjects;
 	LinkedList /*StaticObjectInstance*/ *staticInstances;
+	LinkedList /*StaticBatch*/ *staticBatches;
 
 	LinkedList /*DynamicObject*/ *dynamicObjects;
 	LinkedList /*DynamicObjectInstance*/ *dynamicInstances;
 
 	LinkedList /*ActiveObject*/ *activeObjects;
 	LinkedList /*ActiveObjectInstance*/ *activeInstances;
+
+	/** Texture array of the impostors, one layer per DynamicObject (see lod.h) */
+	GLuint impostorAtlas;
 };
 
 /**
@@ -266,10 +324,21 @@ StaticObject *loadStaticObject(char[]);
 DynamicObject *loadDynamicObject(char[]);
 ActiveObject *loadActiveObject(char[]);
 
-void renderStaticObject(GameInstance*, StaticObjectInstance*);
+void bakePart(MeshBuilder *builder, PartType type, const GLfloat position[3], const GLfloat color[4]);
+GLint meshParts(MeshBuilder *builder, LinkedList *parts);
+
+void initPartOccupancy(PartOccupancy *occupancy);
+void addPartOccupancy(PartOccupancy *occupancy, const GLfloat position[3], GLboolean opaque);
+PartType getVisibleFaces(PartOccupancy *occupancy, PartType type, const GLfloat position[3]);
+void freePartOccupancy(PartOccupancy *occupancy);
+
+void buildStaticBatches(Map *map);
+void setStaticInstanceVisible(GameInstance *this, StaticObjectInstance *instance, GLboolean visible);
+void renderStaticBatches(GameInstance *this);
+void freeStaticBatches(Map *map);
 void renderDynamicObject(GameInstance*, DynamicObjectInstance*);
 void renderActiveObject(GameInstance*, ActiveObjectInstance*);
-void renderTile(GameInstance*, Tile*);
+void freeDynamicObjectMeshes(DynamicObject *obj);
 void initStraticInstance(StaticObjectInstance*);
 
 void initReferencePoints(GameInstance *this);
@@ -0,0 +1,417 @@
+/**
+ * @file renderqueue.c
+ * @author Gerviba (Szabo Gergely)
+ * @brief Sorted render queue
+ *
+ * The renderer methods submit their draw calls instead of drawing immediately. The queue is
+ * sorted and executed at the end of the frame, so the texture, VAO and uniform changes are
+ * only made if the value is different from the previous draw call, and the repeated meshes
+ * (eg. coins, traps) are drawn with one instanced draw call. With the SceneBuffer the whole
+ * world is drawn with a few multi-draw calls.
+ *
+ * @par Header:
+ * 		renderqueue.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stdgame.h"
+
+static GLuint64 getSortKey(GameInstance *this, RenderItem *item, RenderLayer layer, GLuint sequence);
+static int compareRenderItems(const void *a, const void *b);
+static GLboolean isSameBatch(const RenderItem *a, const RenderItem *b);
+static GLsizei getBatchSize(RenderQueue *queue, GLsizei first);
+static GLboolean isSameDrawState(const RenderItem *a, const RenderItem *b);
+static GLsizei drawIndirect(GameInstance *this, GLsizei first, GLsizei *commandCount);
+static GLboolean isAfterOpaqueTiles(const RenderItem *item);
+static GLboolean isTransparent(const RenderItem *item);
+
+/**
+ * Initialize an empty render queue
+ *
+ * @param queue The queue
+ */
+void initRenderQueue(RenderQueue *queue) {
+	queue->count = 0;
+	queue->capacity = RENDER_QUEUE_CAPACITY;
+	queue->items = malloc(sizeof(RenderItem) * queue->capacity);
+	queue->matrices = malloc(sizeof(GLfloat[16]) * queue->capacity);
+	queue->commands = malloc(sizeof(DrawElementsIndirectCommand) * queue->capacity);
+	queue->instanceBuffer = 0;
+	queue->indirectBuffer = 0;
+	memset(&queue->current, 0, sizeof(RenderStats));
+	memset(&queue->last, 0, sizeof(RenderStats));
+}
+
+/**
+ * Create the instance buffer (and the indirect buffer) of the queue
+ *
+ * @note Must be called after the OpenGL context is created.
+ *
+ * @param queue The queue
+ * @param multiDraw Use the multi-draw path (SceneBuffer::multiDraw)
+ */
+void initInstanceBuffer(RenderQueue *queue, GLboolean multiDraw) {
+	glGenBuffers(1, &queue->instanceBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, queue->instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat[16]) * queue->capacity, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	queue->indirectBuffer = 0;
+	if (multiDraw)
+		glGenBuffers(1, &queue->indirectBuffer);
+}
+
+/**
+ * Calculate the sort key of an item
+ *
+ * The depth is the view space depth of the center of the mesh bounding box,
+ * quantized between 0 and twice the view distance.
+ *
+ * @param this Actual GameInstance instance
+ * @param item The item (with the mesh, texture and moveMat already set)
+ * @param layer Render layer of the item
+ * @param sequence Submit index of the item
+ * @return The sort key
+ * @see RenderItem
+ */
+static GLuint64 getSortKey(GameInstance *this, RenderItem *item, RenderLayer layer, GLuint sequence) {
+	const GLfloat *v = this->camera->viewMat;
+	const GLfloat *m = item->moveMat;
+	const Mesh *mesh = item->mesh;
+
+	GLfloat center[3] = {
+			(mesh->min[X] + mesh->max[X]) * 0.5f,
+			(mesh->min[Y] + mesh->max[Y]) * 0.5f,
+			(mesh->min[Z] + mesh->max[Z]) * 0.5f};
+	GLfloat world[3] = {
+			m[0] * center[X] + m[4] * center[Y] + m[8] * center[Z] + m[12],
+			m[1] * center[X] + m[5] * center[Y] + m[9] * center[Z] + m[13],
+			m[2] * center[X] + m[6] * center[Y] + m[10] * center[Z] + m[14]};
+	GLfloat depth = -(v[2] * world[X] + v[6] * world[Y] + v[10] * world[Z] + v[14])
+			/ (2.0f * this->options->viewDistance);
+	GLuint64 quantized = depth <= 0.0f ? 0 : depth >= 1.0f ? 0xFFFF : (GLuint64) (depth * 0xFFFF);
+
+	const GLuint64 texture = item->texture & 0x7FF;
+	const GLuint64 material = mesh->id & 0x3FFFF;
+	sequence &= 0xFFFF;
+
+	if (mesh->transparent || item->baseColor[A] < 1.0f)
+		return ((GLuint64) RP_TRANSPARENT << 63) | ((0xFFFF - quantized) << 47) | ((GLuint64) layer << 45)
+				| (texture << 34) | (material << 16) | sequence;
+	return ((GLuint64) RP_OPAQUE << 63) | ((GLuint64) layer << 61) | (texture << 50) | (material << 32)
+			| (quantized << 16) | sequence;
+}
+
+/**
+ * Add a draw call to the queue
+ *
+ * @note The mesh must stay valid until the queue is flushed.
+ *
+ * @param this Actual GameInstance instance
+ * @param layer Render layer
+ * @param mesh Mesh to render
+ * @param texture Texture array of the mesh
+ * @param moveMat Move matrix of the mesh
+ * @param baseColor Base color (multiplied with the vertex colors)
+ */
+void submitRenderItem(GameInstance *this, RenderLayer layer, Mesh *mesh, GLuint texture,
+		const GLfloat moveMat[16], const GLfloat baseColor[4]) {
+	submitRenderRange(this, layer, mesh, 0, mesh->indexCount, texture, moveMat, baseColor);
+}
+
+/**
+ * Add a draw call of a part of a mesh to the queue
+ *
+ * @note The mesh must stay valid until the queue is flushed.
+ *
+ * @param this Actual GameInstance instance
+ * @param layer Render layer
+ * @param mesh Mesh to render
+ * @param firstIndex First index of the range
+ * @param indexCount Count of the indices
+ * @param texture Texture array of the mesh
+ * @param moveMat Move matrix of the mesh
+ * @param baseColor Base color (multiplied with the vertex colors)
+ */
+void submitRenderRange(GameInstance *this, RenderLayer layer, Mesh *mesh, GLsizei firstIndex,
+		GLsizei indexCount, GLuint texture, const GLfloat moveMat[16], const GLfloat baseColor[4]) {
+	RenderQueue *queue = this->renderQueue;
+	if (indexCount == 0)
+		return;
+
+	if (queue->count == queue->capacity) {
+		queue->capacity *= 2;
+		queue->items = realloc(queue->items, sizeof(RenderItem) * queue->capacity);
+		queue->matrices = realloc(queue->matrices, sizeof(GLfloat[16]) * queue->capacity);
+		queue->commands = realloc(queue->commands, sizeof(DrawElementsIndirectCommand) * queue->capacity);
+	}
+
+	RenderItem *item = &queue->items[queue->count];
+	item->mesh = mesh;
+	item->firstIndex = firstIndex;
+	item->indexCount = indexCount;
+	item->texture = texture;
+	memcpy(item->moveMat, moveMat, sizeof(item->moveMat));
+	memcpy(item->baseColor, baseColor, sizeof(item->baseColor));
+	item->variant = layer == RL_OVERLAY ? SV_UNLIT : this->lighting->variant;
+	item->key = getSortKey(this, item, layer, queue->count);
+	++queue->count;
+}
+
+/**
+ * Compare two items by the sort key (for qsort)
+ */
+static int compareRenderItems(const void *a, const void *b) {
+	const GLuint64 keyA = ((const RenderItem *) a)->key;
+	const GLuint64 keyB = ((const RenderItem *) b)->key;
+	return keyA < keyB ? -1 : keyA > keyB ? 1 : 0;
+}
+
+/**
+ * Check if two sorted items can be drawn with one instanced draw call
+ */
+static GLboolean isSameBatch(const RenderItem *a, const RenderItem *b) {
+	return a->mesh == b->mesh && a->firstIndex == b->firstIndex && a->indexCount == b->indexCount
+			&& a->texture == b->texture && a->variant == b->variant
+			&& memcmp(a->baseColor, b->baseColor, sizeof(a->baseColor)) == 0;
+}
+
+/**
+ * Count the items of the batch starting at the given item
+ */
+static GLsizei getBatchSize(RenderQueue *queue, GLsizei first) {
+	GLsizei count;
+	for (count = 1; first + count < queue->count && isSameBatch(&queue->items[first], &queue->items[first + count]); ++count);
+	return count;
+}
+
+/**
+ * Check if two sorted items can be drawn with one multi-draw call
+ */
+static GLboolean isSameDrawState(const RenderItem *a, const RenderItem *b) {
+	return a->mesh->shared && b->mesh->shared && a->mesh->vao == b->mesh->vao
+			&& a->texture == b->texture && a->variant == b->variant && memcmp(a->baseColor, b->baseColor, sizeof(a->baseColor)) == 0;
+}
+
+/**
+ * Draw the batches with the same state with one multi-draw call
+ *
+ * Every batch is one command. The texture, the VAO and the base color must be set before.
+ * The call ends at the opaque tiles if the result of the GPU culling is not drawn yet, and
+ * at the transparent items if its impostors are not drawn yet.
+ *
+ * @param this Actual GameInstance instance
+ * @param first First item of the first batch
+ * @param commandCount Count of the commands of the flush (incremented)
+ * @return Count of the drawn items
+ */
+static GLsizei drawIndirect(GameInstance *this, GLsizei first, GLsizei *commandCount) {
+	RenderQueue *queue = this->renderQueue;
+	const GLsizei firstCommand = *commandCount;
+
+	const GLboolean culled = this->culling->pending && !isAfterOpaqueTiles(&queue->items[first]);
+	const GLboolean impostors = this->culling->impostorsPending && !isTransparent(&queue->items[first]);
+	GLsizei count, size;
+	for (count = 0; first + count < queue->count
+			&& isSameDrawState(&queue->items[first], &queue->items[first + count])
+			&& !(culled && isAfterOpaqueTiles(&queue->items[first + count]))
+			&& !(impostors && isTransparent(&queue->items[first + count])); count += size) {
+		const RenderItem *item = &queue->items[first + count];
+		size = getBatchSize(queue, first + count);
+
+		DrawElementsIndirectCommand *command = &queue->commands[(*commandCount)++];
+		command->count = item->indexCount;
+		command->instanceCount = size;
+		command->firstIndex = item->mesh->firstIndex + item->firstIndex;
+		command->baseVertex = item->mesh->baseVertex;
+		command->baseInstance = first + count;
+	}
+
+	const GLsizei commands = *commandCount - firstCommand;
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawElementsIndirectCommand) * firstCommand,
+			sizeof(DrawElementsIndirectCommand) * commands, &queue->commands[firstCommand]);
+
+	/** The instance attribute is offset by the base instance of the commands */
+	int j;
+	for (j = 0; j < 4; ++j)
+		glVertexAttribPointer(INSTANCE_MAT_ATTRIBUTE + j, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat[16]),
+				(void *) (sizeof(GLfloat[4]) * j));
+
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+			(void *) (sizeof(DrawElementsIndirectCommand) * firstCommand), commands, 0);
+
+	queue->current.bindsSaved += 3 * (count - 1);
+	queue->current.indirectCommands += commands;
+	return count;
+}
+
+/**
+ * Check if a sorted item is drawn after the opaque tiles (and the result of the GPU culling)
+ *
+ * The culled meshes are loaded before the static batches, so they are drawn before the
+ * queued objects, like they would be by the mesh ids in the sort key.
+ */
+static GLboolean isAfterOpaqueTiles(const RenderItem *item) {
+	return (item->key >> 61) > (((GLuint64) RP_OPAQUE << 2) | RL_TILES);
+}
+
+/**
+ * Check if a sorted item is in the transparent pass (drawn after the culled impostors)
+ */
+static GLboolean isTransparent(const RenderItem *item) {
+	return (item->key >> 63) == RP_TRANSPARENT;
+}
+
+/**
+ * Sort and execute the submitted draw calls
+ *
+ * The result of the GPU culling (if any) is drawn after the opaque tiles, its impostors
+ * before the transparent items.
+ *
+ * The shader variant of the items is selected with useShaderVariant().
+ *
+ * @note The camera must be updated and the light textures must be bound before.
+ *
+ * @param this Actual GameInstance instance
+ */
+void flushRenderQueue(GameInstance *this) {
+	RenderQueue *queue = this->renderQueue;
+	RenderStats *stats = &queue->current;
+
+	if (this->font != NULL)
+		this->font->lastFlush = this->font->useCounter;
+	if (queue->count == 0 && !this->culling->pending && !this->culling->impostorsPending)
+		return;
+
+	qsort(queue->items, queue->count, sizeof(RenderItem), compareRenderItems);
+
+	int i, j;
+	for (i = 0; i < queue->count; ++i)
+		memcpy(queue->matrices[i], queue->items[i].moveMat, sizeof(GLfloat[16]));
+
+	/** Orphan the previous content, so the upload does not wait for the last frame */
+	glBindBuffer(GL_ARRAY_BUFFER, queue->instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat[16]) * queue->capacity, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat[16]) * queue->count, queue->matrices);
+
+	const GLboolean multiDraw = queue->indirectBuffer != 0;
+	if (multiDraw) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, queue->indirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawElementsIndirectCommand) * queue->capacity,
+				NULL, GL_STREAM_DRAW);
+	}
+
+	RenderItem *previous = NULL;
+	GLsizei count, commandCount = 0;
+	for (i = 0; i < queue->count; i += count) {
+		RenderItem *item = &queue->items[i];
+
+		if (this->culling->pending && isAfterOpaqueTiles(item)) {
+			useShaderVariant(this, this->lighting->variant);
+			drawCulledInstances(this);
+			glBindBuffer(GL_ARRAY_BUFFER, queue->instanceBuffer);
+			if (multiDraw)
+				glBindBuffer(GL_DRAW_INDIRECT_BUFFER, queue->indirectBuffer);
+			previous = NULL;
+		}
+
+		if (this->culling->impostorsPending && isTransparent(item)) {
+			useShaderVariant(this, this->lighting->variant);
+			drawCulledImpostors(this);
+			glBindBuffer(GL_ARRAY_BUFFER, queue->instanceBuffer);
+			if (multiDraw)
+				glBindBuffer(GL_DRAW_INDIRECT_BUFFER, queue->indirectBuffer);
+			previous = NULL;
+		}
+
+		if (previous == NULL || item->variant != previous->variant) {
+			useShaderVariant(this, item->variant);
+			previous = NULL;
+		}
+
+		if (previous == NULL || item->texture != previous->texture) {
+			bindTexture(this, 0, GL_TEXTURE_2D_ARRAY, item->texture);
+			++stats->textureBinds;
+		} else {
+			++stats->bindsSaved;
+		}
+
+		if (previous == NULL || item->mesh->vao != previous->mesh->vao) {
+			bindVertexArray(this, item->mesh->vao);
+			setUniform1i(this, this->shader->packedFaces, item->mesh->packed);
+			++stats->meshBinds;
+		} else {
+			++stats->bindsSaved;
+		}
+
+		if (previous == NULL || memcmp(item->baseColor, previous->baseColor, sizeof(item->baseColor)) != 0) {
+			setUniform4fv(this, this->shader->baseColor, 1, item->baseColor);
+			++stats->uniformUploads;
+		} else {
+			++stats->bindsSaved;
+		}
+
+		if (multiDraw && item->mesh->shared) {
+			count = drawIndirect(this, i, &commandCount);
+		} else {
+			count = getBatchSize(queue, i);
+			stats->bindsSaved += 3 * (count - 1);
+
+			/** The instance attribute of the batch starts at the first item of the batch */
+			for (j = 0; j < 4; ++j)
+				glVertexAttribPointer(INSTANCE_MAT_ATTRIBUTE + j, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat[16]),
+						(void *) (sizeof(GLfloat[16]) * i + sizeof(GLfloat[4]) * j));
+
+			glDrawElementsInstanced(GL_TRIANGLES, item->indexCount, GL_UNSIGNED_INT,
+					(void *) (sizeof(GLuint) * item->firstIndex), count);
+		}
+		++stats->drawCalls;
+		previous = item;
+	}
+	if (this->culling->pending || this->culling->impostorsPending) {
+		useShaderVariant(this, this->lighting->variant);
+		drawCulledInstances(this);
+		drawCulledImpostors(this);
+	}
+
+	stats->items += queue->count;
+	queue->count = 0;
+	bindVertexArray(this, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if (multiDraw)
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+/**
+ * Flush the queue and publish the counters of the frame
+ *
+ * @param this Actual GameInstance instance
+ * @see RenderQueue::last
+ */
+void endRenderFrame(GameInstance *this) {
+	RenderQueue *queue = this->renderQueue;
+
+	flushRenderQueue(this);
+	queue->last = queue->current;
+	memset(&queue->current, 0, sizeof(RenderStats));
+}
+
+/**
+ * Free the storage of the queue
+ *
+ * @param queue The queue
+ */
+void freeRenderQueue(RenderQueue *queue) {
+	glDeleteBuffers(1, &queue->instanceBuffer);
+	if (queue->indirectBuffer != 0)
+		glDeleteBuffers(1, &queue->indirectBuffer);
+	free(queue->items);
+	free(queue->matrices);
+	free(queue->commands);
+	queue->items = NULL;
+	queue->matrices = NULL;
+	queue->commands = NULL;
+	queue->count = 0;
+}
@@ -0,0 +1,130 @@
+/**
+ * @file renderqueue.h
+ * @author Gerviba (Szabo Gergely)
+ * @brief Sorted render queue (header)
+ *
+ * @par Definition:
+ * 		renderqueue.c
+ */
+
+#ifndef RENDERQUEUE_H_
+#define RENDERQUEUE_H_
+
+#include "stdgame.h"
+
+/** Initial capacity of the render queue */
+#define RENDER_QUEUE_CAPACITY 256
+
+/** Render passes (executed in this order) */
+typedef enum {
+	/** Sorted by texture, material, then front-to-back (early depth test) */
+	RP_OPAQUE = 0,
+	/** Sorted back-to-front, so the blending is applied in the right order */
+	RP_TRANSPARENT = 1
+} RenderPass;
+
+/**
+ * Render layers
+ *
+ * The depth test is GL_LEQUAL, so an item of a later layer wins on coplanar faces
+ * (eg. objects and texts placed onto the tile faces).
+ */
+typedef enum {
+	RL_TILES = 0,
+	RL_OBJECTS = 1,
+	RL_OVERLAY = 2
+} RenderLayer;
+
+/**
+ * One submitted draw call
+ *
+ * The sort key (from the highest bits):
+ *  - opaque: pass (1), layer (2), texture (11), material (18), depth (16), sequence (16)
+ *  - transparent: pass (1), inverted depth (16), layer (2), texture (11), material (18), sequence (16)
+ *
+ * The material is the id of the mesh. The sequence keeps the submit order of equal items.
+ */
+struct RenderItem {
+	GLuint64 key;
+	Mesh *mesh;
+	/** Range of the drawn indices */
+	GLsizei firstIndex;
+	GLsizei indexCount;
+	GLuint texture;
+	GLfloat moveMat[16];
+	GLfloat baseColor[4];
+	/** ShaderVariant of the item (unlit in the overlay layer) */
+	GLint variant;
+};
+
+/**
+ * Command of glMultiDrawElementsIndirect() (layout defined by OpenGL)
+ *
+ * The base instance selects the move matrix of the first instance in the instance buffer.
+ */
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+/**
+ * Counters of a frame (all the flushes of the frame)
+ *
+ * The counters of the last frame are printed by the H key (see onKeyEvent()).
+ */
+struct RenderStats {
+	GLuint items;
+	/** Instanced draw calls (one per batch) and multi-draw calls */
+	GLuint drawCalls;
+	/** Batches drawn by the multi-draw calls */
+	GLuint indirectCommands;
+	GLuint textureBinds;
+	GLuint meshBinds;
+	GLuint uniformUploads;
+	/** Texture, VAO and uniform changes skipped because the previous item used the same value */
+	GLuint bindsSaved;
+	/** Calls passed to OpenGL and skipped by the GLStateCache (the value was already set) */
+	GLuint stateChanges;
+	GLuint stateSkipped;
+};
+
+/**
+ * Draw calls of the frame, executed at the end of onRender()
+ *
+ * Consecutive items (after sorting) with the same mesh, texture and base color are drawn
+ * as one instanced batch. The move matrices are uploaded into the instance buffer
+ * (INSTANCE_MAT_ATTRIBUTE) once per flush.
+ *
+ * If the SceneBuffer is enabled, the consecutive batches of the shared meshes with the same
+ * texture and base color are drawn with one glMultiDrawElementsIndirect() call.
+ */
+struct RenderQueue {
+	RenderItem *items;
+	GLsizei count;
+	GLsizei capacity;
+	/** Move matrices of the sorted items (CPU side copy of the instance buffer) */
+	GLfloat (*matrices)[16];
+	GLuint instanceBuffer;
+	/** Commands of the multi-draw calls of the flush (CPU side copy of the indirect buffer) */
+	DrawElementsIndirectCommand *commands;
+	GLuint indirectBuffer;
+	/** Counters of the current frame (moved into last and reset by endRenderFrame()) */
+	RenderStats current;
+	/** Counters of the last frame */
+	RenderStats last;
+};
+
+void initRenderQueue(RenderQueue *queue);
+void initInstanceBuffer(RenderQueue *queue, GLboolean multiDraw);
+void submitRenderItem(GameInstance *this, RenderLayer layer, Mesh *mesh, GLuint texture,
+		const GLfloat moveMat[16], const GLfloat baseColor[4]);
+void submitRenderRange(GameInstance *this, RenderLayer layer, Mesh *mesh, GLsizei firstIndex,
+		GLsizei indexCount, GLuint texture, const GLfloat moveMat[16], const GLfloat baseColor[4]);
+void flushRenderQueue(GameInstance *this);
+void endRenderFrame(GameInstance *this);
+void freeRenderQueue(RenderQueue *queue);
+
+#endif /* RENDERQUEUE_H_ */
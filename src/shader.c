@@ -11,9 +11,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
 #include <gl.h>
 #include <glext.h>
 #include "stdgame.h"
+#include "shader.h"
+
+static unsigned long long hashString(unsigned long long hash, const char *str);
 
 /**
  * Load shader from file
@@ -62,39 +70,35 @@ static char* shaderLoadSource(const char *filePath) {
 /**
  * Compile shader program
  *
+ * The defines are inserted after the `#version` line (if there is one). The compile status
+ * is not queried here (it would wait for the compiler), see shaderCheckProgram().
+ *
  * @param type Vertex or Fragment shader
  * @param filePath The shader file's path
+ * @param defines Preprocessor lines of the variant (can be empty)
  */
-static GLuint shaderCompileFromFile(GLenum type, const char *filePath) {
+static GLuint shaderCompileFromFile(GLenum type, const char *filePath, const char *defines) {
 	char *source;
 	GLuint shader;
-	GLint length, result;
 
 	source = shaderLoadSource(filePath);
 	if (!source)
 		return 0;
 
+	const char *body = source;
+	if (strncmp(source, "#version", 8) == 0) {
+		body = strchr(source, '\n');
+		body = body == NULL ? source + strlen(source) : body + 1;
+	}
+
+	const char *sources[3] = {source, defines, body};
+	GLint lengths[3] = {body - source, strlen(defines), strlen(body)};
+
 	shader = glCreateShader(type);
-	length = strlen(source);
-	glShaderSource(shader, 1, (const char **) &source, &length);
+	glShaderSource(shader, 3, sources, lengths);
 	glCompileShader(shader);
 	free(source);
 
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
-	if (result == GL_FALSE) {
-		char *log;
-
-		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
-		log = malloc(length);
-		glGetShaderInfoLog(shader, length, &result, log);
-
-		ERROR("Unable to compile shader program %s: %s", filePath, log);
-		free(log);
-
-		glDeleteShader(shader);
-		return 0;
-	}
-
 	return shader;
 }
 
@@ -105,12 +109,208 @@ static GLuint shaderCompileFromFile(GLenum type, const char *filePath) {
  * @param program identifier
  * @param type Vertex or Fragment shader
  * @param filePath The shader file's path
+ * @param defines Preprocessor lines of the variant (eg. "#define UNLIT\n", can be empty)
  */
-GLuint shaderAttachFromFile(GLuint program, GLenum type, const char *filePath) {
-	GLuint shader = shaderCompileFromFile(type, filePath);
+GLuint shaderAttachFromFile(GLuint program, GLenum type, const char *filePath, const char *defines) {
+	GLuint shader = shaderCompileFromFile(type, filePath, defines);
 	if (shader != 0) {
 		glAttachShader(program, shader);
 		glDeleteShader(shader);
 	}
 	return shader;
 }
+
+/**
+ * Check the link status of a program
+ *
+ * The compile logs of the attached shaders are also printed if the linking failed.
+ *
+ * @param program identifier
+ * @param name Name of the program (for the error messages)
+ * @return The program is linked successfully
+ */
+GLboolean shaderCheckProgram(GLuint program, const char *name) {
+	GLint result, length;
+	char *log;
+
+	glGetProgramiv(program, GL_LINK_STATUS, &result);
+	if (result == GL_TRUE)
+		return GL_TRUE;
+
+	GLuint shaders[2];
+	GLsizei count, i;
+	glGetAttachedShaders(program, 2, &count, shaders);
+	for (i = 0; i < count; ++i) {
+		glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &result);
+		if (result == GL_TRUE)
+			continue;
+
+		glGetShaderiv(shaders[i], GL_INFO_LOG_LENGTH, &length);
+		log = malloc(length);
+		glGetShaderInfoLog(shaders[i], length, &result, log);
+
+		ERROR("Unable to compile shader of %s: %s", name, log);
+		free(log);
+	}
+
+	glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+	log = malloc(length);
+	glGetProgramInfoLog(program, length, &result, log);
+
+	ERROR("%s program linking failed: %s", name, log);
+	free(log);
+	return GL_FALSE;
+}
+
+/**
+ * Let the driver compile the shaders on multiple threads (KHR_parallel_shader_compile)
+ *
+ * The compile and link calls return immediately, the status queries wait for the result.
+ * So every program should be linked before the first status query.
+ */
+void shaderEnableParallelCompile(void) {
+	if (glfwExtensionSupported("GL_KHR_parallel_shader_compile")) {
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		DEBUG("Shader", "Parallel shader compile enabled");
+	}
+}
+
+/**
+ * FNV-1a hash of a string
+ *
+ * @param hash Hash of the previous data
+ * @param str The string
+ * @return The new hash
+ */
+static unsigned long long hashString(unsigned long long hash, const char *str) {
+	for (; *str != '\0'; ++str) {
+		hash ^= (unsigned char) *str;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+ * Get the binary cache file of a program
+ *
+ * The key is the hash of the shader sources, the defines, GL_RENDERER and GL_VERSION, so
+ * the binaries are not reused after a driver or shader change.
+ *
+ * @param path Output path (SHADER_CACHE_PATH_LENGTH characters)
+ * @param filePaths The shader files of the program
+ * @param fileCount Count of the shader files
+ * @param defines Preprocessor lines of the variant (can be empty)
+ * @return The cache can be used (program binaries are supported)
+ */
+GLboolean shaderGetCachePath(char *path, const char **filePaths, int fileCount, const char *defines) {
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (formats <= 0)
+		return GL_FALSE;
+
+	unsigned long long hash = 14695981039346656037ULL;
+	int i;
+	for (i = 0; i < fileCount; ++i) {
+		char *source = shaderLoadSource(filePaths[i]);
+		if (!source)
+			return GL_FALSE;
+		hash = hashString(hash, source);
+		free(source);
+	}
+	hash = hashString(hash, defines);
+	hash = hashString(hash, (const char*) glGetString(GL_RENDERER));
+	hash = hashString(hash, (const char*) glGetString(GL_VERSION));
+
+	snprintf(path, SHADER_CACHE_PATH_LENGTH, SHADER_CACHE_DIR "/%016llx.bin", hash);
+	return GL_TRUE;
+}
+
+/**
+ * Load a program from the binary cache
+ *
+ * The file is:
+ * 		"GLPB" | format (GLenum) | length (GLint) | binary
+ *
+ * @param program identifier (it must not have attached shaders)
+ * @param path Cache file (see shaderGetCachePath())
+ * @return The program is linked from the cache (the driver can reject old binaries)
+ */
+GLboolean shaderLoadBinary(GLuint program, const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return GL_FALSE;
+
+	char magic[4];
+	GLenum format;
+	GLint length;
+	void *binary = NULL;
+	GLboolean loaded = GL_FALSE;
+
+	if (fread(magic, 1, 4, file) == 4 && memcmp(magic, "GLPB", 4) == 0
+			&& fread(&format, sizeof(GLenum), 1, file) == 1
+			&& fread(&length, sizeof(GLint), 1, file) == 1 && length > 0) {
+		binary = malloc(length);
+		if (fread(binary, 1, length, file) == (size_t) length) {
+			GLint result;
+			glProgramBinary(program, format, binary, length);
+			glGetProgramiv(program, GL_LINK_STATUS, &result);
+			loaded = result == GL_TRUE;
+		}
+		free(binary);
+	}
+
+	fclose(file);
+	if (!loaded)
+		WARNING("Shader binary %s is rejected, compiling from source", path);
+	return loaded;
+}
+
+/**
+ * Save a linked program to the binary cache
+ *
+ * @note GL_PROGRAM_BINARY_RETRIEVABLE_HINT must be set before linking.
+ *
+ * @param program identifier
+ * @param path Cache file (see shaderGetCachePath())
+ */
+void shaderSaveBinary(GLuint program, const char *path) {
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	void *binary = malloc(length);
+	GLenum format;
+	glGetProgramBinary(program, length, &length, &format, binary);
+
+#ifdef _WIN32
+	if (_mkdir(SHADER_CACHE_DIR) != 0 && errno != EEXIST) {
+#else
+	if (mkdir(SHADER_CACHE_DIR, 0755) != 0 && errno != EEXIST) {
+#endif
+		WARNING("Unable to create %s", SHADER_CACHE_DIR);
+		free(binary);
+		return;
+	}
+
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		WARNING("Unable to open %s for writing", path);
+		free(binary);
+		return;
+	}
+
+	GLboolean written = fwrite("GLPB", 1, 4, file) == 4
+			&& fwrite(&format, sizeof(GLenum), 1, file) == 1
+			&& fwrite(&length, sizeof(GLint), 1, file) == 1
+			&& fwrite(binary, 1, length, file) == (size_t) length;
+	if (fclose(file) != 0)
+		written = GL_FALSE;
+
+	// A truncated binary would be rejected at every start
+	if (!written) {
+		WARNING("Unable to write %s", path);
+		remove(path);
+	}
+	free(binary);
+}
@@ -10,6 +10,17 @@
 #ifndef SHADER_H_
 #define SHADER_H_
 
-GLuint shaderAttachFromFile(GLuint program, GLenum type, const char *filePath);
+/** Directory of the program binaries */
+#define SHADER_CACHE_DIR "data/shadercache"
+/** Max length of a cache file path */
+#define SHADER_CACHE_PATH_LENGTH 64
+
+GLuint shaderAttachFromFile(GLuint program, GLenum type, const char *filePath, const char *defines);
+GLboolean shaderCheckProgram(GLuint program, const char *name);
+void shaderEnableParallelCompile(void);
+
+GLboolean shaderGetCachePath(char *path, const char **filePaths, int fileCount, const char *defines);
+GLboolean shaderLoadBinary(GLuint program, const char *path);
+void shaderSaveBinary(GLuint program, const char *path);
 
 #endif /* SHADER_H_ */
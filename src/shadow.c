@@ -0,0 +1,355 @@
+/**
+ * @file shadow.c
+ * @author Gerviba (Szabo Gergely)
+ * @brief Cached shadow maps of the nearest lights
+ *
+ * @par Header:
+ * 		shadow.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stdgame.h"
+
+static GLint getShadowLightCount(GameInstance *this);
+static GLboolean allocateShadowMaps(ShadowMaps *shadows, GLint resolution, GLint count);
+static void updateShadowSlot(ShadowSlot *slot, const GLfloat position[3], GLfloat range);
+static void submitStaticCasters(GameInstance *this);
+static void submitDynamicCasters(GameInstance *this);
+static void renderShadowLayer(GameInstance *this, GLuint texture, GLint layer);
+
+/**
+ * Initialize the shadow maps (the textures are created when they are first used)
+ *
+ * @note Must be called after the OpenGL context is (re)created.
+ *
+ * @param shadows The shadow maps
+ */
+void initShadowMaps(ShadowMaps *shadows) {
+	memset(shadows, 0, sizeof(ShadowMaps));
+}
+
+/**
+ * Count of the lights with shadows by the options
+ *
+ * @param this Actual GameInstance instance
+ * @return 0 if the shadows are disabled (or not supported)
+ */
+static GLint getShadowLightCount(GameInstance *this) {
+	if (!this->options->shadow || this->lighting->shadows.unsupported)
+		return 0;
+	return max(0, min(this->options->shadowLights, MAX_SHADOW_LIGHTS));
+}
+
+/**
+ * (Re)create the shadow map textures
+ *
+ * All the slots are invalidated. The framebuffer is checked when it is created.
+ *
+ * @param shadows The shadow maps
+ * @param resolution Width and height of the layers
+ * @param count Count of the layers
+ * @return GL_FALSE if the framebuffer is not complete
+ */
+static GLboolean allocateShadowMaps(ShadowMaps *shadows, GLint resolution, GLint count) {
+	const GLboolean created = shadows->framebuffer == 0;
+	if (created) {
+		glGenFramebuffers(1, &shadows->framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, shadows->framebuffer);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+	}
+
+	if (shadows->staticTexture != 0) {
+		glDeleteTextures(1, &shadows->staticTexture);
+		glDeleteTextures(1, &shadows->dynamicTexture);
+	}
+
+	GLuint *textures[2] = {&shadows->staticTexture, &shadows->dynamicTexture};
+	int i;
+	for (i = 0; i < 2; ++i) {
+		glGenTextures(1, textures[i]);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, *textures[i]);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, count, 0,
+				GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	if (created) {
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadows->staticTexture, 0, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			WARNING("Shadow framebuffer is not complete, the shadows are disabled");
+			shadows->unsupported = GL_TRUE;
+			return GL_FALSE;
+		}
+	}
+
+	shadows->resolution = resolution;
+	shadows->count = count;
+	for (i = 0; i < MAX_SHADOW_LIGHTS; ++i) {
+		shadows->slots[i].staticValid = GL_FALSE;
+		shadows->slots[i].dynamicEmpty = GL_FALSE;
+	}
+
+	DEBUG("Shadow", "Shadow maps: %d lights, %dx%d", count, resolution, resolution);
+	return GL_TRUE;
+}
+
+/**
+ * Update the light position and range of a slot
+ *
+ * The static layer is invalidated if the light is moved.
+ *
+ * @param slot The slot
+ * @param position Position of the light
+ * @param range Range of the light
+ */
+static void updateShadowSlot(ShadowSlot *slot, const GLfloat position[3], GLfloat range) {
+	if (slot->staticValid && memcmp(slot->position, position, sizeof(GLfloat[3])) == 0 && slot->range == range)
+		return;
+
+	GLfloat viewMat[16];
+	mat4Perspective(slot->lightMat, SHADOW_FOV, 1.0f, SHADOW_NEAR, range);
+	mat4Identity(viewMat);
+	mat4Translate(viewMat, -position[X], -position[Y], -position[Z]);
+	mat4Multiply(slot->lightMat, slot->lightMat, viewMat);
+
+	memcpy(slot->position, position, sizeof(GLfloat[3]));
+	slot->range = range;
+	slot->staticValid = GL_FALSE;
+}
+
+/**
+ * Select the lights with shadows and set their slots in the light block
+ *
+ * The lights nearest to the center of the view get the shadows (Options::shadowLights).
+ * The selected lights keep their slots while they are selected, so the static layers stay
+ * valid. The 4th component of the lightInfo is the layer of the light (-1 if it has no shadow).
+ *
+ * @param this Actual GameInstance instance
+ * @param block The light block (the lights are already set)
+ * @param lights The lights of the block
+ */
+void assignShadowLights(GameInstance *this, LightBlock *block, Light **lights) {
+	ShadowMaps *shadows = &this->lighting->shadows;
+	const GLint count = getShadowLightCount(this);
+	GLint selected[MAX_SHADOW_LIGHTS];
+	GLboolean used[MAX_SHADOW_LIGHTS] = {GL_FALSE};
+	GLint selectedCount, i, s;
+
+	for (i = 0; i < block->numLights; ++i)
+		block->lightInfo[i][3] = -1.0f;
+
+	for (selectedCount = 0; selectedCount < count; ++selectedCount) {
+		GLint nearest = -1;
+		GLfloat nearestDist = 0.0f;
+		for (i = 0; i < block->numLights; ++i) {
+			GLfloat dist = getDistSquared2D(block->lightPosition[i], this->camera->position);
+			if (block->lightInfo[i][3] == -1.0f && (nearest == -1 || dist < nearestDist)) {
+				nearest = i;
+				nearestDist = dist;
+			}
+		}
+		if (nearest == -1)
+			break;
+
+		/** Selected, but no slot yet */
+		block->lightInfo[nearest][3] = -2.0f;
+		selected[selectedCount] = nearest;
+	}
+
+	for (i = 0; i < selectedCount; ++i) {
+		for (s = 0; s < count; ++s) {
+			if (!used[s] && shadows->slots[s].light == lights[selected[i]]) {
+				block->lightInfo[selected[i]][3] = s;
+				used[s] = GL_TRUE;
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < selectedCount; ++i) {
+		if (block->lightInfo[selected[i]][3] != -2.0f)
+			continue;
+		for (s = 0; used[s]; ++s);
+
+		shadows->slots[s].light = lights[selected[i]];
+		shadows->slots[s].staticValid = GL_FALSE;
+		shadows->slots[s].dynamicEmpty = GL_FALSE;
+		block->lightInfo[selected[i]][3] = s;
+		used[s] = GL_TRUE;
+	}
+
+	for (s = 0; s < MAX_SHADOW_LIGHTS; ++s)
+		if (!used[s])
+			shadows->slots[s].light = NULL;
+
+	for (i = 0; i < selectedCount; ++i) {
+		s = (GLint) block->lightInfo[selected[i]][3];
+		updateShadowSlot(&shadows->slots[s], block->lightPosition[selected[i]],
+				getLightRange(block, selected[i]));
+		memcpy(block->shadowMat[s], shadows->slots[s].lightMat, sizeof(GLfloat[16]));
+	}
+}
+
+/**
+ * Invalidate the static layers of the shadow maps
+ *
+ * Must be called if the static shadow casters are changed (the map is loaded, a tile is
+ * changed, a static object is shown or hidden, or an object or a physics area is changed
+ * by an action).
+ *
+ * @param this Actual GameInstance instance
+ */
+void invalidateShadowMaps(GameInstance *this) {
+	int i;
+	for (i = 0; i < MAX_SHADOW_LIGHTS; ++i)
+		this->lighting->shadows.slots[i].staticValid = GL_FALSE;
+}
+
+/**
+ * Submit the static shadow casters into the render queue
+ *
+ * The tiles, the static objects and the dynamic objects of the fixed reference point.
+ *
+ * @param this Actual GameInstance instance
+ */
+static void submitStaticCasters(GameInstance *this) {
+	renderTileChunks(this);
+	renderStaticBatches(this);
+
+	Iterator it;
+	foreach (it, this->map->objects->dynamicInstances->first) {
+		DynamicObjectInstance *instance = it->data;
+		if (instance->reference->id == FIXED_REFERENCEPOINT_ID)
+			renderDynamicObject(this, instance);
+	}
+}
+
+/**
+ * Submit the dynamic shadow casters into the render queue
+ *
+ * The active objects and the dynamic objects of the moving reference points.
+ *
+ * @param this Actual GameInstance instance
+ */
+static void submitDynamicCasters(GameInstance *this) {
+	Iterator it;
+	foreach (it, this->map->objects->dynamicInstances->first) {
+		DynamicObjectInstance *instance = it->data;
+		if (instance->reference->id != FIXED_REFERENCEPOINT_ID)
+			renderDynamicObject(this, instance);
+	}
+	foreach (it, this->map->objects->activeInstances->first)
+		renderActiveObject(this, it->data);
+}
+
+/**
+ * Render the submitted items into a layer of a shadow map
+ *
+ * @param this Actual GameInstance instance
+ * @param texture The shadow map
+ * @param layer The layer
+ */
+static void renderShadowLayer(GameInstance *this, GLuint texture, GLint layer) {
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, layer);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	flushRenderQueue(this);
+}
+
+/**
+ * Render the invalid static layers and the dynamic layers of the shadow maps
+ *
+ * The casters are rendered with the unlit variant from the lights (the camera is replaced
+ * while rendering). The shadow maps are bound to SHADOW_TEXTURE_UNIT and the next unit.
+ *
+ * @note Must be called after the lights are assigned and before the items of the frame
+ * are submitted.
+ *
+ * @param this Actual GameInstance instance
+ */
+void renderShadowMaps(GameInstance *this) {
+	ShadowMaps *shadows = &this->lighting->shadows;
+	const GLint count = getShadowLightCount(this);
+	if (count == 0)
+		return;
+
+	const CameraInfo camera = *this->camera;
+	const ShaderVariant variant = this->lighting->variant;
+	GLint viewport[4], framebuffer;
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+
+	if (shadows->resolution != this->options->shadowResolution || shadows->count != count) {
+		const GLboolean complete = allocateShadowMaps(shadows, this->options->shadowResolution, count);
+		invalidateStateCache(this->glState);
+		if (!complete) {
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			return;
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, shadows->framebuffer);
+	glViewport(0, 0, shadows->resolution, shadows->resolution);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(SHADOW_OFFSET_FACTOR, SHADOW_OFFSET_UNITS);
+	this->lighting->variant = SV_UNLIT;
+	mat4Identity(this->camera->viewMat);
+
+	int i;
+	for (i = 0; i < count; ++i) {
+		ShadowSlot *slot = &shadows->slots[i];
+		if (slot->light == NULL)
+			continue;
+
+		memcpy(this->camera->projMat, slot->lightMat, sizeof(GLfloat[16]));
+		setPositionArray(this->camera->position, slot->position);
+		extractFrustumPlanes(this->camera->frustum, slot->lightMat);
+
+		if (!slot->staticValid) {
+			submitStaticCasters(this);
+			renderShadowLayer(this, shadows->staticTexture, i);
+			slot->staticValid = GL_TRUE;
+			++shadows->staticRenders;
+		}
+
+		/** An empty layer is not cleared again */
+		submitDynamicCasters(this);
+		if (this->renderQueue->count > 0 || !slot->dynamicEmpty) {
+			slot->dynamicEmpty = this->renderQueue->count == 0;
+			renderShadowLayer(this, shadows->dynamicTexture, i);
+		}
+	}
+
+	*this->camera = camera;
+	this->lighting->variant = variant;
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+	bindTexture(this, SHADOW_TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, shadows->staticTexture);
+	bindTexture(this, SHADOW_TEXTURE_UNIT + 1, GL_TEXTURE_2D_ARRAY, shadows->dynamicTexture);
+}
+
+/**
+ * Delete the textures of the shadow maps
+ *
+ * @param shadows The shadow maps
+ */
+void freeShadowMaps(ShadowMaps *shadows) {
+	if (shadows->staticTexture != 0) {
+		glDeleteTextures(1, &shadows->staticTexture);
+		glDeleteTextures(1, &shadows->dynamicTexture);
+	}
+	if (shadows->framebuffer != 0)
+		glDeleteFramebuffers(1, &shadows->framebuffer);
+	initShadowMaps(shadows);
+}
@@ -0,0 +1,77 @@
+/**
+ * @file shadow.h
+ * @author Gerviba (Szabo Gergely)
+ * @brief Cached shadow maps of the nearest lights (header)
+ *
+ * @par Definition:
+ * 		shadow.c
+ */
+
+#ifndef SHADOW_H_
+#define SHADOW_H_
+
+#include "stdgame.h"
+
+/** Maximum count of the lights with shadows (same as in the fragment shader) */
+#define MAX_SHADOW_LIGHTS 4
+/** Texture unit of the static shadow maps (the dynamic ones use the next one) */
+#define SHADOW_TEXTURE_UNIT 5
+/** Field of view of the shadow maps (the lights look towards -Z, to the tiles) */
+#define SHADOW_FOV 150.0f
+/** Near plane of the shadow maps */
+#define SHADOW_NEAR 0.05f
+/** Polygon offset of the shadow casters (factor and units) */
+#define SHADOW_OFFSET_FACTOR 2.0f
+#define SHADOW_OFFSET_UNITS 4.0f
+
+/**
+ * A light with shadow maps (one layer of both shadow map arrays)
+ */
+struct ShadowSlot {
+	/** The light of the slot (NULL if the slot is free) */
+	const Light *light;
+	/** Position and range of the light (the static layer is rendered with these) */
+	GLfloat position[3];
+	GLfloat range;
+	/** Projection * view matrix of the light */
+	GLfloat lightMat[16];
+	/** The static layer is up to date */
+	GLboolean staticValid;
+	/** The dynamic layer was cleared and nothing was rendered into it */
+	GLboolean dynamicEmpty;
+};
+
+/**
+ * Shadow maps of the nearest lights (Options::shadow)
+ *
+ * Every light with shadows has a slot. The light looks towards -Z (the lights are in
+ * front of the tiles), so one 2D depth map is enough for a light.
+ *
+ * The static layer (tiles, static objects and the dynamic objects of the fixed reference
+ * point) is rendered only if the light is moved or the scene is changed (see
+ * invalidateShadowMaps()). The dynamic layer (active objects and the dynamic objects of the
+ * moving reference points) is rendered every frame, but only if there is anything to render.
+ * The fragment shader uses the minimum of the two layers.
+ *
+ * The budget is set by Options::shadowResolution and Options::shadowLights.
+ */
+struct ShadowMaps {
+	GLint resolution;
+	GLint count;
+	GLuint staticTexture;
+	GLuint dynamicTexture;
+	GLuint framebuffer;
+	ShadowSlot slots[MAX_SHADOW_LIGHTS];
+	/** Count of the static layers rendered since the maps were created */
+	GLuint staticRenders;
+	/** The framebuffer is not complete (the shadows are disabled) */
+	GLboolean unsupported;
+};
+
+void initShadowMaps(ShadowMaps *shadows);
+void assignShadowLights(GameInstance *this, LightBlock *block, Light **lights);
+void invalidateShadowMaps(GameInstance *this);
+void renderShadowMaps(GameInstance *this);
+void freeShadowMaps(ShadowMaps *shadows);
+
+#endif /* SHADOW_H_ */
@@ -32,14 +32,22 @@ int main(int argc, char *argv[]) {
 	GameInstance *this = new(GameInstance);
 	getGameInstance(&this);
 
-	this->shader = new(ShaderInfo);
+	this->shaders = calloc(SHADER_VARIANT_COUNT, sizeof(ShaderInfo));
+	this->shader = &this->shaders[SV_LIT];
 	this->lighting = new(LigingInfo);
-	this->lighting->numLights = 0;
 	this->camera = new(CameraInfo);
 	setRotation(this->camera->rotation, 0.0f, 0.0f, 0.0f);
 	this->options = new(Options);
 	this->options->selectedToSet = NULL;
 	this->player = NULL;
+	/** The map (and its impostors) is loaded before the font, see flushRenderQueue() */
+	this->font = NULL;
+	this->renderQueue = new(RenderQueue);
+	initRenderQueue(this->renderQueue);
+	this->sceneBuffer = new(SceneBuffer);
+	this->sceneBuffer->multiDraw = GL_FALSE;
+	this->culling = new(InstanceCulling);
+	this->glState = new(GLStateCache);
 
 	loadDefaultOptions(this);
 	loadOptions(this);
@@ -58,6 +66,7 @@ int main(int argc, char *argv[]) {
 		doGameLoop(this);
 
 		saveOptions(this);
+		freeFont(this);
 		glfwDestroyWindow(this->window);
 		glfwTerminate();
 	} while(this->options->reloadProgram);
@@ -75,16 +84,28 @@ int main(int argc, char *argv[]) {
  * @param this Actual GameInstance instance
  */
 static void freeGameInstance(GameInstance* this) {
-	free(this->shader);
+	free(this->shaders);
+	glDeleteBuffers(1, &this->lighting->uniformBuffer);
+	freeLightClusters(&this->lighting->clusters);
+	freeShadowMaps(&this->lighting->shadows);
+	freeLightMasks(&this->lighting->masks);
 	free(this->lighting);
 	free(this->camera);
 	free(this->options);
+	freeRenderQueue(this->renderQueue);
+	free(this->renderQueue);
+	freeInstanceCulling(this->culling);
+	free(this->culling);
+	freeSceneBuffer(this->sceneBuffer);
+	free(this->sceneBuffer);
+	free(this->glState);
 
 	if (this->player != NULL)
 		freePlayer(this);
 
 	int i;
 	for (i = 0; i < this->cursor->cursorObject->size; ++i) {
+		freeDynamicObjectMeshes(&this->cursor->cursorObject->parts[i]);
 		listFree(this->cursor->cursorObject->parts[i].parts);
 		free(this->cursor->cursorObject->parts[i].parts);
 	}
@@ -96,21 +117,6 @@ static void freeGameInstance(GameInstance* this) {
 	free(this->cursor->pointer);
 	free(this->cursor);
 
-	Iterator it;
-	foreach (it, this->font->chars->first) {
-		Char *c = it->data;
-		listFree(c->parts);
-		free(c->parts);
-	}
-	listFree(this->font->chars);
-	free(this->font->chars);
-
-	free(this->font->colors);
-	listFree(this->font->unknown->parts);
-	free(this->font->unknown->parts);
-	free(this->font->unknown);
-	free(this->font);
-
 	listFree(this->referencePoints);
 	free(this->referencePoints);
 	free(this);
@@ -197,10 +203,7 @@ static void setupOpenGL(GameInstance *this, double width, double height) {
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
 	setPerspective(this, PI / 4.0f, (float) width / (float) height, 0.1f, 200.0f);
-	glMatrixMode(GL_MODELVIEW);
 }
 
 /**
@@ -257,8 +260,6 @@ static void setPerspective(GameInstance *this, float fov, float aspect, float ne
 	this->camera->projMat[0xD] = 0.0f;
 	this->camera->projMat[0xE] = (2.0f * far * near) / (near - far);
 	this->camera->projMat[0xF] = 0.0f;
-
-	glMultMatrixf(this->camera->projMat);
 }
 
 /**
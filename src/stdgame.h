@@ -18,6 +18,7 @@
 //#define DEBUG_MALLOC 1
 #define DEBUG_MESSAGES 1
 //#define DEBUG_LIGHT 1
+//#define DEBUG_CULLING 1
 #define WARNING_MESSAGES 1
 /*******************************/
 
@@ -112,6 +113,7 @@ typedef struct Component Component;
 typedef struct CharPart CharPart;
 typedef struct Char Char;
 typedef struct Font Font;
+typedef struct TextMesh TextMesh;
 
 // map.h
 typedef struct Light Light;
@@ -129,11 +131,54 @@ typedef struct HighScoreValue HighScoreValue;
 // menu.h
 typedef struct Menu Menu;
 
+// mesh.h
+typedef struct Vertex Vertex;
+typedef struct FaceQuad FaceQuad;
+typedef struct MeshBuilder MeshBuilder;
+typedef struct PackedFace PackedFace;
+typedef struct Mesh Mesh;
+typedef struct SceneRange SceneRange;
+typedef struct SceneHeap SceneHeap;
+typedef struct SceneBuffer SceneBuffer;
+
+// chunk.h
+typedef struct TileChunk TileChunk;
+
+// cluster.h
+typedef struct LightClusters LightClusters;
+
+// shadow.h
+typedef struct ShadowSlot ShadowSlot;
+typedef struct ShadowMaps ShadowMaps;
+
+// lightmask.h
+typedef struct OcclusionGrid OcclusionGrid;
+typedef struct LightMask LightMask;
+typedef struct LightMasks LightMasks;
+
+// renderqueue.h
+typedef struct RenderItem RenderItem;
+typedef struct DrawElementsIndirectCommand DrawElementsIndirectCommand;
+typedef struct RenderStats RenderStats;
+typedef struct RenderQueue RenderQueue;
+
+// culling.h
+typedef struct CullInstance CullInstance;
+typedef struct CullMesh CullMesh;
+typedef struct CullReference CullReference;
+typedef struct InstanceCulling InstanceCulling;
+
+// glstate.h
+typedef struct ProgramUniforms ProgramUniforms;
+typedef struct GLStateCache GLStateCache;
+
 // object.h
 typedef struct StaticObjectPart StaticObjectPart;
 typedef struct PartColor PartColor;
+typedef struct PartOccupancy PartOccupancy;
 typedef struct StaticObject StaticObject;
 typedef struct StaticObjectInstance StaticObjectInstance;
+typedef struct StaticBatch StaticBatch;
 typedef struct ReferencePoint ReferencePoint;
 typedef struct DynamicObject DynamicObject;
 typedef struct DynamicObjectInstance DynamicObjectInstance;
@@ -149,6 +194,7 @@ typedef struct InputActionWrapper InputActionWrapper;
 typedef struct ShaderInfo ShaderInfo;
 typedef struct CameraInfo CameraInfo;
 typedef struct LigingInfo LigingInfo;
+typedef struct LightBlock LightBlock;
 
 /** PI constant */
 static const float PI = 3.14159265358979323846f;
@@ -170,11 +216,21 @@ static const float PI = 3.14159265358979323846f;
 #define A 3
 
 #include "linkedlist.h"
+#include "matrix.h"
+#include "mesh.h"
 #include "font.h"
 #include "object.h"
 #include "player.h"
 #include "components.h"
 #include "map.h"
+#include "chunk.h"
+#include "cluster.h"
+#include "shadow.h"
+#include "lightmask.h"
+#include "renderqueue.h"
+#include "culling.h"
+#include "glstate.h"
+#include "lod.h"
 #include "game.h"
 #include "events.h"
 